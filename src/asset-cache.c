@@ -0,0 +1,460 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#include "asset-cache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include <zlib.h>
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+#include <obs-module.h>
+#include <util/platform.h>
+#include "plugin-support.h"
+
+// Files smaller than this are not worth compressing
+#define MIN_COMPRESS_SIZE 256
+
+#define INDEX_PATH "/index.html"
+
+struct asset_cache {
+    struct asset *assets;
+    size_t count;
+};
+
+struct content_type {
+    const char *extension;
+    const char *type;
+    bool compressible;
+};
+
+static const struct content_type content_types[] = {
+    {".html", "text/html; charset=utf-8", true},
+    {".js", "text/javascript; charset=utf-8", true},
+    {".css", "text/css; charset=utf-8", true},
+    {".json", "application/json", true},
+    {".svg", "image/svg+xml", true},
+    {".txt", "text/plain; charset=utf-8", true},
+    {".wasm", "application/wasm", true},
+    {".png", "image/png", false},
+    {".jpg", "image/jpeg", false},
+    {".ico", "image/x-icon", false},
+    {".woff2", "font/woff2", false},
+};
+
+static const struct content_type default_content_type = {
+    "", "application/octet-stream", false
+};
+
+static const char *encoding_names[ASSET_ENCODING_COUNT] = {
+    [ASSET_ENCODING_IDENTITY] = NULL,
+    [ASSET_ENCODING_GZIP] = "gzip",
+    [ASSET_ENCODING_BROTLI] = "br",
+};
+
+static const char *etag_suffixes[ASSET_ENCODING_COUNT] = {
+    [ASSET_ENCODING_IDENTITY] = "",
+    [ASSET_ENCODING_GZIP] = "-gz",
+    [ASSET_ENCODING_BROTLI] = "-br",
+};
+
+static const struct content_type* get_content_type(const char *path) {
+    const char *extension = strrchr(path, '.');
+    if (!extension) return &default_content_type;
+
+    for (size_t i = 0; i < sizeof(content_types)/sizeof(content_types[0]); i++) {
+        if (strcasecmp(extension, content_types[i].extension) == 0) {
+            return &content_types[i];
+        }
+    }
+
+    return &default_content_type;
+}
+
+static uint64_t fnv1a_hash(const uint8_t *data, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static bool read_file(const char *path, uint8_t **data, size_t *len) {
+    FILE *file = os_fopen(path, "rb");
+    if (!file) return false;
+
+    int64_t size = os_fgetsize(file);
+    if (size < 0) {
+        fclose(file);
+        return false;
+    }
+
+    *data = bmalloc(size > 0 ? size : 1);
+    *len = fread(*data, 1, size, file);
+    fclose(file);
+
+    if (*len != (size_t) size) {
+        bfree(*data);
+        return false;
+    }
+
+    return true;
+}
+
+static bool gzip_compress(
+    const uint8_t *data,
+    size_t len,
+    uint8_t **out,
+    size_t *out_len
+) {
+    z_stream stream = {0};
+
+    // 16 added to the window bits selects the gzip wrapper
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9,
+            Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+
+    size_t bound = deflateBound(&stream, len);
+    *out = bmalloc(bound);
+
+    stream.next_in = (Bytef *) data;
+    stream.avail_in = len;
+    stream.next_out = *out;
+    stream.avail_out = bound;
+
+    int ret = deflate(&stream, Z_FINISH);
+    *out_len = stream.total_out;
+    deflateEnd(&stream);
+
+    if (ret != Z_STREAM_END) {
+        bfree(*out);
+        *out = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+static bool brotli_compress(
+    const uint8_t *data,
+    size_t len,
+    uint8_t **out,
+    size_t *out_len
+) {
+#ifdef HAVE_BROTLI
+    *out_len = BrotliEncoderMaxCompressedSize(len);
+    if (*out_len == 0) return false;
+
+    *out = bmalloc(*out_len);
+    if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW,
+            BROTLI_MODE_TEXT, len, data, out_len, *out)) {
+        bfree(*out);
+        *out = NULL;
+        return false;
+    }
+
+    return true;
+#else
+    UNUSED_PARAMETER(data);
+    UNUSED_PARAMETER(len);
+    UNUSED_PARAMETER(out);
+    UNUSED_PARAMETER(out_len);
+    return false;
+#endif
+}
+
+static char* format_header(
+    size_t *len,
+    const char *status,
+    const char *content_type,
+    const char *content_encoding,
+    const char *etag,
+    size_t content_length,
+    bool keep_alive
+) {
+    char buffer[512];
+    int written = snprintf(buffer, sizeof(buffer),
+        "HTTP/1.1 %s\r\n"
+        "%s%s%s"
+        "%s%s%s"
+        "Content-Length: %zu\r\n"
+        "ETag: %s\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Vary: Accept-Encoding\r\n"
+        "Connection: %s\r\n"
+        "\r\n",
+        status,
+        content_type ? "Content-Type: " : "",
+        content_type ? content_type : "",
+        content_type ? "\r\n" : "",
+        content_encoding ? "Content-Encoding: " : "",
+        content_encoding ? content_encoding : "",
+        content_encoding ? "\r\n" : "",
+        content_length,
+        etag,
+        keep_alive ? "keep-alive" : "close"
+    );
+
+    *len = written;
+    return bstrdup_n(buffer, written);
+}
+
+static void asset_response_set_headers(
+    struct asset_response *response,
+    const char *status,
+    const char *content_type,
+    const char *content_encoding,
+    const char *etag,
+    size_t content_length
+) {
+    response->header_keep_alive = format_header(
+        &response->header_keep_alive_len,
+        status, content_type, content_encoding, etag, content_length, true
+    );
+    response->header_close = format_header(
+        &response->header_close_len,
+        status, content_type, content_encoding, etag, content_length, false
+    );
+}
+
+static void asset_response_free(struct asset_response *response) {
+    bfree(response->header_keep_alive);
+    bfree(response->header_close);
+    bfree(response->body);
+}
+
+static bool asset_load(
+    struct asset *asset,
+    const char *file_path,
+    const char *url_path
+) {
+    uint8_t *data;
+    size_t len;
+    if (!read_file(file_path, &data, &len)) {
+        obs_log(LOG_WARNING, "Could not read asset %s", file_path);
+        return false;
+    }
+
+    memset(asset, 0, sizeof(*asset));
+    asset->path = bstrdup(url_path);
+
+    uint64_t hash = fnv1a_hash(data, len);
+    for (int i = 0; i < ASSET_ENCODING_COUNT; i++) {
+        snprintf(asset->etags[i], sizeof(asset->etags[i]), "\"%016llx%s\"",
+            (unsigned long long) hash, etag_suffixes[i]);
+    }
+
+    const struct content_type *type = get_content_type(url_path);
+
+    struct asset_response *identity =
+        &asset->encodings[ASSET_ENCODING_IDENTITY];
+    identity->body = data;
+    identity->body_len = len;
+
+    if (type->compressible && len >= MIN_COMPRESS_SIZE) {
+        struct asset_response *gzip = &asset->encodings[ASSET_ENCODING_GZIP];
+        gzip_compress(data, len, &gzip->body, &gzip->body_len);
+
+        struct asset_response *br = &asset->encodings[ASSET_ENCODING_BROTLI];
+        brotli_compress(data, len, &br->body, &br->body_len);
+    }
+
+    for (int i = 0; i < ASSET_ENCODING_COUNT; i++) {
+        struct asset_response *response = &asset->encodings[i];
+        if (!response->body) continue;
+
+        // Drop compressed variants that do not save anything
+        if (i != ASSET_ENCODING_IDENTITY && response->body_len >= len) {
+            bfree(response->body);
+            response->body = NULL;
+            continue;
+        }
+
+        asset_response_set_headers(response, "200 OK", type->type,
+            encoding_names[i], asset->etags[i], response->body_len);
+        asset_response_set_headers(&asset->not_modified[i],
+            "304 Not Modified", NULL, NULL, asset->etags[i], 0);
+    }
+
+    obs_log(LOG_DEBUG, "Cached asset %s (%zu bytes, gzip %zu, br %zu)",
+        url_path, len,
+        asset->encodings[ASSET_ENCODING_GZIP].body_len,
+        asset->encodings[ASSET_ENCODING_BROTLI].body_len);
+
+    return true;
+}
+
+static void asset_cache_scan(
+    struct asset_cache *cache,
+    const char *dir_path,
+    const char *url_prefix
+) {
+    os_dir_t *dir = os_opendir(dir_path);
+    if (!dir) {
+        obs_log(LOG_WARNING, "Could not open asset directory %s", dir_path);
+        return;
+    }
+
+    struct os_dirent *entry;
+    while ((entry = os_readdir(dir))) {
+        if (entry->d_name[0] == '.') continue;
+
+        char file_path[1024];
+        char url_path[1024];
+        snprintf(file_path, sizeof(file_path), "%s/%s",
+            dir_path, entry->d_name);
+        snprintf(url_path, sizeof(url_path), "%s/%s",
+            url_prefix, entry->d_name);
+
+        if (entry->directory) {
+            asset_cache_scan(cache, file_path, url_path);
+            continue;
+        }
+
+        cache->assets = brealloc(cache->assets,
+            (cache->count + 1) * sizeof(struct asset));
+        if (asset_load(&cache->assets[cache->count], file_path, url_path)) {
+            cache->count++;
+        }
+    }
+
+    os_closedir(dir);
+}
+
+struct asset_cache* asset_cache_create(const char *dir) {
+    struct asset_cache *cache = bzalloc(sizeof(struct asset_cache));
+
+    if (dir) {
+        asset_cache_scan(cache, dir, "");
+    } else {
+        obs_log(LOG_WARNING, "Client asset directory not found");
+    }
+
+    obs_log(LOG_INFO, "Loaded %zu client assets", cache->count);
+
+    return cache;
+}
+
+void asset_cache_destroy(struct asset_cache **cache_ptr) {
+    struct asset_cache *cache = *cache_ptr;
+
+    for (size_t i = 0; i < cache->count; i++) {
+        struct asset *asset = &cache->assets[i];
+        for (int j = 0; j < ASSET_ENCODING_COUNT; j++) {
+            asset_response_free(&asset->encodings[j]);
+        }
+        for (int j = 0; j < ASSET_ENCODING_COUNT; j++) {
+            asset_response_free(&asset->not_modified[j]);
+        }
+        bfree(asset->path);
+    }
+
+    bfree(cache->assets);
+    bfree(cache);
+
+    *cache_ptr = NULL;
+}
+
+static const struct asset* asset_cache_find_exact(
+    struct asset_cache *cache,
+    const char *path,
+    size_t len
+) {
+    for (size_t i = 0; i < cache->count; i++) {
+        const char *asset_path = cache->assets[i].path;
+        if (strncmp(asset_path, path, len) == 0 && asset_path[len] == '\0') {
+            return &cache->assets[i];
+        }
+    }
+
+    return NULL;
+}
+
+const struct asset* asset_cache_find(
+    struct asset_cache *cache,
+    const char *path
+) {
+    size_t len = strcspn(path, "?#");
+
+    const struct asset *asset = asset_cache_find_exact(cache, path, len);
+    if (asset) return asset;
+
+    // Only fall back to the index page for paths that are not file names
+    const char *last_segment = path;
+    for (size_t i = 0; i < len; i++) {
+        if (path[i] == '/') last_segment = path + i + 1;
+    }
+    if (memchr(last_segment, '.', len - (last_segment - path))) {
+        return NULL;
+    }
+
+    return asset_cache_find_exact(cache, INDEX_PATH, strlen(INDEX_PATH));
+}
+
+/**
+ * Checks whether an Accept-Encoding header value accepts a coding, taking
+ * "q=0" into account.
+ */
+static bool accepts_encoding(const char *accept_encoding, const char *name) {
+    size_t name_len = strlen(name);
+    const char *item = accept_encoding;
+
+    while (*item) {
+        while (*item == ' ' || *item == '\t' || *item == ',') item++;
+
+        size_t item_len = strcspn(item, ",");
+        size_t token_len = strcspn(item, ",; \t");
+
+        if (token_len == name_len && strncasecmp(item, name, name_len) == 0) {
+            const char *q = strstr(item, "q=");
+            if (!q || (size_t) (q - item) > item_len) return true;
+            return strtod(q + 2, NULL) > 0;
+        }
+
+        item += item_len;
+    }
+
+    return false;
+}
+
+enum asset_encoding asset_select_encoding(
+    const struct asset *asset,
+    const char *accept_encoding
+) {
+    if (accept_encoding) {
+        static const enum asset_encoding preferred[] = {
+            ASSET_ENCODING_BROTLI,
+            ASSET_ENCODING_GZIP,
+        };
+
+        for (size_t i = 0; i < sizeof(preferred)/sizeof(preferred[0]); i++) {
+            if (asset->encodings[preferred[i]].body
+                && accepts_encoding(accept_encoding,
+                    encoding_names[preferred[i]])) {
+                return preferred[i];
+            }
+        }
+    }
+
+    return ASSET_ENCODING_IDENTITY;
+}
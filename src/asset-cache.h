@@ -0,0 +1,94 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum asset_encoding {
+    ASSET_ENCODING_IDENTITY,
+    ASSET_ENCODING_GZIP,
+    ASSET_ENCODING_BROTLI,
+    ASSET_ENCODING_COUNT,
+};
+
+/**
+ * A response that is ready to be sent as is.
+ */
+struct asset_response {
+    // The status line and all the headers, including the final empty line.
+    // There is one variant for persistent connections and one for connections
+    // that are closed after the response.
+    char *header_keep_alive;
+    size_t header_keep_alive_len;
+    char *header_close;
+    size_t header_close_len;
+
+    uint8_t *body;
+    size_t body_len;
+};
+
+struct asset {
+    char *path;
+
+    // Variants that were not worth generating have a NULL body
+    struct asset_response encodings[ASSET_ENCODING_COUNT];
+
+    // Every encoding is a representation of its own, with a strong entity
+    // tag of its own: the hash of the file, with a suffix for the compressed
+    // ones
+    char etags[ASSET_ENCODING_COUNT][24];
+
+    // The 304 Not Modified responses, with the entity tag of each encoding
+    struct asset_response not_modified[ASSET_ENCODING_COUNT];
+};
+
+struct asset_cache;
+
+/**
+ * Loads all the files under a directory into memory, with their compressed
+ * variants and their response headers.
+ *
+ * @param dir The directory to serve, e.g. the module's "client" directory.
+ */
+struct asset_cache* asset_cache_create(const char *dir);
+
+void asset_cache_destroy(struct asset_cache **cache);
+
+/**
+ * Finds the asset that corresponds to a request path. The path may contain a
+ * query string, which is ignored. Paths that do not look like file names are
+ * served the index page, so that the client can do its own routing.
+ *
+ * @return The asset, or NULL if there is none for the path.
+ */
+const struct asset* asset_cache_find(
+    struct asset_cache *cache,
+    const char *path
+);
+
+/**
+ * Picks the best encoding of the asset that the client accepts.
+ *
+ * @param accept_encoding The value of the Accept-Encoding header, or NULL.
+ */
+enum asset_encoding asset_select_encoding(
+    const struct asset *asset,
+    const char *accept_encoding
+);
@@ -0,0 +1,518 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#include "decode-scheduler.h"
+
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include <obs-module.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include "plugin-support.h"
+
+// About two seconds of 1080p video. A queue that falls further behind than
+// that is not going to catch up.
+#define MAX_QUEUED_PACKETS 4096
+
+// The window over which the CPU share of a queue is measured
+#define CPU_SHARE_WINDOW_NS 1000000000ULL
+
+struct queued_packet {
+    struct queued_packet *next;
+    uint64_t arrival_time;
+
+    // The payload and CSRCs point into data
+    struct rtp_packet packet;
+    uint8_t data[];
+};
+
+struct decode_queue {
+    decode_queue_callback_t callback;
+    void *data;
+
+    // Everything below is guarded by the scheduler's mutex
+
+    struct queued_packet *head;
+    struct queued_packet *tail;
+    size_t count;
+    uint64_t dropped;
+    // The RTP timestamp of the last packet that was pushed
+    uint32_t last_timestamp;
+    bool have_timestamp;
+
+    // The thread that last ran the queue, which it is handed back to
+    int home;
+    // Whether the queue is in the ready list of its home thread
+    bool ready;
+    struct decode_queue *next_ready;
+    // Whether a thread is running the callback
+    bool running;
+    bool removed;
+
+    uint64_t cpu_ns;
+    uint64_t window_start;
+    uint64_t window_cpu_ns;
+    double cpu_share;
+};
+
+struct decode_worker {
+    int index;
+    pthread_t thread;
+    pthread_cond_t cond;
+    bool idle;
+
+    // The queues that have packets and are not running, in no order
+    struct decode_queue *ready;
+};
+
+static struct {
+    pthread_mutex_t mutex;
+    // Signaled when a queue stops running, for removing it
+    pthread_cond_t done_cond;
+
+    struct decode_worker *workers;
+    int worker_count;
+    int next_home;
+    bool stopping;
+} scheduler = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .done_cond = PTHREAD_COND_INITIALIZER,
+};
+
+/**
+ * @return The CPU time used by the calling thread.
+ */
+static uint64_t thread_cpu_time_ns(void) {
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+        return 0;
+    }
+
+    // In units of 100 ns
+    uint64_t kernel_time =
+        ((uint64_t) kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+    uint64_t user_time =
+        ((uint64_t) user.dwHighDateTime << 32) | user.dwLowDateTime;
+    return (kernel_time + user_time) * 100;
+#else
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0;
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static void free_packets(struct queued_packet *packet) {
+    while (packet) {
+        struct queued_packet *next = packet->next;
+        bfree(packet);
+        packet = next;
+    }
+}
+
+// Must be called with the mutex held
+static void update_cpu_share(struct decode_queue *queue, uint64_t now) {
+    uint64_t elapsed = now - queue->window_start;
+    if (elapsed < CPU_SHARE_WINDOW_NS) return;
+
+    queue->cpu_share = (double) queue->window_cpu_ns / elapsed;
+    queue->window_start = now;
+    queue->window_cpu_ns = 0;
+}
+
+// Must be called with the mutex held
+static void add_cpu_time(struct decode_queue *queue, uint64_t cpu_ns) {
+    queue->cpu_ns += cpu_ns;
+    queue->window_cpu_ns += cpu_ns;
+    update_cpu_share(queue, os_gettime_ns());
+}
+
+/**
+ * Runs the callback on a list of packets and frees them.
+ *
+ * @return The CPU time it took.
+ */
+static uint64_t run_packets(
+    struct decode_queue *queue,
+    struct queued_packet *packet
+) {
+    uint64_t start = thread_cpu_time_ns();
+
+    while (packet) {
+        struct queued_packet *next = packet->next;
+        queue->callback(&packet->packet, packet->arrival_time, queue->data);
+        bfree(packet);
+        packet = next;
+    }
+
+    return thread_cpu_time_ns() - start;
+}
+
+/**
+ * Puts a queue that has packets in the ready list of its home thread. Must be
+ * called with the mutex held.
+ *
+ * @param wake Whether to wake a thread up to run it, which is not needed when
+ * its home thread is the caller. The queue may already be in the list
+ * without a thread having been woken up for it.
+ */
+static void make_ready(struct decode_queue *queue, bool wake) {
+    if (queue->running || queue->removed || !queue->head) return;
+
+    struct decode_worker *home = &scheduler.workers[queue->home];
+    if (!queue->ready) {
+        queue->ready = true;
+        queue->next_ready = home->ready;
+        home->ready = queue;
+    }
+
+    if (!wake) return;
+
+    if (home->idle) {
+        pthread_cond_signal(&home->cond);
+        return;
+    }
+
+    // The home thread is busy, so another one may as well steal the queue
+    for (int i = 0; i < scheduler.worker_count; i++) {
+        struct decode_worker *worker = &scheduler.workers[i];
+        if (worker->idle) {
+            pthread_cond_signal(&worker->cond);
+            return;
+        }
+    }
+}
+
+// Must be called with the mutex held
+static void unlink_ready(struct decode_queue *queue) {
+    if (!queue->ready) return;
+
+    struct decode_queue **link = &scheduler.workers[queue->home].ready;
+    while (*link != queue) {
+        link = &(*link)->next_ready;
+    }
+    *link = queue->next_ready;
+
+    queue->ready = false;
+    queue->next_ready = NULL;
+}
+
+// Must be called with the mutex held
+static struct decode_queue* earliest_ready(struct decode_worker *worker) {
+    struct decode_queue *earliest = NULL;
+    for (struct decode_queue *queue = worker->ready; queue;
+        queue = queue->next_ready) {
+        if (!earliest
+            || queue->head->arrival_time < earliest->head->arrival_time) {
+            earliest = queue;
+        }
+    }
+    return earliest;
+}
+
+/**
+ * Takes the most urgent queue of a thread, or steals the most urgent one of
+ * the other threads if it has none. Must be called with the mutex held.
+ */
+static struct decode_queue* take_queue(struct decode_worker *worker) {
+    struct decode_queue *queue = earliest_ready(worker);
+
+    if (!queue) {
+        for (int i = 0; i < scheduler.worker_count; i++) {
+            if (i == worker->index) continue;
+
+            struct decode_queue *candidate =
+                earliest_ready(&scheduler.workers[i]);
+            if (candidate && (!queue
+                || candidate->head->arrival_time < queue->head->arrival_time)) {
+                queue = candidate;
+            }
+        }
+    }
+
+    if (queue) {
+        unlink_ready(queue);
+    }
+    return queue;
+}
+
+/**
+ * Takes the packets of the queue up to the end of the first frame. Must be
+ * called with the mutex held.
+ */
+static struct queued_packet* take_frame(struct decode_queue *queue) {
+    struct queued_packet *first = queue->head;
+    struct queued_packet *last = first;
+    size_t count = 1;
+
+    while (last->next && !last->packet.marker) {
+        last = last->next;
+        count++;
+    }
+
+    queue->head = last->next;
+    if (!queue->head) {
+        queue->tail = NULL;
+    }
+    queue->count -= count;
+
+    last->next = NULL;
+    return first;
+}
+
+static void* decode_worker_thread(void *data) {
+    struct decode_worker *worker = data;
+
+    os_set_thread_name("webrtc-decode");
+
+    pthread_mutex_lock(&scheduler.mutex);
+    while (!scheduler.stopping) {
+        struct decode_queue *queue = take_queue(worker);
+        if (!queue) {
+            worker->idle = true;
+            pthread_cond_wait(&worker->cond, &scheduler.mutex);
+            worker->idle = false;
+            continue;
+        }
+
+        queue->running = true;
+        queue->home = worker->index;
+        struct queued_packet *packets = take_frame(queue);
+        pthread_mutex_unlock(&scheduler.mutex);
+
+        uint64_t cpu_ns = run_packets(queue, packets);
+
+        pthread_mutex_lock(&scheduler.mutex);
+        queue->running = false;
+        add_cpu_time(queue, cpu_ns);
+
+        if (queue->removed) {
+            pthread_cond_broadcast(&scheduler.done_cond);
+        } else {
+            make_ready(queue, false);
+        }
+    }
+    pthread_mutex_unlock(&scheduler.mutex);
+
+    return NULL;
+}
+
+bool decode_scheduler_start(int threads) {
+    if (threads <= 0) {
+        threads = os_get_logical_cores() / 2;
+        if (threads < 1) threads = 1;
+    }
+
+    struct decode_worker *workers =
+        bzalloc(sizeof(struct decode_worker) * threads);
+
+    pthread_mutex_lock(&scheduler.mutex);
+    scheduler.workers = workers;
+    scheduler.stopping = false;
+
+    int started = 0;
+    for (; started < threads; started++) {
+        struct decode_worker *worker = &workers[started];
+        worker->index = started;
+        pthread_cond_init(&worker->cond, NULL);
+
+        if (pthread_create(&worker->thread, NULL, decode_worker_thread, worker) != 0) {
+            obs_log(LOG_WARNING, "Could not create decoding thread %d", started);
+            pthread_cond_destroy(&worker->cond);
+            break;
+        }
+    }
+    scheduler.worker_count = started;
+    pthread_mutex_unlock(&scheduler.mutex);
+
+    if (started == 0) {
+        obs_log(LOG_ERROR, "No decoding thread could be created");
+        pthread_mutex_lock(&scheduler.mutex);
+        scheduler.workers = NULL;
+        pthread_mutex_unlock(&scheduler.mutex);
+        bfree(workers);
+        return false;
+    }
+
+    obs_log(LOG_INFO, "Decoding video on %d threads", started);
+    return true;
+}
+
+void decode_scheduler_stop(void) {
+    pthread_mutex_lock(&scheduler.mutex);
+    scheduler.stopping = true;
+    for (int i = 0; i < scheduler.worker_count; i++) {
+        pthread_cond_signal(&scheduler.workers[i].cond);
+    }
+    pthread_mutex_unlock(&scheduler.mutex);
+
+    for (int i = 0; i < scheduler.worker_count; i++) {
+        pthread_join(scheduler.workers[i].thread, NULL);
+        pthread_cond_destroy(&scheduler.workers[i].cond);
+    }
+
+    pthread_mutex_lock(&scheduler.mutex);
+    bfree(scheduler.workers);
+    scheduler.workers = NULL;
+    scheduler.worker_count = 0;
+    pthread_mutex_unlock(&scheduler.mutex);
+}
+
+int decode_scheduler_get_threads(void) {
+    pthread_mutex_lock(&scheduler.mutex);
+    int threads = scheduler.worker_count;
+    pthread_mutex_unlock(&scheduler.mutex);
+
+    return threads;
+}
+
+struct decode_queue* decode_scheduler_add_queue(
+    decode_queue_callback_t callback,
+    void *data
+) {
+    struct decode_queue *queue = bzalloc(sizeof(struct decode_queue));
+    queue->callback = callback;
+    queue->data = data;
+    queue->window_start = os_gettime_ns();
+
+    // Spread the queues over the threads to begin with
+    pthread_mutex_lock(&scheduler.mutex);
+    if (scheduler.worker_count > 0) {
+        queue->home = scheduler.next_home++ % scheduler.worker_count;
+    }
+    pthread_mutex_unlock(&scheduler.mutex);
+
+    return queue;
+}
+
+void decode_scheduler_remove_queue(struct decode_queue **queue_ptr) {
+    struct decode_queue *queue = *queue_ptr;
+    if (!queue) return;
+
+    pthread_mutex_lock(&scheduler.mutex);
+    queue->removed = true;
+    unlink_ready(queue);
+    while (queue->running) {
+        pthread_cond_wait(&scheduler.done_cond, &scheduler.mutex);
+    }
+    struct queued_packet *packets = queue->head;
+    pthread_mutex_unlock(&scheduler.mutex);
+
+    free_packets(packets);
+    bfree(queue);
+    *queue_ptr = NULL;
+}
+
+void decode_queue_push(
+    struct decode_queue *queue,
+    const struct rtp_packet *packet,
+    uint64_t arrival_time
+) {
+    size_t csrc_size = packet->csrc_count * sizeof(uint32_t);
+    struct queued_packet *queued = bmalloc(
+        sizeof(struct queued_packet) + csrc_size + packet->payload_size
+    );
+    queued->next = NULL;
+    queued->arrival_time = arrival_time;
+    queued->packet = *packet;
+    queued->packet.csrc = (uint32_t*) queued->data;
+    queued->packet.payload = queued->data + csrc_size;
+    if (csrc_size > 0) {
+        memcpy(queued->packet.csrc, packet->csrc, csrc_size);
+    }
+    memcpy(queued->packet.payload, packet->payload, packet->payload_size);
+
+    pthread_mutex_lock(&scheduler.mutex);
+
+    if (scheduler.worker_count == 0) {
+        // Without a pool, the packet is processed right away as before
+        pthread_mutex_unlock(&scheduler.mutex);
+        uint64_t cpu_ns = run_packets(queue, queued);
+
+        pthread_mutex_lock(&scheduler.mutex);
+        add_cpu_time(queue, cpu_ns);
+        pthread_mutex_unlock(&scheduler.mutex);
+        return;
+    }
+
+    struct queued_packet *dropped = NULL;
+    if (queue->count >= MAX_QUEUED_PACKETS) {
+        // The decoder recovers by itself at the next keyframe
+        if (queue->dropped == 0) {
+            obs_log(LOG_WARNING,
+                "Decoding is falling behind, dropping %zu packets",
+                queue->count);
+        }
+        dropped = queue->head;
+        queue->dropped += queue->count;
+        queue->head = queue->tail = NULL;
+        queue->count = 0;
+        unlink_ready(queue);
+    }
+
+    if (queue->tail) {
+        queue->tail->next = queued;
+    } else {
+        queue->head = queued;
+    }
+    queue->tail = queued;
+    queue->count++;
+
+    // The H.264 parser only completes a frame once the first data of the
+    // next one arrives, so idle threads are only woken up for the first
+    // packet of a frame. That saves a wakeup for every other packet, on a
+    // receiving thread that may be shared by all the sources. Busy threads
+    // still pick the packets up as they go.
+    bool new_frame = !queue->have_timestamp
+        || packet->timestamp != queue->last_timestamp;
+    queue->last_timestamp = packet->timestamp;
+    queue->have_timestamp = true;
+    make_ready(queue, new_frame);
+    pthread_mutex_unlock(&scheduler.mutex);
+
+    free_packets(dropped);
+}
+
+void decode_queue_clear(struct decode_queue *queue) {
+    pthread_mutex_lock(&scheduler.mutex);
+    struct queued_packet *packets = queue->head;
+    queue->head = queue->tail = NULL;
+    queue->count = 0;
+    unlink_ready(queue);
+    pthread_mutex_unlock(&scheduler.mutex);
+
+    free_packets(packets);
+}
+
+void decode_queue_get_stats(
+    struct decode_queue *queue,
+    struct decode_queue_stats *stats
+) {
+    pthread_mutex_lock(&scheduler.mutex);
+    update_cpu_share(queue, os_gettime_ns());
+    stats->cpu_share = queue->cpu_share;
+    stats->cpu_ns = queue->cpu_ns;
+    stats->queued = queue->count;
+    stats->dropped = queue->dropped;
+    pthread_mutex_unlock(&scheduler.mutex);
+}
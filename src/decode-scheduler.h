@@ -0,0 +1,115 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rtp-parser.h"
+
+/*
+ * The plugin-wide pool of threads that decodes the video of all the sources,
+ * so that the total decoding load is capped to a fixed number of cores
+ * instead of growing with every guest.
+ *
+ * Every source has a queue of ordered RTP packets. The packets of a queue are
+ * processed by one thread at a time, so that its decoder needs no locking,
+ * and one frame at a time, so that the queues take turns between frames. A
+ * queue goes back to the thread that last ran it, which still has its decoder
+ * in cache, and idle threads steal from the others. Each thread runs the
+ * queue whose oldest packet has waited the longest first, since its frame is
+ * the closest to missing its time on screen.
+ */
+
+struct decode_queue;
+
+/**
+ * Processes a packet of the queue, on one of the threads of the pool. The
+ * packet is freed after the call.
+ */
+typedef void (*decode_queue_callback_t)(
+    struct rtp_packet *packet,
+    uint64_t arrival_time,
+    void *data
+);
+
+struct decode_queue_stats {
+    // The share of one core that the queue used over the last second
+    double cpu_share;
+    // The CPU time the queue used in total
+    uint64_t cpu_ns;
+
+    // The packets that are waiting
+    size_t queued;
+    // The packets that were dropped because the queue fell too far behind
+    uint64_t dropped;
+};
+
+/**
+ * Starts the threads. Called once when the module is loaded.
+ *
+ * @param threads The number of threads, or 0 for half of the logical cores,
+ * which leaves the rest to OBS and its encoders.
+ * @return false if no thread could be started, in which case the packets are
+ * processed on the thread that pushes them.
+ */
+bool decode_scheduler_start(int threads);
+
+/**
+ * Stops the threads. All queues must have been removed.
+ */
+void decode_scheduler_stop(void);
+
+/**
+ * @return The number of threads of the pool, 0 if it is not running.
+ */
+int decode_scheduler_get_threads(void);
+
+struct decode_queue* decode_scheduler_add_queue(
+    decode_queue_callback_t callback,
+    void *data
+);
+
+/**
+ * Removes a queue, dropping the packets that are waiting. Waits for the
+ * callback of the queue to return if it is running. Nothing may be pushed to
+ * the queue anymore.
+ */
+void decode_scheduler_remove_queue(struct decode_queue **queue);
+
+/**
+ * Copies a packet to the end of the queue. Can be called from any thread, but
+ * only from one at a time. A thread is woken up for the queue when a packet
+ * ends a frame, i.e. has the marker bit.
+ */
+void decode_queue_push(
+    struct decode_queue *queue,
+    const struct rtp_packet *packet,
+    uint64_t arrival_time
+);
+
+/**
+ * Drops the packets that are waiting, e.g. because the stream restarts.
+ */
+void decode_queue_clear(struct decode_queue *queue);
+
+void decode_queue_get_stats(
+    struct decode_queue *queue,
+    struct decode_queue_stats *stats
+);
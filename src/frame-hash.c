@@ -0,0 +1,99 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#include "frame-hash.h"
+
+#include <string.h>
+
+// The primes of xxHash64, whose round function this uses
+#define PRIME64_1 0x9e3779b185ebca87ULL
+#define PRIME64_2 0xc2b2ae3d27d4eb4fULL
+#define PRIME64_3 0x165667b19e3779f9ULL
+
+// Independent accumulators, so that the rounds can run in parallel
+#define LANES 4
+
+static inline uint64_t rotl64(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+/**
+ * Hashes the visible part of a plane, skipping the padding at the end of
+ * the lines, which the decoder does not initialize.
+ */
+static void hash_plane(
+    uint64_t acc[LANES],
+    const uint8_t *data,
+    int linesize,
+    int width,
+    int height
+) {
+    for (int y = 0; y < height; y++) {
+        const uint8_t *line = data + (ptrdiff_t) y * linesize;
+
+        int x = 0;
+        for (; x + LANES * 8 <= width; x += LANES * 8) {
+            for (int i = 0; i < LANES; i++) {
+                uint64_t input;
+                memcpy(&input, line + x + i * 8, sizeof(input));
+                acc[i] = hash_round(acc[i], input);
+            }
+        }
+
+        for (; x < width; x++) {
+            acc[0] = hash_round(acc[0], line[x]);
+        }
+    }
+}
+
+uint64_t frame_hash(const AVFrame *frame) {
+    uint64_t acc[LANES] = {
+        PRIME64_1 + PRIME64_2,
+        PRIME64_2,
+        0,
+        0 - PRIME64_1,
+    };
+
+    int chroma_width = (frame->width + 1) / 2;
+    int chroma_height = (frame->height + 1) / 2;
+
+    hash_plane(acc, frame->data[0], frame->linesize[0], frame->width,
+        frame->height);
+    hash_plane(acc, frame->data[1], frame->linesize[1], chroma_width,
+        chroma_height);
+    hash_plane(acc, frame->data[2], frame->linesize[2], chroma_width,
+        chroma_height);
+
+    uint64_t hash = rotl64(acc[0], 1) + rotl64(acc[1], 7)
+        + rotl64(acc[2], 12) + rotl64(acc[3], 18);
+    hash = hash_round(hash, ((uint64_t) frame->width << 32) | frame->height);
+
+    // Mix the last bits in
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
@@ -0,0 +1,110 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The layout of the shared memory that frame-ring.c writes the decoded
+ * frames of a source to and frame-ring-reader.c reads them from. Both sides
+ * must agree on FRAME_RING_VERSION.
+ *
+ * The object starts with a header, followed by a fixed number of slots of
+ * the same size. Every slot starts with a header of its own and holds a
+ * frame, whose planes and rows start on cache lines.
+ *
+ * There is a single writer. The frames go to the slots in turn, and every
+ * slot is guarded by a seqlock: its sequence is odd while the slot is being
+ * written, and changes with every write. A reader remembers the sequence
+ * before it uses a slot and checks that it is still the same afterwards, so
+ * readers never block the writer and never write to the object.
+ */
+
+#define FRAME_RING_MAGIC 0x474e5246 // "FRNG"
+#define FRAME_RING_VERSION 1
+
+#define FRAME_RING_CACHE_LINE 64
+
+#define FRAME_RING_FORMAT_I420 1
+
+struct frame_ring_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    // In bytes, including the slot header, a multiple of the cache line
+    uint32_t slot_size;
+    // The largest frame that fits in a slot
+    uint32_t max_width;
+    uint32_t max_height;
+
+    // Set when the writer is done with the object, e.g. because it is
+    // replaced with a larger one under the same name
+    _Atomic uint32_t closed;
+    uint32_t reserved;
+
+    // The number of frames written so far. The newest one is number
+    // frame_count, in slot (frame_count - 1) % slot_count.
+    _Atomic uint64_t frame_count;
+
+    uint8_t padding[24];
+};
+
+struct frame_ring_slot {
+    _Atomic uint32_t sequence;
+    uint32_t format;
+
+    // Numbered from 1
+    uint64_t frame_number;
+    // When the frame was decoded, in the writer's os_gettime_ns() clock
+    uint64_t decode_time_ns;
+    // The RTP timestamp of the frame, in a 90 kHz clock
+    uint32_t rtp_timestamp;
+
+    uint32_t width;
+    uint32_t height;
+
+    // From the start of the slot
+    uint32_t plane_offset[3];
+    uint32_t linesize[3];
+};
+
+_Static_assert(
+    sizeof(struct frame_ring_header) == FRAME_RING_CACHE_LINE,
+    "The header must fill a cache line"
+);
+_Static_assert(
+    sizeof(struct frame_ring_slot) == FRAME_RING_CACHE_LINE,
+    "The slot header must fill a cache line"
+);
+
+static inline uint32_t frame_ring_align(uint32_t size) {
+    return (size + FRAME_RING_CACHE_LINE - 1) & ~(FRAME_RING_CACHE_LINE - 1);
+}
+
+/**
+ * @return The slot of the given index.
+ */
+static inline struct frame_ring_slot* frame_ring_get_slot(
+    struct frame_ring_header *header,
+    uint32_t index
+) {
+    return (struct frame_ring_slot*) ((uint8_t*) header
+        + sizeof(struct frame_ring_header) + (size_t) index * header->slot_size);
+}
@@ -0,0 +1,151 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#include "frame-ring-reader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "frame-ring-format.h"
+
+struct frame_ring_reader {
+    struct frame_ring_header *header;
+    size_t size;
+};
+
+struct frame_ring_reader* frame_ring_reader_open(const char *name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = st.st_size;
+    if (size < sizeof(struct frame_ring_header)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // Read-only, so that a reader cannot disturb the writer or other readers
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    struct frame_ring_header *header = map;
+    bool valid = header->magic == FRAME_RING_MAGIC
+        && header->version == FRAME_RING_VERSION
+        && header->slot_count > 0
+        && header->slot_size >= sizeof(struct frame_ring_slot)
+        && size >= sizeof(struct frame_ring_header)
+            + (size_t) header->slot_count * header->slot_size;
+    atomic_thread_fence(memory_order_acquire);
+
+    if (!valid) {
+        munmap(map, size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct frame_ring_reader *reader = malloc(sizeof(struct frame_ring_reader));
+    if (!reader) {
+        munmap(map, size);
+        return NULL;
+    }
+
+    reader->header = header;
+    reader->size = size;
+    return reader;
+}
+
+void frame_ring_reader_close(struct frame_ring_reader **reader_ptr) {
+    struct frame_ring_reader *reader = *reader_ptr;
+    if (!reader) return;
+
+    munmap(reader->header, reader->size);
+    free(reader);
+    *reader_ptr = NULL;
+}
+
+bool frame_ring_reader_next(
+    struct frame_ring_reader *reader,
+    uint64_t after,
+    struct frame_ring_frame *frame
+) {
+    struct frame_ring_header *header = reader->header;
+
+    uint64_t newest = atomic_load_explicit(
+        &header->frame_count,
+        memory_order_acquire
+    );
+    if (newest == 0 || newest <= after) return false;
+
+    uint32_t index = (newest - 1) % header->slot_count;
+    struct frame_ring_slot *slot = frame_ring_get_slot(header, index);
+
+    uint32_t sequence =
+        atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    if (sequence & 1) return false;
+
+    frame->frame_number = slot->frame_number;
+    frame->decode_time_ns = slot->decode_time_ns;
+    frame->rtp_timestamp = slot->rtp_timestamp;
+    frame->width = slot->width;
+    frame->height = slot->height;
+
+    bool valid = slot->format == FRAME_RING_FORMAT_I420
+        && frame->frame_number == newest;
+    for (int plane = 0; plane < 3; plane++) {
+        uint32_t offset = slot->plane_offset[plane];
+        uint32_t rows = plane == 0 ? frame->height : (frame->height + 1) / 2;
+        frame->data[plane] = (const uint8_t*) slot + offset;
+        frame->linesize[plane] = slot->linesize[plane];
+
+        // Never hand out planes that reach out of the slot, whatever was
+        // read from it
+        uint64_t end = offset + (uint64_t) frame->linesize[plane] * rows;
+        if (end > header->slot_size) valid = false;
+    }
+
+    frame->slot = index;
+    frame->sequence = sequence;
+
+    return valid && frame_ring_reader_check(reader, frame);
+}
+
+bool frame_ring_reader_check(
+    struct frame_ring_reader *reader,
+    const struct frame_ring_frame *frame
+) {
+    struct frame_ring_slot *slot = frame_ring_get_slot(reader->header, frame->slot);
+
+    // The reads of the frame happen before the sequence is read again
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&slot->sequence, memory_order_relaxed)
+        == frame->sequence;
+}
+
+bool frame_ring_reader_closed(struct frame_ring_reader *reader) {
+    return atomic_load_explicit(&reader->header->closed, memory_order_acquire);
+}
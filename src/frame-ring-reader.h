@@ -0,0 +1,115 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Reads the frames that a WebRTC source shares with the "Share the decoded
+ * video" setting, for processes outside of OBS. It depends on nothing but
+ * the C library, so that it can be built into any program.
+ *
+ * The frames are used in place, without copying them. Since the writer
+ * never waits for the readers, a slot can be overwritten while it is being
+ * used, so a reader checks the frame after using it and discards what it
+ * got from it if it changed in the meantime:
+ *
+ *     uint64_t last = 0;
+ *     struct frame_ring_frame frame;
+ *     if (frame_ring_reader_next(reader, last, &frame)) {
+ *         ... use frame.data ...
+ *         if (frame_ring_reader_check(reader, &frame)) {
+ *             last = frame.frame_number;
+ *         }
+ *     }
+ *
+ * There are a few frames' worth of slots, so this only happens to readers
+ * that take longer than a few frame intervals.
+ */
+
+struct frame_ring_reader;
+
+struct frame_ring_frame {
+    // Numbered from 1, in the order they were decoded
+    uint64_t frame_number;
+    // When the frame was decoded, in the monotonic clock of the writer
+    uint64_t decode_time_ns;
+    // The RTP timestamp of the frame, in a 90 kHz clock
+    uint32_t rtp_timestamp;
+
+    uint32_t width;
+    uint32_t height;
+
+    // I420: the Y plane and the U and V planes at half the size, with rows
+    // that start on cache lines
+    const uint8_t *data[3];
+    uint32_t linesize[3];
+
+    // For frame_ring_reader_check
+    uint32_t slot;
+    uint32_t sequence;
+};
+
+/**
+ * Opens the frames of a source.
+ *
+ * @param name The name of the shared memory object, "/obs-webrtc-<room>".
+ * @return The reader, or NULL with errno set if the object does not exist
+ * (yet), or is not a frame ring of this version.
+ */
+struct frame_ring_reader* frame_ring_reader_open(const char *name);
+
+void frame_ring_reader_close(struct frame_ring_reader **reader);
+
+/**
+ * Gets the newest frame, if it is newer than the one that was last used.
+ * Frames in between are skipped.
+ *
+ * @param after The number of the last frame that was used, 0 for none.
+ * @return false if there is no newer frame, or it is being overwritten.
+ */
+bool frame_ring_reader_next(
+    struct frame_ring_reader *reader,
+    uint64_t after,
+    struct frame_ring_frame *frame
+);
+
+/**
+ * Checks that a frame was not overwritten since frame_ring_reader_next
+ * returned it, i.e. that what was read from it is valid.
+ */
+bool frame_ring_reader_check(
+    struct frame_ring_reader *reader,
+    const struct frame_ring_frame *frame
+);
+
+/**
+ * Checks whether the writer is done with the object, e.g. because the
+ * source was removed, or because the frames outgrew it and it was replaced
+ * with a larger one. The reader has to be opened again for new frames.
+ */
+bool frame_ring_reader_closed(struct frame_ring_reader *reader);
+
+#ifdef __cplusplus
+}
+#endif
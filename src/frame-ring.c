@@ -0,0 +1,265 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#include "frame-ring.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <obs-module.h>
+#include <util/platform.h>
+#include "plugin-support.h"
+
+#ifndef _WIN32
+#include "frame-ring-format.h"
+
+// Readers that take up to a few frame intervals to use a frame still get to
+// use it whole
+#define SLOT_COUNT 4
+
+struct frame_ring {
+    char *name;
+    struct frame_ring_header *header;
+    size_t size;
+    uint64_t frame_count;
+};
+
+static uint32_t plane_width(uint32_t width, int plane) {
+    return plane == 0 ? width : (width + 1) / 2;
+}
+
+static uint32_t plane_height(uint32_t height, int plane) {
+    return plane == 0 ? height : (height + 1) / 2;
+}
+
+/**
+ * @return The size of a slot that holds an I420 frame of the given size.
+ */
+static size_t slot_size(uint32_t width, uint32_t height) {
+    size_t size = sizeof(struct frame_ring_slot);
+    for (int plane = 0; plane < 3; plane++) {
+        size += (size_t) frame_ring_align(plane_width(width, plane))
+            * plane_height(height, plane);
+    }
+    return size;
+}
+
+/**
+ * Creates a new object under the name of the ring and maps it. Readers of
+ * an object that was there before keep their mapping of it.
+ */
+static bool map_ring(
+    struct frame_ring *ring,
+    uint32_t max_width,
+    uint32_t max_height
+) {
+    size_t slot = slot_size(max_width, max_height);
+    if (slot > UINT32_MAX) return false;
+    size_t size = sizeof(struct frame_ring_header) + SLOT_COUNT * slot;
+
+    shm_unlink(ring->name);
+    int fd = shm_open(ring->name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        obs_log(LOG_ERROR, "Could not create shared memory %s: %s",
+            ring->name, strerror(errno));
+        return false;
+    }
+
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, size) == 0) {
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        obs_log(LOG_ERROR, "Could not map shared memory %s: %s",
+            ring->name, strerror(errno));
+        shm_unlink(ring->name);
+        return false;
+    }
+
+    // The object starts out zeroed, so readers that open it before the
+    // header is written take it for invalid
+    struct frame_ring_header *header = map;
+    header->version = FRAME_RING_VERSION;
+    header->slot_count = SLOT_COUNT;
+    header->slot_size = (uint32_t) slot;
+    header->max_width = max_width;
+    header->max_height = max_height;
+    // The frame numbers go on from the object that this one replaces
+    atomic_store_explicit(
+        &header->frame_count,
+        ring->frame_count,
+        memory_order_relaxed
+    );
+    atomic_thread_fence(memory_order_release);
+    header->magic = FRAME_RING_MAGIC;
+
+    ring->header = header;
+    ring->size = size;
+
+    obs_log(LOG_INFO, "Sharing frames of up to %ux%u in %s",
+        max_width, max_height, ring->name);
+    return true;
+}
+
+static void unmap_ring(struct frame_ring *ring) {
+    if (!ring->header) return;
+
+    atomic_store_explicit(&ring->header->closed, 1, memory_order_release);
+    munmap(ring->header, ring->size);
+    ring->header = NULL;
+}
+
+struct frame_ring* frame_ring_create(
+    const char *name,
+    uint32_t max_width,
+    uint32_t max_height
+) {
+    struct frame_ring *ring = bzalloc(sizeof(struct frame_ring));
+    ring->name = bstrdup(name);
+
+    if (!map_ring(ring, max_width, max_height)) {
+        bfree(ring->name);
+        bfree(ring);
+        return NULL;
+    }
+
+    return ring;
+}
+
+void frame_ring_destroy(struct frame_ring **ring_ptr) {
+    struct frame_ring *ring = *ring_ptr;
+    if (!ring) return;
+
+    unmap_ring(ring);
+    shm_unlink(ring->name);
+
+    bfree(ring->name);
+    bfree(ring);
+    *ring_ptr = NULL;
+}
+
+void frame_ring_write(
+    struct frame_ring *ring,
+    const AVFrame *frame,
+    uint32_t rtp_timestamp
+) {
+    if (frame->format != AV_PIX_FMT_YUV420P
+        && frame->format != AV_PIX_FMT_YUVJ420P) {
+        return;
+    }
+
+    uint32_t width = frame->width;
+    uint32_t height = frame->height;
+
+    struct frame_ring_header *header = ring->header;
+    if (header && slot_size(width, height) > header->slot_size) {
+        // Grow, and keep the old size in the other direction, so that a
+        // rotated camera does not replace the object back and forth
+        uint32_t max_width = width > header->max_width
+            ? width : header->max_width;
+        uint32_t max_height = height > header->max_height
+            ? height : header->max_height;
+
+        unmap_ring(ring);
+        map_ring(ring, max_width, max_height);
+        header = ring->header;
+    }
+    if (!header) return;
+
+    struct frame_ring_slot *slot =
+        frame_ring_get_slot(header, ring->frame_count % header->slot_count);
+
+    // Odd while the slot is being written
+    uint32_t sequence =
+        atomic_load_explicit(&slot->sequence, memory_order_relaxed);
+    atomic_store_explicit(&slot->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    slot->format = FRAME_RING_FORMAT_I420;
+    slot->frame_number = ring->frame_count + 1;
+    slot->decode_time_ns = os_gettime_ns();
+    slot->rtp_timestamp = rtp_timestamp;
+    slot->width = width;
+    slot->height = height;
+
+    uint32_t offset = sizeof(struct frame_ring_slot);
+    for (int plane = 0; plane < 3; plane++) {
+        uint32_t row_size = plane_width(width, plane);
+        uint32_t rows = plane_height(height, plane);
+        uint32_t linesize = frame_ring_align(row_size);
+
+        slot->plane_offset[plane] = offset;
+        slot->linesize[plane] = linesize;
+
+        uint8_t *dst = (uint8_t*) slot + offset;
+        const uint8_t *src = frame->data[plane];
+        for (uint32_t y = 0; y < rows; y++) {
+            memcpy(dst, src, row_size);
+            dst += linesize;
+            src += frame->linesize[plane];
+        }
+
+        offset += linesize * rows;
+    }
+
+    atomic_store_explicit(&slot->sequence, sequence + 2, memory_order_release);
+
+    ring->frame_count++;
+    atomic_store_explicit(
+        &header->frame_count,
+        ring->frame_count,
+        memory_order_release
+    );
+}
+
+#else
+
+struct frame_ring* frame_ring_create(
+    const char *name,
+    uint32_t max_width,
+    uint32_t max_height
+) {
+    UNUSED_PARAMETER(max_width);
+    UNUSED_PARAMETER(max_height);
+
+    obs_log(LOG_WARNING, "Cannot share frames in %s, shared memory is not "
+        "supported on Windows", name);
+    return NULL;
+}
+
+void frame_ring_destroy(struct frame_ring **ring) {
+    *ring = NULL;
+}
+
+void frame_ring_write(
+    struct frame_ring *ring,
+    const AVFrame *frame,
+    uint32_t rtp_timestamp
+) {
+    UNUSED_PARAMETER(ring);
+    UNUSED_PARAMETER(frame);
+    UNUSED_PARAMETER(rtp_timestamp);
+}
+
+#endif
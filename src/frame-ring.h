@@ -0,0 +1,67 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#pragma once
+
+#include <stdint.h>
+
+#include <libavcodec/avcodec.h>
+
+/*
+ * Publishes the decoded frames of a source to a POSIX shared memory object,
+ * so that other local processes, e.g. recorders or a confidence monitor, can
+ * use the video without a WebRTC session and a decoder of their own. See
+ * frame-ring-format.h for the layout and frame-ring-reader.h for reading it.
+ *
+ * Writing never waits for the readers. Frames that outgrow the slots replace
+ * the object with a larger one under the same name, which readers notice
+ * from the old one being closed. Not available on Windows.
+ */
+
+struct frame_ring;
+
+/**
+ * Creates the shared memory object, replacing any that is left over with
+ * the same name.
+ *
+ * @param name The name of the object, starting with a '/'.
+ * @param max_width The width of the largest frame that the slots hold to
+ * begin with.
+ * @param max_height The height of the largest frame that the slots hold to
+ * begin with.
+ * @return The ring, or NULL if the object could not be created.
+ */
+struct frame_ring* frame_ring_create(
+    const char *name,
+    uint32_t max_width,
+    uint32_t max_height
+);
+
+/**
+ * Closes and removes the shared memory object. Readers that still have it
+ * mapped can keep reading the last frames.
+ */
+void frame_ring_destroy(struct frame_ring **ring);
+
+/**
+ * Copies an I420 frame to the next slot. Only one thread may write at a time.
+ */
+void frame_ring_write(
+    struct frame_ring *ring,
+    const AVFrame *frame,
+    uint32_t rtp_timestamp
+);
@@ -0,0 +1,149 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#include "frame-scaler.h"
+
+#include <libswscale/swscale.h>
+
+#include <obs.h>
+#include "plugin-support.h"
+
+struct frame_scaler {
+    struct SwsContext *context;
+    // The output, reallocated only when the output size changes
+    AVFrame *frame;
+};
+
+struct frame_scaler* frame_scaler_create(void) {
+    return bzalloc(sizeof(struct frame_scaler));
+}
+
+void frame_scaler_destroy(struct frame_scaler **scaler) {
+    sws_freeContext((*scaler)->context);
+    av_frame_free(&(*scaler)->frame);
+    bfree(*scaler);
+    *scaler = NULL;
+}
+
+/**
+ * Computes the largest size within the limits with the aspect ratio of the
+ * frame. I420 needs even dimensions.
+ */
+static void get_scaled_size(
+    int width,
+    int height,
+    uint32_t max_width,
+    uint32_t max_height,
+    int *scaled_width,
+    int *scaled_height
+) {
+    uint64_t w = width;
+    uint64_t h = height;
+
+    if (max_width > 0 && w > max_width) {
+        h = h * max_width / w;
+        w = max_width;
+    }
+    if (max_height > 0 && h > max_height) {
+        w = w * max_height / h;
+        h = max_height;
+    }
+
+    *scaled_width = w < 2 ? 2 : (int) (w & ~1ULL);
+    *scaled_height = h < 2 ? 2 : (int) (h & ~1ULL);
+}
+
+static bool ensure_output_frame(
+    struct frame_scaler *scaler,
+    int width,
+    int height
+) {
+    AVFrame *frame = scaler->frame;
+    if (frame && frame->width == width && frame->height == height) {
+        return true;
+    }
+
+    av_frame_free(&scaler->frame);
+
+    frame = av_frame_alloc();
+    if (!frame) return false;
+
+    frame->width = width;
+    frame->height = height;
+    frame->format = AV_PIX_FMT_YUV420P;
+    if (av_frame_get_buffer(frame, 0) < 0) {
+        av_frame_free(&frame);
+        return false;
+    }
+
+    scaler->frame = frame;
+    return true;
+}
+
+const AVFrame* frame_scaler_scale(
+    struct frame_scaler *scaler,
+    const AVFrame *frame,
+    uint32_t max_width,
+    uint32_t max_height
+) {
+    if (max_width == 0 && max_height == 0) return frame;
+
+    int width, height;
+    get_scaled_size(
+        frame->width,
+        frame->height,
+        max_width,
+        max_height,
+        &width,
+        &height
+    );
+    if (width >= frame->width && height >= frame->height) return frame;
+
+    // Area averaging, which does not alias when scaling down by large
+    // factors, unlike bilinear. FFmpeg has SIMD versions of it.
+    scaler->context = sws_getCachedContext(
+        scaler->context,
+        frame->width,
+        frame->height,
+        frame->format,
+        width,
+        height,
+        AV_PIX_FMT_YUV420P,
+        SWS_AREA,
+        NULL,
+        NULL,
+        NULL
+    );
+    if (!scaler->context || !ensure_output_frame(scaler, width, height)) {
+        obs_log(LOG_ERROR, "Could not scale %dx%d to %dx%d",
+            frame->width, frame->height, width, height);
+        return frame;
+    }
+
+    sws_scale(
+        scaler->context,
+        (const uint8_t * const *) frame->data,
+        frame->linesize,
+        0,
+        frame->height,
+        scaler->frame->data,
+        scaler->frame->linesize
+    );
+    scaler->frame->pts = frame->pts;
+
+    return scaler->frame;
+}
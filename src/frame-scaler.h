@@ -0,0 +1,51 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#pragma once
+
+#include <stdint.h>
+
+#include <libavcodec/avcodec.h>
+
+/*
+ * Scales decoded frames down to the output size of a source, so that OBS
+ * does not have to upload and scale full resolution frames for a small
+ * inset. The scaled frames are written to a buffer that is reused for as
+ * long as the size stays the same.
+ */
+
+struct frame_scaler;
+
+struct frame_scaler* frame_scaler_create(void);
+
+void frame_scaler_destroy(struct frame_scaler **scaler);
+
+/**
+ * Scales a frame down to fit within max_width x max_height, keeping its
+ * aspect ratio. Frames are never scaled up.
+ *
+ * @param max_width The maximum width, or 0 for no limit.
+ * @param max_height The maximum height, or 0 for no limit.
+ * @return The scaled I420 frame, which is owned by the scaler and valid
+ * until the next call, or the frame itself if it already fits.
+ */
+const AVFrame* frame_scaler_scale(
+    struct frame_scaler *scaler,
+    const AVFrame *frame,
+    uint32_t max_width,
+    uint32_t max_height
+);
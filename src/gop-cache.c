@@ -0,0 +1,131 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#include "gop-cache.h"
+
+#include <string.h>
+
+#include <obs.h>
+
+struct cached_access_unit {
+    struct cached_access_unit *next;
+
+    uint32_t rtp_timestamp;
+    bool keyframe;
+    int width;
+    int height;
+
+    size_t size;
+    uint8_t data[];
+};
+
+struct gop_cache {
+    size_t max_size;
+
+    // Starts with a keyframe, unless it is empty
+    struct cached_access_unit *head;
+    struct cached_access_unit *tail;
+    size_t size;
+};
+
+struct gop_cache* gop_cache_create(size_t max_size) {
+    struct gop_cache *cache = bzalloc(sizeof(struct gop_cache));
+    cache->max_size = max_size;
+    return cache;
+}
+
+void gop_cache_destroy(struct gop_cache **cache) {
+    if (!*cache) return;
+
+    gop_cache_clear(*cache);
+
+    bfree(*cache);
+    *cache = NULL;
+}
+
+void gop_cache_clear(struct gop_cache *cache) {
+    struct cached_access_unit *access_unit = cache->head;
+    while (access_unit) {
+        struct cached_access_unit *next = access_unit->next;
+        bfree(access_unit);
+        access_unit = next;
+    }
+
+    cache->head = cache->tail = NULL;
+    cache->size = 0;
+}
+
+bool gop_cache_add(
+    struct gop_cache *cache,
+    const struct h264_access_unit *access_unit
+) {
+    if (access_unit->keyframe) {
+        gop_cache_clear(cache);
+    } else if (!cache->head) {
+        // The frames that follow are useless without their keyframe
+        return true;
+    }
+
+    if (cache->size + access_unit->size > cache->max_size) {
+        gop_cache_clear(cache);
+        return false;
+    }
+
+    struct cached_access_unit *cached = bmalloc(
+        sizeof(struct cached_access_unit) + access_unit->size
+    );
+    cached->next = NULL;
+    cached->rtp_timestamp = access_unit->rtp_timestamp;
+    cached->keyframe = access_unit->keyframe;
+    cached->width = access_unit->width;
+    cached->height = access_unit->height;
+    cached->size = access_unit->size;
+    memcpy(cached->data, access_unit->data, access_unit->size);
+
+    if (cache->tail) {
+        cache->tail->next = cached;
+    } else {
+        cache->head = cached;
+    }
+    cache->tail = cached;
+    cache->size += cached->size;
+
+    return true;
+}
+
+bool gop_cache_replay(
+    struct gop_cache *cache,
+    gop_cache_callback_t callback,
+    void *data
+) {
+    if (!cache->head) return false;
+
+    for (struct cached_access_unit *cached = cache->head; cached;
+        cached = cached->next) {
+        struct h264_access_unit access_unit = {
+            .data = cached->data,
+            .size = cached->size,
+            .rtp_timestamp = cached->rtp_timestamp,
+            .keyframe = cached->keyframe,
+            .width = cached->width,
+            .height = cached->height,
+        };
+        callback(&access_unit, data);
+    }
+
+    return true;
+}
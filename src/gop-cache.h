@@ -0,0 +1,76 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "h264-decoder.h"
+
+/*
+ * Keeps the access units of the video since its last keyframe, so that a
+ * decoder can be brought to the current frame without asking the sender for
+ * a new keyframe, e.g. when full decoding resumes after only keyframes were
+ * decoded.
+ *
+ * The cache is bounded by its size. If the group of pictures outgrows it,
+ * nothing is kept until the next keyframe.
+ */
+
+struct gop_cache;
+
+typedef void (*gop_cache_callback_t)(
+    const struct h264_access_unit *access_unit,
+    void *data
+);
+
+/**
+ * @param max_size The most bytes of access units that are kept.
+ */
+struct gop_cache* gop_cache_create(size_t max_size);
+
+void gop_cache_destroy(struct gop_cache **cache);
+
+/**
+ * Adds an access unit, starting over if it is a keyframe.
+ *
+ * @return false if it did not fit, in which case the cache stays empty until
+ * the next keyframe.
+ */
+bool gop_cache_add(
+    struct gop_cache *cache,
+    const struct h264_access_unit *access_unit
+);
+
+/**
+ * Empties the cache until the next keyframe, e.g. because the stream
+ * restarts.
+ */
+void gop_cache_clear(struct gop_cache *cache);
+
+/**
+ * Passes the access units since the last keyframe to a callback, in order.
+ *
+ * @return false if the cache does not start with a keyframe, in which case
+ * the callback is not called.
+ */
+bool gop_cache_replay(
+    struct gop_cache *cache,
+    gop_cache_callback_t callback,
+    void *data
+);
@@ -19,6 +19,21 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 
 #include <obs.h>
 #include "plugin-support.h"
+#include "trace.h"
+
+#define NAL_TYPE_SPS 7
+#define NAL_TYPE_PPS 8
+
+// Far more than the parameter sets of any stream a browser sends
+#define MAX_PARAMETER_SET_SIZE 256
+
+/**
+ * A parameter set with its Annex B start code.
+ */
+struct parameter_set {
+    uint8_t data[3 + MAX_PARAMETER_SET_SIZE];
+    size_t size;
+};
 
 struct h264_decoder {
     const AVCodec *codec;
@@ -29,8 +44,22 @@ struct h264_decoder {
 
     uint8_t *buffer;
     size_t buffer_size;
+
+    h264_access_unit_callback_t access_unit_callback;
+    void *access_unit_callback_data;
+
+    // The last SPS and PPS that were seen, fed to the decoder ahead of the
+    // next data after a flush, in case the keyframe that follows comes
+    // without them
+    struct parameter_set sps;
+    struct parameter_set pps;
+    bool prime;
+
+    bool keyframes_only;
 };
 
+static const uint8_t nal_prefix[3] = {0, 0, 1};
+
 struct h264_decoder* h264_decoder_create() {
     struct h264_decoder decoder = {};
 
@@ -62,6 +91,8 @@ struct h264_decoder* h264_decoder_create() {
 }
 
 void h264_decoder_destroy(struct h264_decoder **decoder) {
+    if (!*decoder) return;
+
     av_parser_close((*decoder)->parser);
 
     avcodec_free_context(&(*decoder)->ctx);
@@ -70,32 +101,169 @@ void h264_decoder_destroy(struct h264_decoder **decoder) {
     *decoder = NULL;
 }
 
-void rtp_process_h264_packet(
+void h264_decoder_set_access_unit_callback(
+    struct h264_decoder *decoder,
+    h264_access_unit_callback_t callback,
+    void *data
+) {
+    decoder->access_unit_callback = callback;
+    decoder->access_unit_callback_data = data;
+}
+
+void h264_decoder_flush(struct h264_decoder *decoder) {
+    // The parser has no flush of its own, so start with a fresh one
+    AVCodecParserContext *parser = av_parser_init(decoder->codec->id);
+    if (parser) {
+        av_parser_close(decoder->parser);
+        decoder->parser = parser;
+    }
+
+    avcodec_flush_buffers(decoder->ctx);
+
+    decoder->prime = true;
+}
+
+void h264_decoder_reset(struct h264_decoder *decoder) {
+    avcodec_flush_buffers(decoder->ctx);
+}
+
+void h264_decoder_set_keyframes_only(
+    struct h264_decoder *decoder,
+    bool keyframes_only
+) {
+    decoder->keyframes_only = keyframes_only;
+
+    // The decoder skips what gets past the parser, e.g. frames that it took
+    // for keyframes because of a recovery point
+    decoder->ctx->skip_frame = keyframes_only
+        ? AVDISCARD_NONKEY
+        : AVDISCARD_DEFAULT;
+}
+
+/**
+ * Remembers a NAL unit if it is a parameter set.
+ *
+ * @return Whether it was one.
+ */
+static bool cache_parameter_set(
+    struct h264_decoder *decoder,
+    const uint8_t *nalu,
+    size_t size
+) {
+    if (size < 1 || size > MAX_PARAMETER_SET_SIZE) return false;
+
+    struct parameter_set *set;
+    switch (nalu[0] & 0b11111) {
+        case NAL_TYPE_SPS: set = &decoder->sps; break;
+        case NAL_TYPE_PPS: set = &decoder->pps; break;
+        default: return false;
+    }
+
+    memcpy(set->data, nal_prefix, 3);
+    memcpy(set->data + 3, nalu, size);
+    set->size = 3 + size;
+    return true;
+}
+
+static int base64_value(char c) {
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    return -1;
+}
+
+/**
+ * Decodes base64 up to the end of the string or a comma.
+ *
+ * @return The decoded size, or 0 if it is invalid or does not fit.
+ */
+static size_t base64_decode(
+    const char *text,
+    uint8_t *out,
+    size_t size,
+    const char **end
+) {
+    uint32_t bits = 0;
+    int bit_count = 0;
+    size_t len = 0;
+    bool valid = true;
+
+    const char *c = text;
+    for (; *c && *c != ','; c++) {
+        if (*c == '=') continue;
+
+        int value = base64_value(*c);
+        if (value < 0 || len >= size) {
+            valid = false;
+            continue;
+        }
+
+        bits = (bits << 6) | value;
+        bit_count += 6;
+        if (bit_count >= 8) {
+            bit_count -= 8;
+            out[len++] = (uint8_t) (bits >> bit_count);
+        }
+    }
+
+    *end = c;
+    return valid ? len : 0;
+}
+
+void h264_decoder_set_parameter_sets(
+    struct h264_decoder *decoder,
+    const char *sprop_parameter_sets
+) {
+    const char *c = sprop_parameter_sets;
+    while (*c) {
+        uint8_t nalu[MAX_PARAMETER_SET_SIZE];
+        size_t size = base64_decode(c, nalu, sizeof(nalu), &c);
+        if (!cache_parameter_set(decoder, nalu, size)) {
+            obs_log(LOG_DEBUG, "Ignoring a sprop-parameter-sets entry");
+        }
+
+        if (*c == ',') c++;
+    }
+
+    decoder->prime = true;
+}
+
+bool rtp_process_h264_packet(
     struct h264_decoder *decoder,
     struct rtp_packet *packet
 ) {
     int ret;
-    uint8_t *buffer = malloc(0);
+    uint8_t *buffer = NULL;
     size_t bufsize = 0;
+    bool ok = true;
+    // Whether the packet starts a NAL unit, and whether it is a parameter set
+    bool nal_start = true;
+    bool has_parameter_sets = false;
+
+    if (packet->payload_size < 1) return false;
 
-    const uint8_t nal_prefix[3] = {0, 0, 1};
+    uint64_t trace = trace_begin();
 
     uint8_t fragment_type = packet->payload[0] & 0b11111;
     switch (fragment_type) {
-        case 1: { // Single NAL
-            buffer = malloc(3 + packet->payload_size);
-            bufsize = 3 + packet->payload_size;
-
-            memcpy(buffer, nal_prefix, 3);
-            memcpy(buffer + 3, packet->payload, packet->payload_size);
-        } break;
-
         case 24: { // STAP-A
             uint8_t *nalu = packet->payload + 1;
-            while (nalu < packet->payload + packet->payload_size) {
+            uint8_t *end = packet->payload + packet->payload_size;
+            while (nalu + 2 <= end) {
                 uint16_t nalu_size = (nalu[0] << 8) | nalu[1];
                 nalu += 2;
 
+                if (nalu_size > end - nalu) {
+                    ok = false;
+                    break;
+                }
+
+                if (cache_parameter_set(decoder, nalu, nalu_size)) {
+                    has_parameter_sets = true;
+                }
+
                 buffer = realloc(buffer, bufsize + 3 + nalu_size);
                 memcpy(buffer + bufsize, nal_prefix, 3);
                 memcpy(buffer + bufsize + 3, nalu, nalu_size);
@@ -106,8 +274,11 @@ void rtp_process_h264_packet(
         } break;
 
         case 28: { // FU-A
+            if (packet->payload_size < 2) return false;
+
             uint8_t start_bit = packet->payload[1] >> 7;
             uint8_t nal_unit = (packet->payload[0] & 0b11100000) | (packet->payload[1] & 0b11111);
+            nal_start = start_bit;
 
             if (start_bit) {
                 buffer = malloc(4);
@@ -120,8 +291,49 @@ void rtp_process_h264_packet(
             memcpy(buffer + bufsize, packet->payload + 2, packet->payload_size - 2);
             bufsize += packet->payload_size - 2;
         } break;
+
+        case 25: // STAP-B
+        case 26: // MTAP16
+        case 27: // MTAP24
+        case 29: // FU-B
+            // Only used in interleaved mode, which we do not offer
+            return false;
+
+        default: { // Single NAL
+            has_parameter_sets = cache_parameter_set(
+                decoder,
+                packet->payload,
+                packet->payload_size
+            );
+
+            buffer = malloc(3 + packet->payload_size);
+            bufsize = 3 + packet->payload_size;
+
+            memcpy(buffer, nal_prefix, 3);
+            memcpy(buffer + 3, packet->payload, packet->payload_size);
+        } break;
     }
 
+    if (decoder->prime && nal_start) {
+        decoder->prime = false;
+
+        // Only needed if the stream does not bring its own
+        struct parameter_set *sps = &decoder->sps;
+        struct parameter_set *pps = &decoder->pps;
+        if (!has_parameter_sets && sps->size > 0 && pps->size > 0) {
+            uint8_t *primed = malloc(sps->size + pps->size + bufsize);
+            memcpy(primed, sps->data, sps->size);
+            memcpy(primed + sps->size, pps->data, pps->size);
+            memcpy(primed + sps->size + pps->size, buffer, bufsize);
+
+            free(buffer);
+            buffer = primed;
+            bufsize += sps->size + pps->size;
+        }
+    }
+
+    trace_end("depacketize", trace);
+
     AVPacket *pkt = av_packet_alloc();
 
     size_t parsed = 0;
@@ -133,39 +345,95 @@ void rtp_process_h264_packet(
             &pkt->size,
             buffer + parsed,
             bufsize - parsed,
-            AV_NOPTS_VALUE,
+            packet->timestamp,
             AV_NOPTS_VALUE,
             0
         );
 
         if (ret < 0) {
-            obs_log(LOG_ERROR, "Parsing error");
-            exit(1);
+            obs_log(LOG_WARNING, "H.264 parsing error");
+            ok = false;
+            break;
         }
 
         parsed += ret;
 
         if (pkt->size > 0) {
+            // The RTP timestamp of the frame, so that it can be matched with
+            // its packets once decoded
+            pkt->pts = decoder->parser->pts;
+
+            if (decoder->access_unit_callback) {
+                struct h264_access_unit access_unit = {
+                    .data = pkt->data,
+                    .size = pkt->size,
+                    .rtp_timestamp = (uint32_t) pkt->pts,
+                    .keyframe = decoder->parser->key_frame == 1,
+                    .width = decoder->parser->width,
+                    .height = decoder->parser->height,
+                };
+                decoder->access_unit_callback(
+                    &access_unit,
+                    decoder->access_unit_callback_data
+                );
+            }
+
+            // Not even handed to libavcodec, which would still parse it
+            if (decoder->keyframes_only && decoder->parser->key_frame != 1) {
+                continue;
+            }
+
+            // Corrupt data is common after packet loss, the decoder
+            // recovers by itself at the next keyframe
+            trace = trace_begin();
             ret = avcodec_send_packet(decoder->ctx, pkt);
-            if (ret < 0) {
-                obs_log(LOG_ERROR, "Sending packet error");
-                exit(1);
+            trace_end("send_packet", trace);
+            if (ret < 0 && ret != AVERROR(EAGAIN)) {
+                obs_log(LOG_DEBUG, "H.264 decoding error");
+                ok = false;
             }
         }
     }
 
+    av_packet_free(&pkt);
     free(buffer);
+    return ok;
+}
+
+bool h264_decoder_decode_access_unit(
+    struct h264_decoder *decoder,
+    const struct h264_access_unit *access_unit
+) {
+    AVPacket *pkt = av_packet_alloc();
+    // Not reference counted, so libavcodec makes a copy
+    pkt->data = (uint8_t *) access_unit->data;
+    pkt->size = (int) access_unit->size;
+    pkt->pts = access_unit->rtp_timestamp;
+
+    uint64_t trace = trace_begin();
+    int ret = avcodec_send_packet(decoder->ctx, pkt);
+    trace_end("send_packet", trace);
+    av_packet_free(&pkt);
+
+    if (ret < 0 && ret != AVERROR(EAGAIN)) {
+        obs_log(LOG_DEBUG, "H.264 decoding error");
+        return false;
+    }
+    return true;
 }
 
 AVFrame* h264_decoder_get_frame(struct h264_decoder *decoder) {
     AVFrame *frame = av_frame_alloc();
 
+    uint64_t trace = trace_begin();
     int ret = avcodec_receive_frame(decoder->ctx, frame);
-    if (ret == AVERROR(EAGAIN)) {
+    trace_end("receive_frame", trace);
+    if (ret < 0) {
+        if (ret != AVERROR(EAGAIN)) {
+            obs_log(LOG_WARNING, "Error receiving frame");
+        }
+        av_frame_free(&frame);
         return NULL;
-    } else if (ret < 0) {
-        obs_log(LOG_ERROR, "Error receiving frame");
-        exit(1);
     }
 
     return frame;
@@ -17,6 +17,7 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 */
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -26,13 +27,101 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 
 struct h264_decoder;
 
+/**
+ * A complete H.264 access unit, as split by the parser before decoding.
+ */
+struct h264_access_unit {
+    // The NAL units of the access unit, with Annex B start codes
+    const uint8_t *data;
+    size_t size;
+
+    uint32_t rtp_timestamp;
+    bool keyframe;
+
+    // The size of the video, 0 if it is not known yet
+    int width;
+    int height;
+};
+
+typedef void (*h264_access_unit_callback_t)(
+    const struct h264_access_unit *access_unit,
+    void *data
+);
+
 struct h264_decoder* h264_decoder_create();
 
 void h264_decoder_destroy(struct h264_decoder **decoder);
 
-void rtp_process_h264_packet(
+/**
+ * Sets a callback that receives every access unit before it is decoded, e.g.
+ * to record the stream without transcoding it. The data is only valid during
+ * the call.
+ */
+void h264_decoder_set_access_unit_callback(
+    struct h264_decoder *decoder,
+    h264_access_unit_callback_t callback,
+    void *data
+);
+
+/**
+ * Drops any partially parsed data and buffered frames, e.g. after packets
+ * were skipped. Decoding resumes with the next keyframe, which can be decoded
+ * even if it comes without an SPS and PPS, as long as they were seen before.
+ */
+void h264_decoder_flush(struct h264_decoder *decoder);
+
+/**
+ * Drops the buffered frames and references of the decoder, but not the data
+ * that is being parsed, e.g. to decode access units that were kept again
+ * from their keyframe before the stream goes on.
+ */
+void h264_decoder_reset(struct h264_decoder *decoder);
+
+/**
+ * Gives the decoder the SPS and PPS of the stream ahead of its first
+ * keyframe, as found in the sprop-parameter-sets of the SDP (RFC 6184).
+ *
+ * @param sprop_parameter_sets The base64 parameter sets, separated by commas.
+ */
+void h264_decoder_set_parameter_sets(
+    struct h264_decoder *decoder,
+    const char *sprop_parameter_sets
+);
+
+/**
+ * Sets whether only keyframes are decoded, e.g. for a small preview. The
+ * other access units are still passed to the access unit callback. After
+ * switching back, the frames are corrupt until the next keyframe.
+ */
+void h264_decoder_set_keyframes_only(
+    struct h264_decoder *decoder,
+    bool keyframes_only
+);
+
+/**
+ * Depacketizes an RTP packet and decodes the access units it completes.
+ *
+ * @return false if the packet was malformed or the data could not be
+ * decoded.
+ */
+bool rtp_process_h264_packet(
     struct h264_decoder *decoder,
     struct rtp_packet *packet
 );
 
+/**
+ * Decodes an access unit that was already depacketized, e.g. one that was
+ * kept from earlier. It is not passed to the access unit callback.
+ *
+ * @return false if the data could not be decoded.
+ */
+bool h264_decoder_decode_access_unit(
+    struct h264_decoder *decoder,
+    const struct h264_access_unit *access_unit
+);
+
+/**
+ * @return The next decoded frame, or NULL if there is none yet. The pts of the
+ * frame is the RTP timestamp of its packets.
+ */
 AVFrame* h264_decoder_get_frame(struct h264_decoder *decoder);
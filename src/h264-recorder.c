@@ -0,0 +1,402 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#include "h264-recorder.h"
+
+#include <pthread.h>
+#include <libavformat/avformat.h>
+
+#include <obs.h>
+#include <util/bmem.h>
+#include <util/dstr.h>
+#include <util/threading.h>
+#include "plugin-support.h"
+
+// The RTP clock rate of all video codecs, used as the time base of the file
+#define VIDEO_CLOCK_RATE 90000
+
+// Larger jumps of the RTP timestamp are not taken as the time between frames
+#define MAX_TIMESTAMP_GAP (10 * VIDEO_CLOCK_RATE)
+
+// How much can be waiting for the disk before access units are dropped
+#define MAX_QUEUED_BYTES (64 * 1024 * 1024)
+
+#define NAL_TYPE_SPS 7
+#define NAL_TYPE_PPS 8
+
+struct queued_access_unit {
+    struct queued_access_unit *next;
+
+    uint32_t rtp_timestamp;
+    bool keyframe;
+    int width;
+    int height;
+
+    size_t size;
+    uint8_t data[];
+};
+
+struct h264_recorder {
+    char *path;
+    pthread_t thread;
+
+    // Guards the queue and stopping
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    struct queued_access_unit *head;
+    struct queued_access_unit *tail;
+    size_t queued_bytes;
+    bool stopping;
+
+    // Set when the queue was full, so that nothing is written until the next
+    // keyframe. Only used by the receiving thread.
+    bool dropping;
+
+    // Only used by the writer thread
+    AVFormatContext *format;
+    AVStream *stream;
+    AVPacket *pkt;
+    bool failed;
+    uint32_t last_rtp_timestamp;
+    int64_t last_pts;
+};
+
+static void log_av_error(const char *what, int error) {
+    char desc[AV_ERROR_MAX_STRING_SIZE];
+    av_strerror(error, desc, sizeof(desc));
+    obs_log(LOG_ERROR, "Recorder: %s: %s", what, desc);
+}
+
+/**
+ * Finds the next NAL unit in Annex B data.
+ *
+ * @return The start of the NAL unit after its start code, or NULL if there
+ * are no more.
+ */
+static const uint8_t* find_nal_unit(const uint8_t *data, const uint8_t *end) {
+    for (const uint8_t *p = data; p + 3 <= end; p++) {
+        if (p[0] == 0 && p[1] == 0 && p[2] == 1) {
+            return p + 3;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Copies the SPS and PPS of a keyframe, with their start codes, into the
+ * extradata of the stream. The muxers convert it to the avcC they need.
+ */
+static bool set_extradata(
+    AVCodecParameters *codecpar,
+    const struct queued_access_unit *access_unit
+) {
+    const uint8_t *end = access_unit->data + access_unit->size;
+    const uint8_t *nal = find_nal_unit(access_unit->data, end);
+
+    uint8_t *extradata = av_mallocz(
+        access_unit->size + 4 + AV_INPUT_BUFFER_PADDING_SIZE
+    );
+    size_t extradata_size = 0;
+
+    while (nal && nal < end) {
+        const uint8_t *next = find_nal_unit(nal, end);
+        // The next start code may have a leading zero byte
+        const uint8_t *nal_end = next ? next - 3 : end;
+        while (nal_end > nal && nal_end[-1] == 0) nal_end--;
+
+        uint8_t type = nal[0] & 0x1f;
+        if (type == NAL_TYPE_SPS || type == NAL_TYPE_PPS) {
+            static const uint8_t start_code[4] = {0, 0, 0, 1};
+            memcpy(extradata + extradata_size, start_code, 4);
+            memcpy(extradata + extradata_size + 4, nal, nal_end - nal);
+            extradata_size += 4 + (nal_end - nal);
+        }
+
+        nal = next;
+    }
+
+    if (extradata_size == 0) {
+        av_free(extradata);
+        return false;
+    }
+
+    codecpar->extradata = extradata;
+    codecpar->extradata_size = extradata_size;
+    return true;
+}
+
+static bool has_extension(const char *path, const char *extension) {
+    const char *dot = strrchr(path, '.');
+    return dot && astrcmpi(dot, extension) == 0;
+}
+
+static bool h264_recorder_open(
+    struct h264_recorder *recorder,
+    const struct queued_access_unit *access_unit
+) {
+    int ret;
+    bool mp4 = has_extension(recorder->path, ".mp4");
+
+    ret = avformat_alloc_output_context2(
+        &recorder->format,
+        NULL,
+        mp4 ? "mp4" : "matroska",
+        recorder->path
+    );
+    if (ret < 0) {
+        log_av_error("Could not create the output format", ret);
+        return false;
+    }
+
+    recorder->stream = avformat_new_stream(recorder->format, NULL);
+    if (!recorder->stream) {
+        obs_log(LOG_ERROR, "Recorder: Could not create the video stream");
+        return false;
+    }
+
+    AVCodecParameters *codecpar = recorder->stream->codecpar;
+    codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    codecpar->codec_id = AV_CODEC_ID_H264;
+    codecpar->width = access_unit->width;
+    codecpar->height = access_unit->height;
+    recorder->stream->time_base = (AVRational) {1, VIDEO_CLOCK_RATE};
+
+    if (!set_extradata(codecpar, access_unit)) {
+        obs_log(LOG_WARNING, "Recorder: The keyframe has no SPS and PPS");
+    }
+
+    if (!(recorder->format->oformat->flags & AVFMT_NOFILE)) {
+        ret = avio_open(&recorder->format->pb, recorder->path, AVIO_FLAG_WRITE);
+        if (ret < 0) {
+            log_av_error("Could not open the file", ret);
+            return false;
+        }
+    }
+
+    AVDictionary *options = NULL;
+    if (mp4) {
+        // Fragmented, so that the file is playable even if OBS crashes
+        av_dict_set(
+            &options,
+            "movflags",
+            "frag_keyframe+empty_moov+default_base_moof",
+            0
+        );
+    }
+
+    ret = avformat_write_header(recorder->format, &options);
+    av_dict_free(&options);
+    if (ret < 0) {
+        log_av_error("Could not write the header", ret);
+        return false;
+    }
+
+    // So that the first access unit gets a pts of 0
+    recorder->last_rtp_timestamp = access_unit->rtp_timestamp;
+    recorder->last_pts = -1;
+
+    obs_log(LOG_INFO, "Recording to %s", recorder->path);
+    return true;
+}
+
+static void h264_recorder_close(struct h264_recorder *recorder) {
+    if (!recorder->format) return;
+
+    if (recorder->stream && !recorder->failed) {
+        int ret = av_write_trailer(recorder->format);
+        if (ret < 0) {
+            log_av_error("Could not write the trailer", ret);
+        }
+    }
+
+    if (!(recorder->format->oformat->flags & AVFMT_NOFILE)) {
+        avio_closep(&recorder->format->pb);
+    }
+
+    avformat_free_context(recorder->format);
+    recorder->format = NULL;
+    recorder->stream = NULL;
+}
+
+static void h264_recorder_write_access_unit(
+    struct h264_recorder *recorder,
+    const struct queued_access_unit *access_unit
+) {
+    if (recorder->failed) return;
+
+    if (!recorder->format) {
+        // The file starts with a keyframe, so that it can be decoded
+        if (!access_unit->keyframe) return;
+
+        if (!h264_recorder_open(recorder, access_unit)) {
+            recorder->failed = true;
+            return;
+        }
+    }
+
+    // Unwrap the 32-bit RTP timestamp. The timestamps have to increase, even
+    // if the sender sends two frames with the same one.
+    int32_t delta = (int32_t) (
+        access_unit->rtp_timestamp - recorder->last_rtp_timestamp
+    );
+    if (delta > MAX_TIMESTAMP_GAP) {
+        // A new guest, whose timestamps start somewhere else
+        delta = VIDEO_CLOCK_RATE / 30;
+    }
+    int64_t pts = recorder->last_pts + (delta > 0 ? delta : 1);
+
+    recorder->last_rtp_timestamp = access_unit->rtp_timestamp;
+
+    if (av_new_packet(recorder->pkt, access_unit->size) < 0) return;
+    memcpy(recorder->pkt->data, access_unit->data, access_unit->size);
+
+    recorder->pkt->pts = pts;
+    recorder->pkt->dts = pts;
+    recorder->pkt->stream_index = recorder->stream->index;
+    if (access_unit->keyframe) {
+        recorder->pkt->flags |= AV_PKT_FLAG_KEY;
+    }
+    av_packet_rescale_ts(
+        recorder->pkt,
+        (AVRational) {1, VIDEO_CLOCK_RATE},
+        recorder->stream->time_base
+    );
+
+    int ret = av_interleaved_write_frame(recorder->format, recorder->pkt);
+    if (ret < 0) {
+        log_av_error("Could not write a frame", ret);
+        recorder->failed = true;
+    }
+
+    recorder->last_pts = pts;
+}
+
+static void* h264_recorder_thread(void *data) {
+    struct h264_recorder *recorder = data;
+
+    os_set_thread_name("webrtc-recorder");
+
+    pthread_mutex_lock(&recorder->mutex);
+    for (;;) {
+        while (!recorder->head && !recorder->stopping) {
+            pthread_cond_wait(&recorder->cond, &recorder->mutex);
+        }
+
+        // Take the whole queue, so that the disk is written to unlocked
+        struct queued_access_unit *access_unit = recorder->head;
+        recorder->head = recorder->tail = NULL;
+        recorder->queued_bytes = 0;
+        bool stopping = recorder->stopping;
+        pthread_mutex_unlock(&recorder->mutex);
+
+        while (access_unit) {
+            struct queued_access_unit *next = access_unit->next;
+            h264_recorder_write_access_unit(recorder, access_unit);
+            bfree(access_unit);
+            access_unit = next;
+        }
+
+        if (stopping) break;
+        pthread_mutex_lock(&recorder->mutex);
+    }
+
+    h264_recorder_close(recorder);
+    return NULL;
+}
+
+struct h264_recorder* h264_recorder_create(const char *path) {
+    struct h264_recorder *recorder = bzalloc(sizeof(struct h264_recorder));
+    recorder->path = bstrdup(path);
+    recorder->pkt = av_packet_alloc();
+    pthread_mutex_init(&recorder->mutex, NULL);
+    pthread_cond_init(&recorder->cond, NULL);
+
+    if (pthread_create(&recorder->thread, NULL, h264_recorder_thread, recorder) != 0) {
+        obs_log(LOG_ERROR, "Recorder: Could not create the writer thread");
+        pthread_cond_destroy(&recorder->cond);
+        pthread_mutex_destroy(&recorder->mutex);
+        av_packet_free(&recorder->pkt);
+        bfree(recorder->path);
+        bfree(recorder);
+        return NULL;
+    }
+
+    return recorder;
+}
+
+void h264_recorder_destroy(struct h264_recorder **recorder_ptr) {
+    struct h264_recorder *recorder = *recorder_ptr;
+    if (!recorder) return;
+
+    pthread_mutex_lock(&recorder->mutex);
+    recorder->stopping = true;
+    pthread_cond_signal(&recorder->cond);
+    pthread_mutex_unlock(&recorder->mutex);
+
+    pthread_join(recorder->thread, NULL);
+
+    pthread_cond_destroy(&recorder->cond);
+    pthread_mutex_destroy(&recorder->mutex);
+    av_packet_free(&recorder->pkt);
+    bfree(recorder->path);
+    bfree(recorder);
+    *recorder_ptr = NULL;
+}
+
+void h264_recorder_write(
+    struct h264_recorder *recorder,
+    const struct h264_access_unit *access_unit
+) {
+    if (recorder->dropping && !access_unit->keyframe) return;
+
+    struct queued_access_unit *queued = bmalloc(
+        sizeof(struct queued_access_unit) + access_unit->size
+    );
+    queued->next = NULL;
+    queued->rtp_timestamp = access_unit->rtp_timestamp;
+    queued->keyframe = access_unit->keyframe;
+    queued->width = access_unit->width;
+    queued->height = access_unit->height;
+    queued->size = access_unit->size;
+    memcpy(queued->data, access_unit->data, access_unit->size);
+
+    pthread_mutex_lock(&recorder->mutex);
+    bool full = recorder->queued_bytes + queued->size > MAX_QUEUED_BYTES;
+    if (!full) {
+        if (recorder->tail) {
+            recorder->tail->next = queued;
+        } else {
+            recorder->head = queued;
+        }
+        recorder->tail = queued;
+        recorder->queued_bytes += queued->size;
+        pthread_cond_signal(&recorder->cond);
+    }
+    pthread_mutex_unlock(&recorder->mutex);
+
+    if (full) {
+        // The frames that follow depend on this one, so wait for a keyframe
+        if (!recorder->dropping) {
+            obs_log(LOG_WARNING,
+                "Recorder: The disk is too slow, dropping frames");
+        }
+        recorder->dropping = true;
+        bfree(queued);
+    } else {
+        recorder->dropping = false;
+    }
+}
@@ -0,0 +1,54 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#pragma once
+
+#include "h264-decoder.h"
+
+/*
+ * Records the received H.264 stream as is, without transcoding it, by
+ * remuxing the access units into a Matroska or a fragmented MP4 file.
+ *
+ * The access units are queued and written on a thread of the recorder, so
+ * that the receiving thread never waits for the disk. If the disk cannot keep
+ * up and the queue fills up, access units are dropped until the next
+ * keyframe.
+ */
+
+struct h264_recorder;
+
+/**
+ * Creates the recorder and its writer thread. The file is created when the
+ * first keyframe arrives, since its header needs the SPS and PPS.
+ *
+ * @param path The output file. The container is chosen from the extension,
+ * ".mp4" is written as fragmented MP4 and anything else as Matroska.
+ */
+struct h264_recorder* h264_recorder_create(const char *path);
+
+/**
+ * Stops the recorder, writing what is still queued and finishing the file.
+ */
+void h264_recorder_destroy(struct h264_recorder **recorder);
+
+/**
+ * Queues an access unit to be written. Never blocks.
+ */
+void h264_recorder_write(
+    struct h264_recorder *recorder,
+    const struct h264_access_unit *access_unit
+);
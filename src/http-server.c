@@ -18,77 +18,747 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 
 #include <errno.h>
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <pthread.h>
 
 #include <obs-module.h>
+#include <util/platform.h>
+#include <util/threading.h>
 #include "plugin-support.h"
 
-#define READ_BUFFER_SIZE 4096
+#include "http-server.h"
+#include "asset-cache.h"
+#include "websocket.h"
+#include "poller.h"
+
+// macOS has no MSG_NOSIGNAL, SIGPIPE is turned off per socket there instead
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// The maximum size of a request line plus its headers
+#define MAX_REQUEST_SIZE 8192
+#define MAX_HEADERS 32
+#define MAX_EVENTS 64
+#define READ_SIZE 4096
+#define LISTEN_BACKLOG 128
+
+// Idle keep-alive connections are closed after this long. Idle WebSocket
+// connections are pinged instead, and closed if they stay silent.
+#define IDLE_TIMEOUT_NS (30 * 1000000000ULL)
+
+#define MAX_WS_MESSAGE_SIZE (1024 * 1024)
+// The most that is buffered of a connection: a frame with the largest
+// message, with the largest header and the mask
+#define MAX_WS_BUFFER_SIZE \
+    (MAX_WS_MESSAGE_SIZE + WEBSOCKET_MAX_HEADER_SIZE + 4)
+
+struct http_header {
+    const char *name;
+    const char *value;
+};
+
+struct http_request {
+    const char *method;
+    const char *path;
+    int version_minor;
+    bool keep_alive;
+    size_t content_length;
+
+    struct http_header headers[MAX_HEADERS];
+    size_t header_count;
+};
+
+struct http_connection {
+    int fd;
+
+    char request[MAX_REQUEST_SIZE];
+    size_t request_len;
+
+    // Bytes of a request body that still have to be read and discarded
+    size_t body_remaining;
+
+    // Response bytes that could not be sent without blocking
+    char *out;
+    size_t out_len;
+    size_t out_sent;
+
+    bool close_after_write;
+    uint64_t last_activity;
+
+    uint64_t id;
+    bool websocket;
+    bool ws_pinged;
+
+    // Received WebSocket data that has not been parsed into frames yet
+    uint8_t *ws_in;
+    size_t ws_in_len;
+    size_t ws_in_capacity;
+
+    // The fragmented message being reassembled
+    uint8_t *ws_message;
+    size_t ws_message_len;
+    bool ws_message_started;
+
+    struct http_connection *prev;
+    struct http_connection *next;
+};
+
+/**
+ * A WebSocket frame queued by another thread, to be sent by the listen thread.
+ */
+struct http_outgoing {
+    uint64_t connection_id;
+    bool close;
+    size_t len;
+    struct http_outgoing *next;
+    uint8_t data[];
+};
 
 struct http_server {
     int socket_fd;
+    struct poller *poller;
     pthread_t listen_thread;
-    char *html;
-    char *ws_port;
+    volatile bool stopping;
+
+    struct asset_cache *assets;
+
+    struct http_connection *connections;
+    uint64_t next_connection_id;
+
+    struct http_server_ws_callbacks ws_callbacks;
+    void *ws_data;
+
+    // Connections are only touched by the listen thread. Other threads hand
+    // their frames over through this queue and wake the thread up.
+    pthread_mutex_t outgoing_mutex;
+    struct http_outgoing *outgoing_head;
+    struct http_outgoing *outgoing_tail;
 };
 
-char* http_server_read_html() {
-    char *path = obs_module_file("client/index.html");
-
-    FILE *file = fopen(path, "r");
-
-    char *data = bmalloc(READ_BUFFER_SIZE * sizeof(char));
-    size_t allocated = READ_BUFFER_SIZE;
-    int len = 0;
-    int chars_read;
-    do {
-        chars_read = fread(
-            data + allocated - READ_BUFFER_SIZE,
-            sizeof(char),
-            READ_BUFFER_SIZE,
-            file
-        );
+static bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static const char* http_request_get_header(
+    struct http_request *request,
+    const char *name
+) {
+    for (size_t i = 0; i < request->header_count; i++) {
+        if (strcasecmp(request->headers[i].name, name) == 0) {
+            return request->headers[i].value;
+        }
+    }
+
+    return NULL;
+}
 
-        data = brealloc(data, allocated + READ_BUFFER_SIZE);
-        allocated += READ_BUFFER_SIZE;
+/**
+ * Checks whether a comma separated header value contains a token,
+ * e.g. "keep-alive" in "Connection: keep-alive, Upgrade".
+ */
+static bool header_has_token(const char *value, const char *token) {
+    size_t token_len = strlen(token);
 
-        len += chars_read;
-    } while (chars_read > 0);
+    while (value && *value) {
+        while (*value == ' ' || *value == '\t' || *value == ',') value++;
+
+        const char *end = value;
+        while (*end && *end != ',') end++;
+
+        const char *trimmed_end = end;
+        while (trimmed_end > value
+            && (trimmed_end[-1] == ' ' || trimmed_end[-1] == '\t')) {
+            trimmed_end--;
+        }
+
+        if ((size_t) (trimmed_end - value) == token_len
+            && strncasecmp(value, token, token_len) == 0) {
+            return true;
+        }
+
+        value = end;
+    }
+
+    return false;
+}
+
+static char* trim(char *str) {
+    while (*str == ' ' || *str == '\t') str++;
+
+    char *end = str + strlen(str);
+    while (end > str && (end[-1] == ' ' || end[-1] == '\t')) end--;
+    *end = '\0';
 
-    char *str = bstrdup_n(data, len);
     return str;
 }
 
-static void get_path(char *header, int len, char *path) {
-    int pathstart = -1;
-    int pathlen = 0;
-    for (int i = 0; i < len; i++) {
-        if (header[i] == ' ') {
-            if (pathstart == -1) {
-                pathstart = i + 1;
-                continue;
-            } else {
-                pathlen = pathstart - i + 1;
-                break;
-            }
+/**
+ * Parses the request line and the headers of a request, modifying the buffer
+ * in place. The buffer must contain the whole header, up to and including the
+ * empty line.
+ *
+ * @return Whether the request is well-formed.
+ */
+static bool http_request_parse(char *buffer, struct http_request *request) {
+    memset(request, 0, sizeof(*request));
+
+    char *line_end = strstr(buffer, "\r\n");
+    if (!line_end) return false;
+    *line_end = '\0';
+
+    // Request line: METHOD SP request-target SP HTTP-version
+    char *method = buffer;
+    char *path = strchr(method, ' ');
+    if (!path) return false;
+    *path++ = '\0';
+
+    char *version = strchr(path, ' ');
+    if (!version) return false;
+    *version++ = '\0';
+
+    if (strncmp(version, "HTTP/1.", 7) != 0 || !version[7]) return false;
+
+    request->method = method;
+    request->path = path;
+    request->version_minor = version[7] - '0';
+
+    // HTTP/1.1 connections are persistent by default, HTTP/1.0 are not
+    request->keep_alive = request->version_minor >= 1;
+
+    char *line = line_end + 2;
+    while ((line_end = strstr(line, "\r\n")) && line_end != line) {
+        *line_end = '\0';
+
+        char *colon = strchr(line, ':');
+        if (!colon) return false;
+        *colon = '\0';
+
+        if (request->header_count < MAX_HEADERS) {
+            struct http_header *header =
+                &request->headers[request->header_count++];
+            header->name = line;
+            header->value = trim(colon + 1);
         }
 
-        if (pathstart != -1) {
-            path[i - pathstart] = header[i];
+        line = line_end + 2;
+    }
+
+    const char *connection = http_request_get_header(request, "Connection");
+    if (connection) {
+        if (header_has_token(connection, "close")) {
+            request->keep_alive = false;
+        } else if (header_has_token(connection, "keep-alive")) {
+            request->keep_alive = true;
         }
     }
 
-    path[pathlen] = '\0';
+    const char *content_length =
+        http_request_get_header(request, "Content-Length");
+    if (content_length) {
+        char *end;
+        unsigned long long len = strtoull(content_length, &end, 10);
+        if (end == content_length || *end != '\0') return false;
+        request->content_length = len;
+    }
+
+    return true;
 }
 
-const char http_header[] = "HTTP/1.0 200 OK\r\nContent-Type: text/html\r\n\r\n";
+static void http_connection_close(
+    struct http_server *server,
+    struct http_connection *conn
+) {
+    if (conn->websocket && server->ws_callbacks.close) {
+        server->ws_callbacks.close(server->ws_data, conn->id);
+    }
 
-void* http_server_loop(void *arg) {
-    struct http_server *server = arg;
+    poller_remove(server->poller, conn->fd);
+    close(conn->fd);
+
+    if (conn->prev) {
+        conn->prev->next = conn->next;
+    } else {
+        server->connections = conn->next;
+    }
+    if (conn->next) {
+        conn->next->prev = conn->prev;
+    }
 
+    bfree(conn->out);
+    bfree(conn->ws_in);
+    bfree(conn->ws_message);
+    bfree(conn);
+}
+
+/**
+ * Sends as much of the pending output as possible.
+ *
+ * @return false if the connection failed and has to be closed.
+ */
+static bool http_connection_flush(
+    struct http_server *server,
+    struct http_connection *conn
+) {
+    while (conn->out_sent < conn->out_len) {
+        ssize_t sent = send(
+            conn->fd,
+            conn->out + conn->out_sent,
+            conn->out_len - conn->out_sent,
+            MSG_NOSIGNAL
+        );
+
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == EINTR) continue;
+            return false;
+        }
+
+        conn->out_sent += sent;
+    }
+
+    bool pending = conn->out_sent < conn->out_len;
+    if (!pending) {
+        conn->out_len = 0;
+        conn->out_sent = 0;
+    }
+
+    // While a response is pending no further requests are read, so wait only
+    // for writability until it is sent
+    poller_modify(server->poller, conn->fd,
+        pending ? POLLER_WRITE : POLLER_READ, conn);
+
+    return true;
+}
+
+static void http_connection_queue(
+    struct http_connection *conn,
+    const char *data,
+    size_t len
+) {
+    conn->out = brealloc(conn->out, conn->out_len + len);
+    memcpy(conn->out + conn->out_len, data, len);
+    conn->out_len += len;
+}
+
+/**
+ * Sends the buffers with a single system call if nothing else is pending,
+ * queueing whatever could not be sent without blocking.
+ */
+static void http_connection_send(
+    struct http_connection *conn,
+    struct iovec *iov,
+    int iovcnt
+) {
+    size_t skip = 0;
+
+    if (conn->out_len == 0) {
+        // sendmsg instead of writev, to avoid SIGPIPE
+        struct msghdr msg = {
+            .msg_iov = iov,
+            .msg_iovlen = iovcnt,
+        };
+
+        ssize_t sent;
+        do {
+            sent = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+        } while (sent < 0 && errno == EINTR);
+
+        if (sent > 0) skip = sent;
+    }
+
+    for (int i = 0; i < iovcnt; i++) {
+        if (skip >= iov[i].iov_len) {
+            skip -= iov[i].iov_len;
+            continue;
+        }
+
+        http_connection_queue(conn,
+            (const char *) iov[i].iov_base + skip,
+            iov[i].iov_len - skip
+        );
+        skip = 0;
+    }
+}
+
+static void http_connection_respond(
+    struct http_connection *conn,
+    struct http_request *request,
+    const char *status,
+    const char *content_type,
+    const char *body,
+    size_t body_len
+) {
+    char header[256];
+    int header_len = snprintf(header, sizeof(header),
+        "HTTP/1.1 %s\r\n"
+        "Content-Type: %s\r\n"
+        "Content-Length: %zu\r\n"
+        "Connection: %s\r\n"
+        "\r\n",
+        status,
+        content_type,
+        body_len,
+        request->keep_alive ? "keep-alive" : "close"
+    );
+
+    struct iovec iov[2] = {
+        {.iov_base = header, .iov_len = header_len},
+        {.iov_base = (void *) body, .iov_len = body_len},
+    };
+    bool head = strcmp(request->method, "HEAD") == 0;
+    http_connection_send(conn, iov, head ? 1 : 2);
+
+    if (!request->keep_alive) {
+        conn->close_after_write = true;
+    }
+}
+
+/**
+ * Checks an If-None-Match header value against an entity tag.
+ */
+static bool etag_matches(const char *if_none_match, const char *etag) {
+    if (strcmp(if_none_match, "*") == 0) return true;
+
+    size_t etag_len = strlen(etag);
+    const char *match = if_none_match;
+    while ((match = strstr(match, etag))) {
+        // Weak comparison, as the header may contain W/ prefixed tags
+        char next = match[etag_len];
+        if (next == '\0' || next == ',' || next == ' ' || next == '\t') {
+            return true;
+        }
+        match += etag_len;
+    }
+
+    return false;
+}
+
+static void http_connection_send_asset(
+    struct http_connection *conn,
+    struct http_request *request,
+    const struct asset *asset
+) {
+    enum asset_encoding encoding = asset_select_encoding(
+        asset,
+        http_request_get_header(request, "Accept-Encoding")
+    );
+    const struct asset_response *response = &asset->encodings[encoding];
+
+    // A tag of any encoding means that the client has the file, and the
+    // 304 response carries the tag of the encoding it would get now
+    const char *if_none_match =
+        http_request_get_header(request, "If-None-Match");
+    for (int i = 0; if_none_match && i < ASSET_ENCODING_COUNT; i++) {
+        if (asset->encodings[i].body
+            && etag_matches(if_none_match, asset->etags[i])) {
+            response = &asset->not_modified[encoding];
+            break;
+        }
+    }
+
+    struct iovec iov[2];
+    if (request->keep_alive) {
+        iov[0].iov_base = response->header_keep_alive;
+        iov[0].iov_len = response->header_keep_alive_len;
+    } else {
+        iov[0].iov_base = response->header_close;
+        iov[0].iov_len = response->header_close_len;
+        conn->close_after_write = true;
+    }
+    iov[1].iov_base = response->body;
+    iov[1].iov_len = response->body_len;
+
+    bool head = strcmp(request->method, "HEAD") == 0;
+    http_connection_send(conn, iov, head || !response->body ? 1 : 2);
+}
+
+static void http_connection_send_ws_frame(
+    struct http_connection *conn,
+    enum websocket_opcode opcode,
+    const void *payload,
+    size_t len
+) {
+    uint8_t header[WEBSOCKET_MAX_HEADER_SIZE];
+    size_t header_len = websocket_write_header(header, opcode, len);
+
+    struct iovec iov[2] = {
+        {.iov_base = header, .iov_len = header_len},
+        {.iov_base = (void *) payload, .iov_len = len},
+    };
+    http_connection_send(conn, iov, len > 0 ? 2 : 1);
+}
+
+/**
+ * Completes the WebSocket handshake, if the request is valid and the path is
+ * accepted.
+ */
+static void http_connection_upgrade(
+    struct http_server *server,
+    struct http_connection *conn,
+    struct http_request *request
+) {
+    const char *connection = http_request_get_header(request, "Connection");
+    const char *key = http_request_get_header(request, "Sec-WebSocket-Key");
+    const char *version =
+        http_request_get_header(request, "Sec-WebSocket-Version");
+
+    if (strcmp(request->method, "GET") != 0
+        || !connection || !header_has_token(connection, "upgrade")
+        || !key || !version || strcmp(version, "13") != 0) {
+        const char body[] = "Bad WebSocket Request";
+        request->keep_alive = false;
+        http_connection_respond(conn, request,
+            "400 Bad Request", "text/plain",
+            body, sizeof(body) - 1
+        );
+        return;
+    }
+
+    if (!server->ws_callbacks.open
+        || !server->ws_callbacks.open(server->ws_data, conn->id, request->path)) {
+        const char body[] = "Forbidden";
+        request->keep_alive = false;
+        http_connection_respond(conn, request,
+            "403 Forbidden", "text/plain",
+            body, sizeof(body) - 1
+        );
+        return;
+    }
+
+    char accept[WEBSOCKET_ACCEPT_KEY_SIZE];
+    websocket_accept_key(key, accept);
+
+    char response[256];
+    int response_len = snprintf(response, sizeof(response),
+        "HTTP/1.1 101 Switching Protocols\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: %s\r\n"
+        "\r\n",
+        accept
+    );
+
+    struct iovec iov = {.iov_base = response, .iov_len = response_len};
+    http_connection_send(conn, &iov, 1);
+
+    conn->websocket = true;
+}
+
+static void http_connection_deliver_ws_message(
+    struct http_server *server,
+    struct http_connection *conn
+) {
+    // Null-terminate, so that text messages can be used as strings
+    conn->ws_message = brealloc(conn->ws_message, conn->ws_message_len + 1);
+    conn->ws_message[conn->ws_message_len] = '\0';
+
+    if (server->ws_callbacks.message) {
+        server->ws_callbacks.message(
+            server->ws_data,
+            conn->id,
+            (const char *) conn->ws_message,
+            conn->ws_message_len
+        );
+    }
+
+    conn->ws_message_len = 0;
+    conn->ws_message_started = false;
+}
+
+/**
+ * Handles all the complete frames in the connection's WebSocket buffer.
+ *
+ * @return false if the connection has to be closed.
+ */
+static bool http_connection_process_ws(
+    struct http_server *server,
+    struct http_connection *conn
+) {
+    while (!conn->close_after_write) {
+        struct websocket_frame frame;
+        long frame_len = websocket_parse_frame(
+            conn->ws_in,
+            conn->ws_in_len,
+            MAX_WS_MESSAGE_SIZE,
+            &frame
+        );
+
+        if (frame_len < 0) return false;
+        if (frame_len == 0) {
+            // Refuse to buffer frames larger than any message we accept
+            return conn->ws_in_len <= MAX_WS_BUFFER_SIZE;
+        }
+
+        switch (frame.opcode) {
+            case WEBSOCKET_OPCODE_TEXT:
+            case WEBSOCKET_OPCODE_BINARY:
+            case WEBSOCKET_OPCODE_CONTINUATION: {
+                bool continuation =
+                    frame.opcode == WEBSOCKET_OPCODE_CONTINUATION;
+                if (continuation != conn->ws_message_started) return false;
+
+                if (conn->ws_message_len + frame.payload_len
+                    > MAX_WS_MESSAGE_SIZE) {
+                    return false;
+                }
+
+                conn->ws_message = brealloc(conn->ws_message,
+                    conn->ws_message_len + frame.payload_len + 1);
+                memcpy(conn->ws_message + conn->ws_message_len,
+                    frame.payload, frame.payload_len);
+                conn->ws_message_len += frame.payload_len;
+                conn->ws_message_started = true;
+
+                if (frame.fin) {
+                    http_connection_deliver_ws_message(server, conn);
+                }
+            } break;
+
+            case WEBSOCKET_OPCODE_CLOSE:
+                // Echo the status code back and close the connection
+                http_connection_send_ws_frame(conn, WEBSOCKET_OPCODE_CLOSE,
+                    frame.payload, frame.payload_len >= 2 ? 2 : 0);
+                conn->close_after_write = true;
+                break;
+
+            case WEBSOCKET_OPCODE_PING:
+                http_connection_send_ws_frame(conn, WEBSOCKET_OPCODE_PONG,
+                    frame.payload, frame.payload_len);
+                break;
+
+            case WEBSOCKET_OPCODE_PONG:
+                break;
+
+            default:
+                return false;
+        }
+
+        memmove(conn->ws_in, conn->ws_in + frame_len,
+            conn->ws_in_len - frame_len);
+        conn->ws_in_len -= frame_len;
+    }
+
+    return true;
+}
+
+static void http_connection_ws_reserve(
+    struct http_connection *conn,
+    size_t additional
+) {
+    if (conn->ws_in_len + additional > conn->ws_in_capacity) {
+        conn->ws_in_capacity = conn->ws_in_len + additional;
+        conn->ws_in = brealloc(conn->ws_in, conn->ws_in_capacity);
+    }
+}
+
+static void http_server_handle_request(
+    struct http_server *server,
+    struct http_connection *conn,
+    struct http_request *request
+) {
+    if (strcmp(request->method, "GET") != 0
+        && strcmp(request->method, "HEAD") != 0) {
+        const char body[] = "Method Not Allowed";
+        http_connection_respond(conn, request,
+            "405 Method Not Allowed", "text/plain",
+            body, sizeof(body) - 1
+        );
+        return;
+    }
+
+    const char *upgrade = http_request_get_header(request, "Upgrade");
+    if (upgrade && header_has_token(upgrade, "websocket")) {
+        http_connection_upgrade(server, conn, request);
+        return;
+    }
+
+    const struct asset *asset = asset_cache_find(server->assets, request->path);
+    if (asset) {
+        http_connection_send_asset(conn, request, asset);
+    } else {
+        const char body[] = "Not Found";
+        http_connection_respond(conn, request,
+            "404 Not Found", "text/plain",
+            body, sizeof(body) - 1
+        );
+    }
+}
+
+/**
+ * Handles all the complete requests in the connection's buffer.
+ *
+ * @return false if the connection has to be closed.
+ */
+static bool http_connection_process(
+    struct http_server *server,
+    struct http_connection *conn
+) {
+    while (!conn->close_after_write) {
+        // Discard request bodies, we never need them
+        if (conn->body_remaining > 0) {
+            size_t skip = conn->body_remaining < conn->request_len
+                ? conn->body_remaining
+                : conn->request_len;
+            memmove(conn->request, conn->request + skip,
+                conn->request_len - skip);
+            conn->request_len -= skip;
+            conn->body_remaining -= skip;
+
+            if (conn->body_remaining > 0) break;
+        }
+
+        // Keep the buffer null-terminated, so it can be searched as a string
+        conn->request[conn->request_len] = '\0';
+
+        char *header_end = strstr(conn->request, "\r\n\r\n");
+        if (!header_end) {
+            if (conn->request_len >= MAX_REQUEST_SIZE - 1) {
+                // The header does not fit in the buffer
+                return false;
+            }
+            break;
+        }
+
+        size_t header_len = header_end + 4 - conn->request;
+
+        struct http_request request;
+        header_end[2] = '\0';
+        if (!http_request_parse(conn->request, &request)) {
+            return false;
+        }
+
+        http_server_handle_request(server, conn, &request);
+
+        memmove(conn->request, conn->request + header_len,
+            conn->request_len - header_len);
+        conn->request_len -= header_len;
+        conn->body_remaining = request.content_length;
+
+        if (conn->websocket) {
+            // Whatever follows the handshake is already WebSocket data
+            if (conn->request_len > 0) {
+                http_connection_ws_reserve(conn, conn->request_len);
+                memcpy(conn->ws_in, conn->request, conn->request_len);
+                conn->ws_in_len = conn->request_len;
+                conn->request_len = 0;
+            }
+
+            return http_connection_process_ws(server, conn);
+        }
+    }
+
+    return true;
+}
+
+static void http_server_accept(struct http_server *server) {
     while (1) {
         struct sockaddr_in client_address;
         socklen_t client_address_len = sizeof(client_address);
@@ -100,42 +770,297 @@ void* http_server_loop(void *arg) {
         );
 
         if (client_fd < 0) {
-            obs_log(LOG_ERROR, "accept failed: %s", strerror(errno));
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                obs_log(LOG_ERROR, "accept failed: %s", strerror(errno));
+            }
+            return;
+        }
+
+        if (!set_nonblocking(client_fd)) {
+            obs_log(LOG_ERROR, "fcntl failed: %s", strerror(errno));
+            close(client_fd);
             continue;
         }
 
-        char header[1024];
-        int bytes_recvd = recv(client_fd, header, 1024, 0);
-        if (bytes_recvd < 0) {
-            obs_log(LOG_ERROR, "recv failed: %s", strerror(errno));
+        // Responses and frames are written whole, so Nagle's algorithm only
+        // holds back the next one until the client's delayed ACK
+        setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+#ifdef SO_NOSIGPIPE
+        setsockopt(client_fd, SOL_SOCKET, SO_NOSIGPIPE, &(int){1}, sizeof(int));
+#endif
+
+        struct http_connection *conn =
+            bzalloc(sizeof(struct http_connection));
+        conn->fd = client_fd;
+        conn->id = ++server->next_connection_id;
+        conn->last_activity = os_gettime_ns();
+
+        if (!poller_add(server->poller, client_fd, POLLER_READ, conn)) {
+            obs_log(LOG_ERROR, "poller_add failed: %s", strerror(errno));
+            close(client_fd);
+            bfree(conn);
+            continue;
+        }
+
+        conn->next = server->connections;
+        if (server->connections) {
+            server->connections->prev = conn;
+        }
+        server->connections = conn;
+    }
+}
+
+static void http_connection_on_event(
+    struct http_server *server,
+    struct http_connection *conn,
+    uint32_t events
+) {
+    conn->last_activity = os_gettime_ns();
+    conn->ws_pinged = false;
+
+    if (events & POLLER_ERROR) {
+        http_connection_close(server, conn);
+        return;
+    }
+
+    if ((events & POLLER_READ) && conn->websocket) {
+        // Whatever is left is read on the next round, since the events are
+        // level-triggered, so a fast client can neither make the buffer grow
+        // without bounds nor hold up the other connections for long
+        while (conn->ws_in_len <= MAX_WS_BUFFER_SIZE) {
+            http_connection_ws_reserve(conn, READ_SIZE);
+            ssize_t received = recv(
+                conn->fd,
+                conn->ws_in + conn->ws_in_len,
+                READ_SIZE,
+                0
+            );
+
+            if (received == 0) {
+                http_connection_close(server, conn);
+                return;
+            } else if (received < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                http_connection_close(server, conn);
+                return;
+            }
+
+            conn->ws_in_len += received;
+        }
+
+        if (!http_connection_process_ws(server, conn)) {
+            http_connection_close(server, conn);
+            return;
+        }
+    }
+
+    // Do not read further requests until the previous responses are sent
+    if ((events & POLLER_READ) && !conn->websocket && conn->out_len == 0) {
+        while (conn->request_len < MAX_REQUEST_SIZE - 1) {
+            ssize_t received = recv(
+                conn->fd,
+                conn->request + conn->request_len,
+                MAX_REQUEST_SIZE - 1 - conn->request_len,
+                0
+            );
+
+            if (received == 0) {
+                http_connection_close(server, conn);
+                return;
+            } else if (received < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                http_connection_close(server, conn);
+                return;
+            }
+
+            conn->request_len += received;
+        }
+
+        if (!http_connection_process(server, conn)) {
+            http_connection_close(server, conn);
+            return;
+        }
+    }
+
+    if (!http_connection_flush(server, conn)) {
+        http_connection_close(server, conn);
+        return;
+    }
+
+    if (conn->out_len == 0) {
+        if (conn->close_after_write) {
+            http_connection_close(server, conn);
+            return;
+        }
+
+        // Requests that arrived while a response was pending
+        if (!conn->websocket && conn->request_len > 0) {
+            if (!http_connection_process(server, conn)
+                || !http_connection_flush(server, conn)) {
+                http_connection_close(server, conn);
+            }
+        }
+    }
+}
+
+static void http_server_close_idle(struct http_server *server) {
+    uint64_t now = os_gettime_ns();
+
+    struct http_connection *conn = server->connections;
+    while (conn) {
+        struct http_connection *next = conn->next;
+        if (now - conn->last_activity > IDLE_TIMEOUT_NS) {
+            if (conn->websocket && !conn->ws_pinged) {
+                // Any answer resets the idle time, otherwise it is closed the
+                // next time it is found idle
+                http_connection_send_ws_frame(conn, WEBSOCKET_OPCODE_PING,
+                    NULL, 0);
+                conn->ws_pinged = true;
+                conn->last_activity = now;
+
+                if (!http_connection_flush(server, conn)) {
+                    http_connection_close(server, conn);
+                }
+            } else {
+                http_connection_close(server, conn);
+            }
+        }
+        conn = next;
+    }
+}
+
+/**
+ * Sends the frames that other threads have queued.
+ */
+static void http_server_send_outgoing(struct http_server *server) {
+    pthread_mutex_lock(&server->outgoing_mutex);
+    struct http_outgoing *item = server->outgoing_head;
+    server->outgoing_head = NULL;
+    server->outgoing_tail = NULL;
+    pthread_mutex_unlock(&server->outgoing_mutex);
+
+    while (item) {
+        struct http_outgoing *next = item->next;
+
+        struct http_connection *conn = server->connections;
+        while (conn && conn->id != item->connection_id) {
+            conn = conn->next;
+        }
+
+        if (conn && conn->websocket && !conn->close_after_write) {
+            struct iovec iov = {.iov_base = item->data, .iov_len = item->len};
+            http_connection_send(conn, &iov, 1);
+
+            if (item->close) {
+                conn->close_after_write = true;
+            }
+
+            if (!http_connection_flush(server, conn)
+                || (conn->out_len == 0 && conn->close_after_write)) {
+                http_connection_close(server, conn);
+            }
+        }
+
+        bfree(item);
+        item = next;
+    }
+}
+
+void* http_server_loop(void *arg) {
+    struct http_server *server = arg;
+    struct poller_event events[MAX_EVENTS];
+
+    os_set_thread_name("webrtc-http-server");
+
+    while (1) {
+        int count = poller_wait(server->poller, events, MAX_EVENTS, 1000);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            obs_log(LOG_ERROR, "poller_wait failed: %s", strerror(errno));
+            break;
         }
 
-        char path[1024];
-        get_path(header, bytes_recvd, path);
+        // The queued frames are sent after the batch, since sending them can
+        // close connections that still have events later in the batch
+        bool woken_up = false;
 
-        send(client_fd, http_header, (sizeof(http_header) - 1)/sizeof(char), 0);
-        if (strcmp(path, "/ws-port") == 0) {
-            send(client_fd, server->ws_port, strlen(server->ws_port)*sizeof(char), 0);
-        } else {
-            send(client_fd, server->html, strlen(server->html)*sizeof(char), 0);
+        for (int i = 0; i < count; i++) {
+            void *ptr = events[i].data;
+
+            if (events[i].events & POLLER_WAKE_UP) {
+                if (server->stopping) {
+                    return NULL;
+                }
+
+                woken_up = true;
+            } else if (ptr == &server->socket_fd) {
+                http_server_accept(server);
+            } else {
+                http_connection_on_event(server, ptr, events[i].events);
+            }
         }
 
-        shutdown(client_fd, SHUT_RDWR);
+        if (woken_up) {
+            http_server_send_outgoing(server);
+        }
+
+        http_server_close_idle(server);
     }
 
     return NULL;
 }
 
-struct http_server* http_server_create(int port) {
-    struct http_server *server = malloc(sizeof(struct http_server));
+static void http_server_free(struct http_server *server) {
+    // The owner is going away, so do not report the closed connections
+    memset(&server->ws_callbacks, 0, sizeof(server->ws_callbacks));
+
+    while (server->connections) {
+        http_connection_close(server, server->connections);
+    }
+
+    if (server->socket_fd >= 0) close(server->socket_fd);
+    if (server->poller) poller_destroy(&server->poller);
+
+    if (server->assets) asset_cache_destroy(&server->assets);
+
+    while (server->outgoing_head) {
+        struct http_outgoing *next = server->outgoing_head->next;
+        bfree(server->outgoing_head);
+        server->outgoing_head = next;
+    }
+    pthread_mutex_destroy(&server->outgoing_mutex);
+
+    bfree(server);
+}
+
+struct http_server* http_server_create(
+    int port,
+    const struct http_server_ws_callbacks *ws_callbacks,
+    void *ws_data
+) {
+    struct http_server *server = bzalloc(sizeof(struct http_server));
+    pthread_mutex_init(&server->outgoing_mutex, NULL);
+
+    if (ws_callbacks) {
+        server->ws_callbacks = *ws_callbacks;
+    }
+    server->ws_data = ws_data;
 
     server->socket_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (server->socket_fd < 0) {
         obs_log(LOG_ERROR, "socket failed: %s", strerror(errno));
-        return NULL;
+        goto error;
+    }
+
+    if (!set_nonblocking(server->socket_fd)) {
+        obs_log(LOG_ERROR, "fcntl failed: %s", strerror(errno));
+        goto error;
     }
 
-    struct sockaddr_in address;
+    struct sockaddr_in address = {0};
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
     address.sin_port = htons(port);
@@ -145,17 +1070,31 @@ struct http_server* http_server_create(int port) {
 
     if (bind(server->socket_fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
         obs_log(LOG_ERROR, "bind failed: %s", strerror(errno));
-        return NULL;
+        goto error;
     }
 
-    if (listen(server->socket_fd, 2) < 0) {
+    if (listen(server->socket_fd, LISTEN_BACKLOG) < 0) {
         obs_log(LOG_ERROR, "listen failed: %s", strerror(errno));
-        return NULL;
+        goto error;
     }
 
-    server->html = http_server_read_html();
+    server->poller = poller_create();
+    if (!server->poller) {
+        obs_log(LOG_ERROR, "poller_create failed: %s", strerror(errno));
+        goto error;
+    }
 
-    server->ws_port = "-1";
+    // The listening socket is told apart from the connections by pointing
+    // to its field in the server struct
+    if (!poller_add(server->poller, server->socket_fd, POLLER_READ,
+            &server->socket_fd)) {
+        obs_log(LOG_ERROR, "poller_add failed: %s", strerror(errno));
+        goto error;
+    }
+
+    char *client_dir = obs_module_file("client");
+    server->assets = asset_cache_create(client_dir);
+    bfree(client_dir);
 
     int result = pthread_create(
         &server->listen_thread,
@@ -166,25 +1105,84 @@ struct http_server* http_server_create(int port) {
 
     if (result != 0) {
         obs_log(LOG_ERROR, "pthread_create failed: %s", strerror(result));
-        return NULL;
+        errno = result;
+        goto error;
     }
 
     return server;
+
+error:;
+    // Keep errno intact for the caller's error message
+    int error = errno;
+    http_server_free(server);
+    errno = error;
+    return NULL;
+}
+
+static void http_server_wake_up(struct http_server *server) {
+    if (!poller_wake_up(server->poller)) {
+        obs_log(LOG_ERROR, "poller_wake_up failed: %s", strerror(errno));
+    }
 }
 
 void http_server_destroy(struct http_server **server_ptr) {
     struct http_server *server = *server_ptr;
 
-    // Stop the listen thread
-    pthread_cancel(server->listen_thread);
+    // Wake up the listen thread and wait for it to exit
+    server->stopping = true;
+    http_server_wake_up(server);
+    pthread_join(server->listen_thread, NULL);
 
-    bfree(server->html);
-    free(server);
+    http_server_free(server);
 
     *server_ptr = NULL;
 }
 
-void http_server_set_ws_port(struct http_server *server, int port) {
-    server->ws_port = malloc(6 * sizeof(char));
-    snprintf(server->ws_port, 6, "%d", port);
-}
\ No newline at end of file
+static void http_server_queue_outgoing(
+    struct http_server *server,
+    uint64_t connection_id,
+    enum websocket_opcode opcode,
+    const void *payload,
+    size_t len,
+    bool close
+) {
+    uint8_t header[WEBSOCKET_MAX_HEADER_SIZE];
+    size_t header_len = websocket_write_header(header, opcode, len);
+
+    struct http_outgoing *item =
+        bmalloc(sizeof(struct http_outgoing) + header_len + len);
+    item->connection_id = connection_id;
+    item->close = close;
+    item->len = header_len + len;
+    item->next = NULL;
+    memcpy(item->data, header, header_len);
+    if (len > 0) memcpy(item->data + header_len, payload, len);
+
+    pthread_mutex_lock(&server->outgoing_mutex);
+    if (server->outgoing_tail) {
+        server->outgoing_tail->next = item;
+    } else {
+        server->outgoing_head = item;
+    }
+    server->outgoing_tail = item;
+    pthread_mutex_unlock(&server->outgoing_mutex);
+
+    http_server_wake_up(server);
+}
+
+void http_server_ws_send(
+    struct http_server *server,
+    uint64_t connection_id,
+    const char *message,
+    size_t len
+) {
+    http_server_queue_outgoing(server, connection_id,
+        WEBSOCKET_OPCODE_TEXT, message, len, false);
+}
+
+void http_server_ws_close(struct http_server *server, uint64_t connection_id) {
+    // Status code 1000, normal closure
+    const uint8_t status[2] = {0x03, 0xe8};
+    http_server_queue_outgoing(server, connection_id,
+        WEBSOCKET_OPCODE_CLOSE, status, sizeof(status), true);
+}
@@ -16,14 +16,57 @@ You should have received a copy of the GNU General Public License along
 with this program. If not, see <https://www.gnu.org/licenses/>
 */
 
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 struct http_server;
 
 /**
- * Creates and starts an HTTP server.
+ * Callbacks for the WebSocket connections of the server. They are called from
+ * the server's thread, and every connection is identified by an ID that is
+ * unique for the lifetime of the server.
+ */
+struct http_server_ws_callbacks {
+    /**
+     * Called when a client asks to upgrade a connection to WebSocket.
+     *
+     * @param path The request path the client connected to.
+     * @return Whether to accept the connection.
+     */
+    bool (*open)(void *data, uint64_t connection_id, const char *path);
+
+    /**
+     * Called for every complete message. The message is null-terminated.
+     */
+    void (*message)(
+        void *data,
+        uint64_t connection_id,
+        const char *message,
+        size_t len
+    );
+
+    /**
+     * Called when an accepted connection is closed, from either side.
+     */
+    void (*close)(void *data, uint64_t connection_id);
+};
+
+/**
+ * Creates and starts an HTTP server, which also accepts WebSocket connections
+ * on the same port.
  *
  * @param port The port to listen on.
+ * @param ws_callbacks Handlers for WebSocket connections, may be NULL.
+ * @param ws_data Passed to the WebSocket handlers.
  */
-struct http_server* http_server_create(int port);
+struct http_server* http_server_create(
+    int port,
+    const struct http_server_ws_callbacks *ws_callbacks,
+    void *ws_data
+);
 
 /**
  * Stops and destroys the HTTP server.
@@ -31,7 +74,17 @@ struct http_server* http_server_create(int port);
 void http_server_destroy(struct http_server **server_ptr);
 
 /**
- * Set the port that the WebSocket server listens on, so it gets sent to the
- * clients.
+ * Sends a text message over a WebSocket connection. Can be called from any
+ * thread. Messages to connections that have been closed are dropped.
+ */
+void http_server_ws_send(
+    struct http_server *server,
+    uint64_t connection_id,
+    const char *message,
+    size_t len
+);
+
+/**
+ * Closes a WebSocket connection. Can be called from any thread.
  */
-void http_server_set_ws_port(struct http_server *server, int port);
\ No newline at end of file
+void http_server_ws_close(struct http_server *server, uint64_t connection_id);
@@ -0,0 +1,308 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#include "latency-stats.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+#include <obs.h>
+#include <util/platform.h>
+#include <util/threading.h>
+
+// The RTP clock rate of all video codecs
+#define VIDEO_CLOCK_RATE 90000
+
+// Seconds between the NTP epoch (1900) and the Unix epoch (1970)
+#define NTP_UNIX_OFFSET 2208988800ULL
+
+// Frames that are still in flight, i.e. not yet handed to OBS
+#define MAX_PENDING_FRAMES 64
+
+// The number of frames the percentiles are computed over
+#define WINDOW_SIZE 512
+
+struct pending_frame {
+    bool used;
+    uint32_t rtp_timestamp;
+    uint64_t first_packet;
+    // When the receiver released the last packet so far
+    uint64_t released;
+    uint64_t decoding;
+    uint64_t decoded;
+};
+
+struct latency_window {
+    double samples[WINDOW_SIZE];
+    size_t next;
+    size_t count;
+};
+
+struct latency_stats {
+    pthread_mutex_t mutex;
+
+    // The wall clock minus os_gettime_ns(), to bring the sender's wall clock
+    // to our time base
+    int64_t wall_clock_offset;
+
+    bool have_sender_report;
+    // The sender's wall clock at sender_report_rtp, in Unix nanoseconds
+    int64_t sender_report_time;
+    uint32_t sender_report_rtp;
+
+    struct pending_frame frames[MAX_PENDING_FRAMES];
+
+    struct latency_window network;
+    struct latency_window jitter_buffer;
+    struct latency_window queue;
+    struct latency_window decode;
+    struct latency_window output;
+    struct latency_window total;
+};
+
+static int64_t get_wall_clock_offset(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    int64_t wall_clock = (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+    return wall_clock - (int64_t) os_gettime_ns();
+}
+
+struct latency_stats* latency_stats_create(void) {
+    struct latency_stats *stats = bzalloc(sizeof(struct latency_stats));
+    pthread_mutex_init(&stats->mutex, NULL);
+    stats->wall_clock_offset = get_wall_clock_offset();
+    return stats;
+}
+
+void latency_stats_destroy(struct latency_stats **stats) {
+    pthread_mutex_destroy(&(*stats)->mutex);
+    bfree(*stats);
+    *stats = NULL;
+}
+
+void latency_stats_reset(struct latency_stats *stats) {
+    pthread_mutex_lock(&stats->mutex);
+
+    stats->have_sender_report = false;
+    memset(stats->frames, 0, sizeof(stats->frames));
+    stats->network.count = stats->network.next = 0;
+    stats->jitter_buffer.count = stats->jitter_buffer.next = 0;
+    stats->queue.count = stats->queue.next = 0;
+    stats->decode.count = stats->decode.next = 0;
+    stats->output.count = stats->output.next = 0;
+    stats->total.count = stats->total.next = 0;
+
+    // The wall clock may have been adjusted in the meantime
+    stats->wall_clock_offset = get_wall_clock_offset();
+
+    pthread_mutex_unlock(&stats->mutex);
+}
+
+void latency_stats_sender_report(
+    struct latency_stats *stats,
+    uint64_t ntp_timestamp,
+    uint32_t rtp_timestamp
+) {
+    uint64_t seconds = ntp_timestamp >> 32;
+    uint64_t fraction = ntp_timestamp & 0xffffffff;
+    if (seconds < NTP_UNIX_OFFSET) return;
+
+    int64_t time = (int64_t) (seconds - NTP_UNIX_OFFSET) * 1000000000
+        + (int64_t) ((fraction * 1000000000) >> 32);
+
+    pthread_mutex_lock(&stats->mutex);
+    stats->have_sender_report = true;
+    stats->sender_report_time = time;
+    stats->sender_report_rtp = rtp_timestamp;
+    pthread_mutex_unlock(&stats->mutex);
+}
+
+// Must be called with the mutex held
+static struct pending_frame* find_frame(
+    struct latency_stats *stats,
+    uint32_t rtp_timestamp
+) {
+    for (size_t i = 0; i < MAX_PENDING_FRAMES; i++) {
+        struct pending_frame *frame = &stats->frames[i];
+        if (frame->used && frame->rtp_timestamp == rtp_timestamp) {
+            return frame;
+        }
+    }
+    return NULL;
+}
+
+void latency_stats_packet_received(
+    struct latency_stats *stats,
+    uint32_t rtp_timestamp,
+    uint64_t arrival_time,
+    uint64_t time
+) {
+    pthread_mutex_lock(&stats->mutex);
+
+    struct pending_frame *frame = find_frame(stats, rtp_timestamp);
+    if (!frame) {
+        // Take a free slot, or the oldest one if frames were lost
+        frame = &stats->frames[0];
+        for (size_t i = 0; i < MAX_PENDING_FRAMES; i++) {
+            struct pending_frame *candidate = &stats->frames[i];
+            if (!candidate->used) {
+                frame = candidate;
+                break;
+            }
+            if (candidate->first_packet < frame->first_packet) {
+                frame = candidate;
+            }
+        }
+
+        *frame = (struct pending_frame) {
+            .used = true,
+            .rtp_timestamp = rtp_timestamp,
+            .first_packet = arrival_time,
+        };
+    }
+
+    // The packets are released in order, so the last one released is the
+    // end of the frame, even if its marker packet was lost
+    frame->released = time;
+
+    pthread_mutex_unlock(&stats->mutex);
+}
+
+void latency_stats_frame_decoding(
+    struct latency_stats *stats,
+    uint32_t rtp_timestamp,
+    uint64_t time
+) {
+    pthread_mutex_lock(&stats->mutex);
+
+    struct pending_frame *frame = find_frame(stats, rtp_timestamp);
+    if (frame) {
+        frame->decoding = time;
+    }
+
+    pthread_mutex_unlock(&stats->mutex);
+}
+
+void latency_stats_frame_decoded(
+    struct latency_stats *stats,
+    uint32_t rtp_timestamp,
+    uint64_t time
+) {
+    pthread_mutex_lock(&stats->mutex);
+
+    struct pending_frame *frame = find_frame(stats, rtp_timestamp);
+    if (frame) {
+        frame->decoded = time;
+    }
+
+    pthread_mutex_unlock(&stats->mutex);
+}
+
+static void window_add(struct latency_window *window, int64_t duration) {
+    window->samples[window->next] = duration / 1000000.0;
+    window->next = (window->next + 1) % WINDOW_SIZE;
+    if (window->count < WINDOW_SIZE) {
+        window->count++;
+    }
+}
+
+void latency_stats_frame_output(
+    struct latency_stats *stats,
+    uint32_t rtp_timestamp,
+    uint64_t time
+) {
+    pthread_mutex_lock(&stats->mutex);
+
+    struct pending_frame *frame = find_frame(stats, rtp_timestamp);
+    if (!frame) {
+        pthread_mutex_unlock(&stats->mutex);
+        return;
+    }
+
+    // Frames that were decoded without going through the parser, e.g. when
+    // fast-forwarding, have no time at which they were handed to the decoder
+    uint64_t decoded = frame->decoded ? frame->decoded : time;
+    uint64_t decoding = frame->decoding ? frame->decoding : frame->released;
+
+    window_add(&stats->jitter_buffer, frame->released - frame->first_packet);
+    window_add(&stats->queue, decoding - frame->released);
+    window_add(&stats->decode, decoded - decoding);
+    window_add(&stats->output, time - decoded);
+
+    if (stats->have_sender_report) {
+        // The RTP timestamp may be slightly before the sender report
+        int32_t rtp_delta = (int32_t) (rtp_timestamp - stats->sender_report_rtp);
+        int64_t capture = stats->sender_report_time
+            + (int64_t) rtp_delta * 1000000000 / VIDEO_CLOCK_RATE
+            - stats->wall_clock_offset;
+
+        window_add(&stats->network, (int64_t) frame->first_packet - capture);
+        window_add(&stats->total, (int64_t) time - capture);
+    }
+
+    frame->used = false;
+
+    pthread_mutex_unlock(&stats->mutex);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @return The index of the given percentile in n sorted samples.
+ */
+static inline size_t nearest_rank(size_t percentile, size_t n) {
+    return (percentile * n + 99) / 100 - 1;
+}
+
+static void window_get_percentiles(
+    const struct latency_window *window,
+    struct latency_percentiles *percentiles
+) {
+    *percentiles = (struct latency_percentiles) {0};
+    if (window->count == 0) return;
+
+    double sorted[WINDOW_SIZE];
+    memcpy(sorted, window->samples, window->count * sizeof(double));
+    qsort(sorted, window->count, sizeof(double), compare_doubles);
+
+    size_t n = window->count;
+    percentiles->p50 = sorted[nearest_rank(50, n)];
+    percentiles->p95 = sorted[nearest_rank(95, n)];
+    percentiles->p99 = sorted[nearest_rank(99, n)];
+    percentiles->count = n;
+}
+
+void latency_stats_get_report(
+    struct latency_stats *stats,
+    struct latency_report *report
+) {
+    pthread_mutex_lock(&stats->mutex);
+
+    window_get_percentiles(&stats->network, &report->network);
+    window_get_percentiles(&stats->jitter_buffer, &report->jitter_buffer);
+    window_get_percentiles(&stats->queue, &report->queue);
+    window_get_percentiles(&stats->decode, &report->decode);
+    window_get_percentiles(&stats->output, &report->output);
+    window_get_percentiles(&stats->total, &report->total);
+
+    pthread_mutex_unlock(&stats->mutex);
+}
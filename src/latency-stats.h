@@ -0,0 +1,130 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Per-frame latency of the received video, split into stages:
+ *
+ * - network: from capture on the sender to the arrival of the frame's first
+ *   packet. The capture time is taken from the RTP timestamp, mapped to the
+ *   sender's wall clock with the RTCP sender reports, so this is only
+ *   accurate if both clocks are synchronized, e.g. through NTP.
+ * - jitter_buffer: from the arrival of the frame's first packet until the
+ *   receiver passes its last packet on, including the time it was held back
+ *   to wait for missing packets.
+ * - queue: from there until the access unit is handed to the decoder, i.e.
+ *   waiting for a decoding thread and for the parser to complete the frame.
+ * - decode: from the access unit being handed to the decoder until the
+ *   decoder returns the frame.
+ * - output: from the decoder until the frame has been handed to OBS.
+ * - total: from capture until the frame has been handed to OBS.
+ *
+ * All times are in nanoseconds of os_gettime_ns(). The functions can be
+ * called from any thread.
+ */
+
+struct latency_stats;
+
+struct latency_percentiles {
+    double p50;
+    double p95;
+    double p99;
+    // The number of samples the percentiles were computed from
+    size_t count;
+};
+
+/**
+ * Rolling percentiles over the most recent frames, in milliseconds.
+ */
+struct latency_report {
+    struct latency_percentiles network;
+    struct latency_percentiles jitter_buffer;
+    struct latency_percentiles queue;
+    struct latency_percentiles decode;
+    struct latency_percentiles output;
+    struct latency_percentiles total;
+};
+
+struct latency_stats* latency_stats_create(void);
+
+void latency_stats_destroy(struct latency_stats **stats);
+
+/**
+ * Forgets everything, e.g. when a new client connects.
+ */
+void latency_stats_reset(struct latency_stats *stats);
+
+/**
+ * Records the timestamps of an RTCP sender report.
+ *
+ * @param ntp_timestamp The sender's wall clock, in the 32.32 fixed point NTP
+ * format.
+ * @param rtp_timestamp The RTP timestamp that corresponds to ntp_timestamp.
+ */
+void latency_stats_sender_report(
+    struct latency_stats *stats,
+    uint64_t ntp_timestamp,
+    uint32_t rtp_timestamp
+);
+
+/**
+ * Records an RTP packet as the receiver passes it on.
+ *
+ * @param arrival_time When the packet arrived.
+ * @param time When the receiver released it.
+ */
+void latency_stats_packet_received(
+    struct latency_stats *stats,
+    uint32_t rtp_timestamp,
+    uint64_t arrival_time,
+    uint64_t time
+);
+
+/**
+ * Records that the access unit of a frame was handed to the decoder.
+ */
+void latency_stats_frame_decoding(
+    struct latency_stats *stats,
+    uint32_t rtp_timestamp,
+    uint64_t time
+);
+
+void latency_stats_frame_decoded(
+    struct latency_stats *stats,
+    uint32_t rtp_timestamp,
+    uint64_t time
+);
+
+/**
+ * Records that a frame was handed to OBS. This completes the frame, and
+ * its latencies are added to the rolling window.
+ */
+void latency_stats_frame_output(
+    struct latency_stats *stats,
+    uint32_t rtp_timestamp,
+    uint64_t time
+);
+
+void latency_stats_get_report(
+    struct latency_stats *stats,
+    struct latency_report *report
+);
@@ -0,0 +1,123 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#include "plugin-config.h"
+
+#include <obs-module.h>
+#include <util/platform.h>
+#include "plugin-support.h"
+
+#define CONFIG_FILE "config.json"
+
+static obs_data_t *config = NULL;
+
+/**
+ * Sets a default that is also written to the file, so that users can see
+ * which settings exist.
+ */
+static void set_default_int(obs_data_t *data, const char *name, long long val) {
+    obs_data_set_default_int(data, name, val);
+    if (!obs_data_has_user_value(data, name)) {
+        obs_data_set_int(data, name, val);
+    }
+}
+
+static void set_default_bool(obs_data_t *data, const char *name, bool val) {
+    obs_data_set_default_bool(data, name, val);
+    if (!obs_data_has_user_value(data, name)) {
+        obs_data_set_bool(data, name, val);
+    }
+}
+
+static void set_default_string(
+    obs_data_t *data,
+    const char *name,
+    const char *val
+) {
+    obs_data_set_default_string(data, name, val);
+    if (!obs_data_has_user_value(data, name)) {
+        obs_data_set_string(data, name, val);
+    }
+}
+
+static void plugin_config_set_defaults(obs_data_t *data) {
+    set_default_int(data, "http_server_port", 3080);
+
+    // The least severe messages of libdatachannel that are logged: none,
+    // fatal, error, warning, info, debug or verbose
+    set_default_string(data, "webrtc_log_level", "warning");
+
+    // A directory to capture the RTP of every guest to, for webrtc-replay.
+    // Empty to disable.
+    set_default_string(data, "rtp_capture_dir", "");
+
+    // How long the video waits for a lost packet to be retransmitted or
+    // repaired before it is given up on. Only delays the frames after a loss.
+    set_default_int(data, "loss_wait_ms", 100);
+
+    // How many threads decode the video of all the sources together, which
+    // caps the cores that decoding can take from OBS and its encoders. 0 uses
+    // half of the logical cores.
+    set_default_int(data, "decode_threads", 0);
+
+    // How many megabytes of video since the last keyframe every source
+    // keeps, so that full decoding can resume without waiting for a new
+    // keyframe. 0 to disable.
+    set_default_int(data, "gop_cache_mb", 16);
+
+    // Whether the peer connections of all the sources share a single UDP
+    // socket, instead of one each, so that a single port has to be open on
+    // the firewall
+    set_default_bool(data, "ice_udp_mux", true);
+
+    // The range that the UDP ports of the peer connections are taken from.
+    // With ice_udp_mux, the shared port is the first free one, so the same
+    // value twice fixes it. 0 for any.
+    set_default_int(data, "ice_port_range_begin", 0);
+    set_default_int(data, "ice_port_range_end", 0);
+}
+
+void plugin_config_load(void) {
+    char *path = obs_module_config_path(CONFIG_FILE);
+
+    config = obs_data_create_from_json_file_safe(path, "bak");
+    if (!config) {
+        config = obs_data_create();
+    }
+
+    plugin_config_set_defaults(config);
+
+    // Write the defaults out, so that there is a file to edit
+    char *dir = obs_module_config_path("");
+    os_mkdirs(dir);
+    bfree(dir);
+
+    if (!obs_data_save_json_safe(config, path, "tmp", "bak")) {
+        obs_log(LOG_WARNING, "Could not write %s", path);
+    }
+
+    bfree(path);
+}
+
+void plugin_config_free(void) {
+    obs_data_release(config);
+    config = NULL;
+}
+
+obs_data_t* plugin_config_get(void) {
+    return config;
+}
@@ -0,0 +1,38 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#pragma once
+
+#include <obs.h>
+
+/*
+ * Plugin-wide settings, shared by all the sources. They are stored in
+ * config.json in the plugin's configuration directory, which is written with
+ * the defaults on the first run so that it can be edited by hand.
+ */
+
+/**
+ * Loads the configuration file. Called once when the module is loaded.
+ */
+void plugin_config_load(void);
+
+void plugin_config_free(void);
+
+/**
+ * @return The plugin-wide settings. Owned by the plugin, do not release.
+ */
+obs_data_t* plugin_config_get(void);
@@ -19,12 +19,37 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 #include <obs-module.h>
 #include <plugin-support.h>
 
+#include "plugin-config.h"
+#include "decode-scheduler.h"
+#include "trace.h"
+#include "signaling-server.h"
+#include "webrtc.h"
+
 OBS_DECLARE_MODULE()
 OBS_MODULE_USE_DEFAULT_LOCALE(PLUGIN_NAME, "en-US")
 
 extern struct obs_source_info webrtc_source;
 
 bool obs_module_load(void) {
+	plugin_config_load();
+	obs_data_t *config = plugin_config_get();
+
+	struct webrtc_ice_config ice = {
+		.udp_mux = obs_data_get_bool(config, "ice_udp_mux"),
+		.port_range_begin = obs_data_get_int(config, "ice_port_range_begin"),
+		.port_range_end = obs_data_get_int(config, "ice_port_range_end"),
+	};
+	webrtc_init(obs_data_get_string(config, "webrtc_log_level"), &ice);
+
+	// Without the threads, every source decodes on its receiving thread
+	decode_scheduler_start((int) obs_data_get_int(config, "decode_threads"));
+
+	// All the sources share a single server. If it cannot start, the sources
+	// are still registered, so that scenes using them still load.
+	int port = obs_data_get_int(config, "http_server_port");
+	if (!signaling_server_start(port)) {
+		obs_log(LOG_ERROR, "Could not start the server on port %d", port);
+	}
 
 	obs_register_source(&webrtc_source);
 
@@ -34,5 +59,11 @@ bool obs_module_load(void) {
 }
 
 void obs_module_unload(void) {
+	signaling_server_stop();
+	decode_scheduler_stop();
+	webrtc_shutdown();
+	trace_free();
+	plugin_config_free();
+
 	obs_log(LOG_INFO, "plugin unloaded");
 }
@@ -0,0 +1,270 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#include "poller.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#else
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+
+#include <obs-module.h>
+
+// The most events that are returned by a single wait
+#define MAX_EVENTS 64
+
+#ifdef __linux__
+
+struct poller {
+    int epoll_fd;
+    int wakeup_fd;
+    struct epoll_event events[MAX_EVENTS];
+};
+
+static uint32_t to_epoll_events(uint32_t events) {
+    return ((events & POLLER_READ) ? EPOLLIN : 0)
+        | ((events & POLLER_WRITE) ? EPOLLOUT : 0);
+}
+
+struct poller* poller_create(void) {
+    struct poller *poller = bzalloc(sizeof(struct poller));
+    poller->wakeup_fd = -1;
+
+    poller->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (poller->epoll_fd < 0) goto error;
+
+    poller->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (poller->wakeup_fd < 0) goto error;
+
+    // Told apart from the other file descriptors by its data
+    struct epoll_event event = {
+        .events = EPOLLIN,
+        .data.ptr = &poller->wakeup_fd,
+    };
+    if (epoll_ctl(poller->epoll_fd, EPOLL_CTL_ADD, poller->wakeup_fd, &event) < 0) {
+        goto error;
+    }
+
+    return poller;
+
+error:;
+    int error = errno;
+    poller_destroy(&poller);
+    errno = error;
+    return NULL;
+}
+
+void poller_destroy(struct poller **poller_ptr) {
+    struct poller *poller = *poller_ptr;
+    if (poller->epoll_fd >= 0) close(poller->epoll_fd);
+    if (poller->wakeup_fd >= 0) close(poller->wakeup_fd);
+    bfree(poller);
+    *poller_ptr = NULL;
+}
+
+bool poller_add(struct poller *poller, int fd, uint32_t events, void *data) {
+    struct epoll_event event = {
+        .events = to_epoll_events(events),
+        .data.ptr = data,
+    };
+    return epoll_ctl(poller->epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+bool poller_modify(struct poller *poller, int fd, uint32_t events, void *data) {
+    struct epoll_event event = {
+        .events = to_epoll_events(events),
+        .data.ptr = data,
+    };
+    return epoll_ctl(poller->epoll_fd, EPOLL_CTL_MOD, fd, &event) == 0;
+}
+
+void poller_remove(struct poller *poller, int fd) {
+    epoll_ctl(poller->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+int poller_wait(
+    struct poller *poller,
+    struct poller_event *events,
+    int max_events,
+    int timeout_ms
+) {
+    if (max_events > MAX_EVENTS) max_events = MAX_EVENTS;
+
+    int count = epoll_wait(poller->epoll_fd, poller->events, max_events,
+        timeout_ms);
+
+    for (int i = 0; i < count; i++) {
+        struct epoll_event *event = &poller->events[i];
+
+        if (event->data.ptr == &poller->wakeup_fd) {
+            uint64_t value;
+            if (read(poller->wakeup_fd, &value, sizeof(value)) < 0) {
+                // Nothing to do, the eventfd is reset either way
+            }
+
+            events[i].data = NULL;
+            events[i].events = POLLER_WAKE_UP;
+            continue;
+        }
+
+        events[i].data = event->data.ptr;
+        events[i].events = ((event->events & EPOLLIN) ? POLLER_READ : 0)
+            | ((event->events & EPOLLOUT) ? POLLER_WRITE : 0)
+            | ((event->events & (EPOLLERR | EPOLLHUP)) ? POLLER_ERROR : 0);
+    }
+
+    return count;
+}
+
+bool poller_wake_up(struct poller *poller) {
+    uint64_t value = 1;
+    return write(poller->wakeup_fd, &value, sizeof(value)) == sizeof(value);
+}
+
+#else
+
+struct poller {
+    int kqueue_fd;
+    struct kevent events[MAX_EVENTS];
+};
+
+// The identifier of the user event that wakes the poller up
+#define WAKEUP_IDENT 0
+
+struct poller* poller_create(void) {
+    struct poller *poller = bzalloc(sizeof(struct poller));
+
+    poller->kqueue_fd = kqueue();
+    if (poller->kqueue_fd < 0) goto error;
+
+    fcntl(poller->kqueue_fd, F_SETFD, FD_CLOEXEC);
+
+    struct kevent change;
+    EV_SET(&change, WAKEUP_IDENT, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, NULL);
+    if (kevent(poller->kqueue_fd, &change, 1, NULL, 0, NULL) < 0) goto error;
+
+    return poller;
+
+error:;
+    int error = errno;
+    poller_destroy(&poller);
+    errno = error;
+    return NULL;
+}
+
+void poller_destroy(struct poller **poller_ptr) {
+    struct poller *poller = *poller_ptr;
+    if (poller->kqueue_fd >= 0) close(poller->kqueue_fd);
+    bfree(poller);
+    *poller_ptr = NULL;
+}
+
+/**
+ * Reading and writing are separate filters in kqueue. Both are registered,
+ * and only the ones that are asked for are enabled, so that modifying them
+ * never has to delete a filter that may not exist.
+ */
+static bool set_filters(
+    struct poller *poller,
+    int fd,
+    uint32_t events,
+    void *data
+) {
+    struct kevent changes[2];
+    EV_SET(&changes[0], fd, EVFILT_READ,
+        EV_ADD | ((events & POLLER_READ) ? EV_ENABLE : EV_DISABLE),
+        0, 0, data);
+    EV_SET(&changes[1], fd, EVFILT_WRITE,
+        EV_ADD | ((events & POLLER_WRITE) ? EV_ENABLE : EV_DISABLE),
+        0, 0, data);
+    return kevent(poller->kqueue_fd, changes, 2, NULL, 0, NULL) == 0;
+}
+
+bool poller_add(struct poller *poller, int fd, uint32_t events, void *data) {
+    return set_filters(poller, fd, events, data);
+}
+
+bool poller_modify(struct poller *poller, int fd, uint32_t events, void *data) {
+    return set_filters(poller, fd, events, data);
+}
+
+void poller_remove(struct poller *poller, int fd) {
+    struct kevent changes[2];
+    EV_SET(&changes[0], fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+    EV_SET(&changes[1], fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+    kevent(poller->kqueue_fd, changes, 2, NULL, 0, NULL);
+}
+
+int poller_wait(
+    struct poller *poller,
+    struct poller_event *events,
+    int max_events,
+    int timeout_ms
+) {
+    if (max_events > MAX_EVENTS) max_events = MAX_EVENTS;
+
+    struct timespec timeout = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_nsec = (long) (timeout_ms % 1000) * 1000000,
+    };
+    int count = kevent(poller->kqueue_fd, NULL, 0, poller->events, max_events,
+        timeout_ms < 0 ? NULL : &timeout);
+
+    for (int i = 0; i < count; i++) {
+        struct kevent *event = &poller->events[i];
+
+        if (event->filter == EVFILT_USER) {
+            events[i].data = NULL;
+            events[i].events = POLLER_WAKE_UP;
+            continue;
+        }
+
+        events[i].data = event->udata;
+
+        // Like with epoll, a peer that only shut down its side can still be
+        // read from until the end, which the reads find out by themselves
+        if ((event->flags & EV_ERROR)
+            || ((event->flags & EV_EOF) && event->fflags != 0)) {
+            events[i].events = POLLER_ERROR;
+        } else if (event->filter == EVFILT_READ) {
+            events[i].events = POLLER_READ;
+        } else if (event->flags & EV_EOF) {
+            // Nothing can be written anymore
+            events[i].events = POLLER_ERROR;
+        } else {
+            events[i].events = POLLER_WRITE;
+        }
+    }
+
+    return count;
+}
+
+bool poller_wake_up(struct poller *poller) {
+    struct kevent change;
+    EV_SET(&change, WAKEUP_IDENT, EVFILT_USER, 0, NOTE_TRIGGER, 0, NULL);
+    return kevent(poller->kqueue_fd, &change, 1, NULL, 0, NULL) == 0;
+}
+
+#endif
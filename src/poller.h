@@ -0,0 +1,86 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Level-triggered readiness of file descriptors for the HTTP server's
+ * event loop, on epoll and an eventfd on Linux, and on kqueue elsewhere.
+ * The poller can be woken up from any other thread, e.g. to have it send
+ * what was queued for it; all the other functions belong to the thread that
+ * waits.
+ */
+
+#define POLLER_READ 0x1
+#define POLLER_WRITE 0x2
+// The connection failed or was closed by the peer in both directions
+#define POLLER_ERROR 0x4
+// poller_wake_up was called, the data of the event is NULL
+#define POLLER_WAKE_UP 0x8
+
+struct poller;
+
+struct poller_event {
+    void *data;
+    uint32_t events;
+};
+
+/**
+ * @return The poller, or NULL with errno set.
+ */
+struct poller* poller_create(void);
+
+void poller_destroy(struct poller **poller);
+
+/**
+ * Starts watching fd for the given events, which are reported with data.
+ *
+ * @return false with errno set if it failed.
+ */
+bool poller_add(struct poller *poller, int fd, uint32_t events, void *data);
+
+/**
+ * Changes the events that fd is watched for.
+ */
+bool poller_modify(struct poller *poller, int fd, uint32_t events, void *data);
+
+/**
+ * Stops watching fd, which has to be called before it is closed.
+ */
+void poller_remove(struct poller *poller, int fd);
+
+/**
+ * Waits until one of the file descriptors is ready, the poller is woken up
+ * or the timeout expires. Several wake-ups in a row may be reported once.
+ *
+ * @return The number of events, 0 on timeout, or -1 with errno set.
+ */
+int poller_wait(
+    struct poller *poller,
+    struct poller_event *events,
+    int max_events,
+    int timeout_ms
+);
+
+/**
+ * Makes the waiting thread return from poller_wait. Can be called from any
+ * thread.
+ */
+bool poller_wake_up(struct poller *poller);
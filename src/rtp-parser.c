@@ -21,14 +21,30 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 #include <obs.h>
 #include "plugin-support.h"
 
-static inline uint16_t get_16bit_number(uint8_t *data) {
+#define RTCP_SENDER_REPORT 200
+#define RTCP_TRANSPORT_FEEDBACK 205
+#define RTCP_FEEDBACK_NACK 1
+
+static inline uint16_t get_16bit_number(const uint8_t *data) {
     return (data[0] << 8) | data[1];
 }
 
-static inline uint32_t get_32bit_number(uint8_t *data) {
+static inline uint32_t get_32bit_number(const uint8_t *data) {
     return (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
 }
 
+static inline void set_16bit_number(uint8_t *data, uint16_t value) {
+    data[0] = value >> 8;
+    data[1] = value;
+}
+
+static inline void set_32bit_number(uint8_t *data, uint32_t value) {
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+
 void rtp_packet_free(struct rtp_packet *packet) {
     if (packet)
     free(packet->csrc);
@@ -93,15 +109,19 @@ struct rtp_packet* rtp_packet_parse(uint8_t *data, size_t len) {
             goto error;
         }
 
-        uint16_t ext_header_len = get_16bit_number(current + 2);
-        current += ext_header_len;
+        // The length is in 32 bit words, without the extension header header
+        size_t ext_len = 4 + (size_t) get_16bit_number(current + 2) * 4;
+        if (len - (current - data) < ext_len) {
+            goto error;
+        }
+        current += ext_len;
     }
 
     packet->payload = current;
     packet->payload_size = len - (current - data);
 
     if (padding) {
-        uint8_t padding_size = data[len];
+        uint8_t padding_size = data[len - 1];
 
         if (padding_size > packet->payload_size) {
             goto error;
@@ -120,4 +140,69 @@ error:
         free(packet);
     }
     return NULL;
-}
\ No newline at end of file
+}
+
+bool rtcp_find_sender_report(
+    const uint8_t *data,
+    size_t len,
+    uint64_t *ntp_timestamp,
+    uint32_t *rtp_timestamp
+) {
+    while (len >= 4) {
+        // The length is in 32-bit words, minus one
+        size_t packet_len = ((size_t) get_16bit_number(data + 2) + 1) * 4;
+        if ((data[0] >> 6) != 2 || packet_len > len) return false;
+
+        // Header, SSRC, NTP timestamp and RTP timestamp
+        if (data[1] == RTCP_SENDER_REPORT && packet_len >= 20) {
+            *ntp_timestamp = ((uint64_t) get_32bit_number(data + 8) << 32)
+                | get_32bit_number(data + 12);
+            *rtp_timestamp = get_32bit_number(data + 16);
+            return true;
+        }
+
+        data += packet_len;
+        len -= packet_len;
+    }
+
+    return false;
+}
+
+size_t rtcp_write_nack(
+    uint8_t *buffer,
+    size_t size,
+    uint32_t sender_ssrc,
+    uint32_t media_ssrc,
+    const uint16_t *sequence_numbers,
+    size_t count
+) {
+    size_t len = 12;
+
+    // Every entry has a packet ID and a bitmask of the 16 packets after it
+    for (size_t i = 0; i < count;) {
+        if (len + 4 > size) return 0;
+
+        uint16_t packet_id = sequence_numbers[i++];
+        uint16_t bitmask = 0;
+        while (i < count) {
+            uint16_t offset = sequence_numbers[i] - packet_id;
+            if (offset == 0 || offset > 16) break;
+            bitmask |= 1 << (offset - 1);
+            i++;
+        }
+
+        set_16bit_number(buffer + len, packet_id);
+        set_16bit_number(buffer + len + 2, bitmask);
+        len += 4;
+    }
+
+    if (len == 12) return 0;
+
+    buffer[0] = 0x80 | RTCP_FEEDBACK_NACK;
+    buffer[1] = RTCP_TRANSPORT_FEEDBACK;
+    set_16bit_number(buffer + 2, len / 4 - 1);
+    set_32bit_number(buffer + 4, sender_ssrc);
+    set_32bit_number(buffer + 8, media_ssrc);
+
+    return len;
+}
@@ -18,8 +18,13 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 #pragma once
 
 #include <stddef.h>
+#include <stdbool.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 struct rtp_packet {
     uint8_t version;
     uint8_t payload_type;
@@ -39,3 +44,38 @@ void rtp_packet_free(struct rtp_packet *packet);
 void rtp_packet_debug_print(struct rtp_packet *packet);
 
 struct rtp_packet* rtp_packet_parse(uint8_t *data, size_t len);
+
+/**
+ * Looks for a sender report in a compound RTCP packet.
+ *
+ * @param ntp_timestamp The sender's wall clock, in the 32.32 fixed point NTP
+ * format.
+ * @param rtp_timestamp The RTP timestamp that corresponds to ntp_timestamp.
+ * @return Whether a sender report was found.
+ */
+bool rtcp_find_sender_report(
+    const uint8_t *data,
+    size_t len,
+    uint64_t *ntp_timestamp,
+    uint32_t *rtp_timestamp
+);
+
+/**
+ * Writes a generic NACK (RFC 4585) that asks for the retransmission of lost
+ * packets.
+ *
+ * @param sequence_numbers The lost packets, in order.
+ * @return The length of the RTCP packet, or 0 if it does not fit in size.
+ */
+size_t rtcp_write_nack(
+    uint8_t *buffer,
+    size_t size,
+    uint32_t sender_ssrc,
+    uint32_t media_ssrc,
+    const uint16_t *sequence_numbers,
+    size_t count
+);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,921 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#include "rtp-receiver.h"
+
+#include <string.h>
+
+#include <obs.h>
+#include <util/threading.h>
+
+#include "trace.h"
+
+#define RTP_HEADER_SIZE 12
+#define MAX_PACKET_SIZE (RTP_HEADER_SIZE + UINT16_MAX)
+
+// The ULPFEC header and the level 0 header without its mask
+#define ULPFEC_HEADER_SIZE 12
+// The FlexFEC header with the SSRC and SN base of one protected stream
+#define FLEXFEC_HEADER_SIZE 18
+
+// The number of packets that are kept for ordering and FEC recovery. Must be
+// a power of two, and larger than what a single FEC packet can protect.
+#define HISTORY_SIZE 512
+#define HISTORY_MASK (HISTORY_SIZE - 1)
+
+// The number of FEC packets that are kept until they are used up
+#define MAX_FEC_PACKETS 32
+
+// How often a lost packet is asked for at most
+#define MAX_NACKS 10
+// The round trip time until the first retransmission has been measured
+#define INITIAL_RTT_NS 50000000ULL
+// Lost packets are not asked for again more often than this, even if the
+// round trip time is shorter
+#define MIN_NACK_INTERVAL_NS 5000000ULL
+
+struct history_packet {
+    bool used;
+    uint16_t sequence_number;
+    // FEC packets sent within the media stream take up a sequence number,
+    // but are not passed on
+    bool media;
+    uint64_t arrival_time;
+
+    uint8_t *data;
+    size_t len;
+    size_t capacity;
+};
+
+struct missing_packet {
+    bool pending;
+    uint16_t sequence_number;
+    uint8_t nack_count;
+    uint64_t nack_time;
+};
+
+struct fec_packet {
+    bool used;
+    uint32_t protected_ssrc;
+    uint16_t base_sequence_number;
+    // Bit i is set if base_sequence_number + i is protected
+    uint64_t mask[2];
+
+    // The XOR of the protected packets' first two bytes, timestamps and
+    // lengths after the fixed header
+    uint8_t header_recovery[2];
+    uint32_t timestamp_recovery;
+    uint16_t length_recovery;
+
+    // The XOR of the protected packets after the fixed header
+    uint8_t *payload;
+    size_t payload_len;
+    size_t capacity;
+};
+
+struct rtp_receiver {
+    struct rtp_receiver_config config;
+    rtp_receiver_callback_t callback;
+    void *callback_data;
+
+    // Guards everything below, since the stats are read from other threads
+    pthread_mutex_t mutex;
+
+    bool started;
+    uint32_t ssrc;
+    // The next packet to pass on
+    uint16_t next_sequence_number;
+    uint16_t highest_sequence_number;
+
+    struct history_packet history[HISTORY_SIZE];
+
+    // The packets between next_sequence_number and highest_sequence_number
+    // that have not arrived, for the NACKs
+    struct missing_packet missing[HISTORY_SIZE];
+    rtp_receiver_nack_callback_t nack_callback;
+    void *nack_callback_data;
+
+    struct fec_packet fec_packets[MAX_FEC_PACKETS];
+    size_t next_fec_packet;
+
+    struct rtp_receiver_stats stats;
+
+    uint8_t unwrapped[MAX_PACKET_SIZE];
+    uint8_t retransmitted[MAX_PACKET_SIZE];
+    uint8_t recovered[MAX_PACKET_SIZE];
+};
+
+static inline uint16_t get_16bit_number(const uint8_t *data) {
+    return (data[0] << 8) | data[1];
+}
+
+static inline uint32_t get_32bit_number(const uint8_t *data) {
+    return ((uint32_t) data[0] << 24) | (data[1] << 16) | (data[2] << 8)
+        | data[3];
+}
+
+static inline void set_32bit_number(uint8_t *data, uint32_t value) {
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+
+static inline int16_t sequence_diff(uint16_t a, uint16_t b) {
+    return (int16_t) (a - b);
+}
+
+static inline void mask_set(uint64_t mask[2], size_t bit) {
+    mask[bit / 64] |= 1ULL << (bit % 64);
+}
+
+static inline bool mask_get(const uint64_t mask[2], size_t bit) {
+    return (mask[bit / 64] >> (bit % 64)) & 1;
+}
+
+struct rtp_receiver* rtp_receiver_create(
+    const struct rtp_receiver_config *config,
+    rtp_receiver_callback_t callback,
+    void *callback_data
+) {
+    struct rtp_receiver *receiver = bzalloc(sizeof(struct rtp_receiver));
+    receiver->config = *config;
+    receiver->callback = callback;
+    receiver->callback_data = callback_data;
+    receiver->stats.rtt_ns = INITIAL_RTT_NS;
+    pthread_mutex_init(&receiver->mutex, NULL);
+    return receiver;
+}
+
+void rtp_receiver_set_nack_callback(
+    struct rtp_receiver *receiver,
+    rtp_receiver_nack_callback_t callback,
+    void *data
+) {
+    pthread_mutex_lock(&receiver->mutex);
+    receiver->nack_callback = callback;
+    receiver->nack_callback_data = data;
+    pthread_mutex_unlock(&receiver->mutex);
+}
+
+void rtp_receiver_destroy(struct rtp_receiver **receiver_ptr) {
+    struct rtp_receiver *receiver = *receiver_ptr;
+
+    for (size_t i = 0; i < HISTORY_SIZE; i++) {
+        bfree(receiver->history[i].data);
+    }
+    for (size_t i = 0; i < MAX_FEC_PACKETS; i++) {
+        bfree(receiver->fec_packets[i].payload);
+    }
+
+    pthread_mutex_destroy(&receiver->mutex);
+    bfree(receiver);
+    *receiver_ptr = NULL;
+}
+
+static struct history_packet* find_packet(
+    struct rtp_receiver *receiver,
+    uint16_t sequence_number
+) {
+    struct history_packet *packet =
+        &receiver->history[sequence_number & HISTORY_MASK];
+    if (!packet->used || packet->sequence_number != sequence_number) {
+        return NULL;
+    }
+    return packet;
+}
+
+static void forget_stream(struct rtp_receiver *receiver) {
+    receiver->started = false;
+    for (size_t i = 0; i < HISTORY_SIZE; i++) {
+        receiver->history[i].used = false;
+        receiver->missing[i].pending = false;
+    }
+    for (size_t i = 0; i < MAX_FEC_PACKETS; i++) {
+        receiver->fec_packets[i].used = false;
+    }
+}
+
+static struct missing_packet* find_missing(
+    struct rtp_receiver *receiver,
+    uint16_t sequence_number
+) {
+    struct missing_packet *missing =
+        &receiver->missing[sequence_number & HISTORY_MASK];
+    if (!missing->pending || missing->sequence_number != sequence_number) {
+        return NULL;
+    }
+    return missing;
+}
+
+static void pass_on(struct rtp_receiver *receiver, struct history_packet *packet) {
+    if (!packet->media) return;
+
+    struct rtp_packet *parsed = rtp_packet_parse(packet->data, packet->len);
+    if (!parsed) return;
+
+    receiver->callback(parsed, packet->arrival_time, receiver->callback_data);
+    rtp_packet_free(parsed);
+}
+
+/**
+ * Passes on everything before sequence_number, counting what is missing as
+ * lost.
+ */
+static void give_up_until(
+    struct rtp_receiver *receiver,
+    uint16_t sequence_number
+) {
+    while (sequence_diff(sequence_number, receiver->next_sequence_number) > 0) {
+        struct history_packet *packet =
+            find_packet(receiver, receiver->next_sequence_number);
+        if (packet) {
+            pass_on(receiver, packet);
+        } else {
+            struct missing_packet *missing =
+                find_missing(receiver, receiver->next_sequence_number);
+            if (missing) {
+                missing->pending = false;
+            }
+            receiver->stats.lost++;
+        }
+        receiver->next_sequence_number++;
+    }
+}
+
+/**
+ * Smooths the round trip time like TCP does (RFC 6298).
+ */
+static void update_rtt(struct rtp_receiver *receiver, uint64_t sample) {
+    uint64_t rtt = receiver->stats.rtt_ns;
+    receiver->stats.rtt_ns = rtt - rtt / 8 + sample / 8;
+}
+
+/**
+ * Adds a packet of the media stream to the history.
+ *
+ * @param data The packet, or NULL for a FEC packet that only takes up the
+ * sequence number.
+ * @param retransmission Whether the packet was asked for with a NACK.
+ * @return false if the packet is a duplicate or too late.
+ */
+static bool add_packet(
+    struct rtp_receiver *receiver,
+    uint16_t sequence_number,
+    const uint8_t *data,
+    size_t len,
+    bool retransmission,
+    uint64_t time
+) {
+    if (receiver->started && sequence_diff(
+        sequence_number,
+        receiver->next_sequence_number
+    ) < -HISTORY_SIZE) {
+        // Too far behind to be late, the sender must have started over
+        forget_stream(receiver);
+    }
+
+    if (!receiver->started) {
+        receiver->started = true;
+        receiver->next_sequence_number = sequence_number;
+        receiver->highest_sequence_number = sequence_number;
+    }
+
+    int16_t diff = sequence_diff(sequence_number, receiver->next_sequence_number);
+    if (diff < 0) return false;
+
+    if (diff >= HISTORY_SIZE) {
+        // Make room, the packets that are held back are outdated anyway
+        give_up_until(receiver, sequence_number - HISTORY_SIZE + 1);
+    }
+
+    if (find_packet(receiver, sequence_number)) return false;
+
+    struct history_packet *packet =
+        &receiver->history[sequence_number & HISTORY_MASK];
+    if (packet->capacity < len) {
+        packet->data = brealloc(packet->data, len);
+        packet->capacity = len;
+    }
+    if (len > 0) {
+        memcpy(packet->data, data, len);
+    }
+    packet->len = len;
+    packet->media = data != NULL;
+    packet->sequence_number = sequence_number;
+    packet->arrival_time = time;
+    packet->used = true;
+
+    struct missing_packet *missing = find_missing(receiver, sequence_number);
+    if (missing) {
+        missing->pending = false;
+
+        // Only a packet that was asked for once tells which NACK it answers
+        if (retransmission && missing->nack_count == 1) {
+            update_rtt(receiver, time - missing->nack_time);
+        }
+    }
+
+    if (sequence_diff(sequence_number, receiver->highest_sequence_number) > 0) {
+        // Everything in between is missing, for now
+        uint16_t first = receiver->highest_sequence_number + 1;
+        if (sequence_diff(receiver->next_sequence_number, first) > 0) {
+            first = receiver->next_sequence_number;
+        }
+
+        for (uint16_t i = first; i != sequence_number; i++) {
+            missing = &receiver->missing[i & HISTORY_MASK];
+            missing->pending = true;
+            missing->sequence_number = i;
+            missing->nack_count = 0;
+        }
+
+        receiver->highest_sequence_number = sequence_number;
+    }
+
+    return true;
+}
+
+static struct fec_packet* new_fec_packet(struct rtp_receiver *receiver) {
+    struct fec_packet *fec = NULL;
+    for (size_t i = 0; i < MAX_FEC_PACKETS; i++) {
+        if (!receiver->fec_packets[i].used) {
+            fec = &receiver->fec_packets[i];
+            break;
+        }
+    }
+
+    if (!fec) {
+        // Replace the oldest one
+        fec = &receiver->fec_packets[receiver->next_fec_packet];
+        receiver->next_fec_packet =
+            (receiver->next_fec_packet + 1) % MAX_FEC_PACKETS;
+    }
+
+    fec->used = true;
+    fec->mask[0] = fec->mask[1] = 0;
+    return fec;
+}
+
+static void set_fec_payload(
+    struct fec_packet *fec,
+    const uint8_t *payload,
+    size_t len
+) {
+    if (fec->capacity < len) {
+        fec->payload = brealloc(fec->payload, len);
+        fec->capacity = len;
+    }
+    memcpy(fec->payload, payload, len);
+    fec->payload_len = len;
+}
+
+/**
+ * Stores a ULPFEC packet (RFC 5109). Only level 0 protection is used by
+ * browsers.
+ */
+static void add_ulpfec_packet(
+    struct rtp_receiver *receiver,
+    uint32_t ssrc,
+    const uint8_t *data,
+    size_t len
+) {
+    if (len < ULPFEC_HEADER_SIZE) return;
+
+    // The E bit is reserved for extensions of the header
+    if (data[0] & 0x80) return;
+
+    // The L bit selects the 48 bit mask
+    size_t mask_size = (data[0] & 0x40) ? 6 : 2;
+    if (len < ULPFEC_HEADER_SIZE + mask_size) return;
+
+    size_t protection_len = get_16bit_number(&data[10]);
+    if (len - ULPFEC_HEADER_SIZE - mask_size < protection_len) return;
+
+    struct fec_packet *fec = new_fec_packet(receiver);
+    fec->protected_ssrc = ssrc;
+    fec->header_recovery[0] = data[0];
+    fec->header_recovery[1] = data[1];
+    fec->base_sequence_number = get_16bit_number(&data[2]);
+    fec->timestamp_recovery = get_32bit_number(&data[4]);
+    fec->length_recovery = get_16bit_number(&data[8]);
+
+    const uint8_t *mask = data + ULPFEC_HEADER_SIZE;
+    for (size_t i = 0; i < mask_size * 8; i++) {
+        if ((mask[i / 8] >> (7 - i % 8)) & 1) {
+            mask_set(fec->mask, i);
+        }
+    }
+
+    set_fec_payload(fec, mask + mask_size, protection_len);
+}
+
+/**
+ * Stores a FlexFEC packet (draft-ietf-payload-flexible-fec-scheme-03), the
+ * version that browsers implement. Only flexible masks over a single stream
+ * are supported, which is all that browsers send.
+ */
+static void add_flexfec_packet(
+    struct rtp_receiver *receiver,
+    const uint8_t *data,
+    size_t len
+) {
+    if (len < FLEXFEC_HEADER_SIZE) return;
+
+    // The R bit marks retransmissions and the F bit fixed masks
+    if (data[0] & 0xc0) return;
+
+    // The number of protected streams
+    if (data[8] != 1) return;
+
+    struct fec_packet fec = {0};
+    fec.header_recovery[0] = data[0];
+    fec.header_recovery[1] = data[1];
+    fec.length_recovery = get_16bit_number(&data[2]);
+    fec.timestamp_recovery = get_32bit_number(&data[4]);
+    fec.protected_ssrc = get_32bit_number(&data[12]);
+    fec.base_sequence_number = get_16bit_number(&data[16]);
+
+    // The mask comes in chunks of 15, 31 and 63 bits, each of which starts
+    // with a K bit that is set in the last chunk
+    static const size_t chunk_sizes[] = {2, 4, 8};
+    const uint8_t *mask = data + FLEXFEC_HEADER_SIZE;
+    size_t remaining = len - FLEXFEC_HEADER_SIZE;
+    size_t offset = 0;
+    size_t bit = 0;
+    bool last_chunk = false;
+
+    for (size_t chunk = 0; chunk < 3 && !last_chunk; chunk++) {
+        size_t size = chunk_sizes[chunk];
+        if (remaining - offset < size) return;
+
+        last_chunk = mask[offset] & 0x80;
+        for (size_t i = 1; i < size * 8; i++, bit++) {
+            if ((mask[offset + i / 8] >> (7 - i % 8)) & 1) {
+                mask_set(fec.mask, bit);
+            }
+        }
+        offset += size;
+    }
+
+    if (!last_chunk) return;
+
+    struct fec_packet *stored = new_fec_packet(receiver);
+    uint8_t *payload = stored->payload;
+    size_t capacity = stored->capacity;
+    *stored = fec;
+    stored->used = true;
+    stored->payload = payload;
+    stored->capacity = capacity;
+    set_fec_payload(stored, mask + offset, remaining - offset);
+}
+
+/**
+ * Rebuilds a missing packet from a FEC packet and the other packets it
+ * protects, which must all be in the history.
+ */
+static bool recover_packet(
+    struct rtp_receiver *receiver,
+    struct fec_packet *fec,
+    uint16_t sequence_number,
+    uint64_t time
+) {
+    uint8_t header[2] = {fec->header_recovery[0], fec->header_recovery[1]};
+    uint32_t timestamp = fec->timestamp_recovery;
+    uint16_t length = fec->length_recovery;
+
+    for (size_t i = 0; i < 128; i++) {
+        if (!mask_get(fec->mask, i)) continue;
+
+        uint16_t protected_sequence_number = fec->base_sequence_number + i;
+        if (protected_sequence_number == sequence_number) continue;
+
+        struct history_packet *packet =
+            find_packet(receiver, protected_sequence_number);
+        if (packet->len < RTP_HEADER_SIZE) return false;
+
+        header[0] ^= packet->data[0];
+        header[1] ^= packet->data[1];
+        timestamp ^= get_32bit_number(&packet->data[4]);
+        length ^= packet->len - RTP_HEADER_SIZE;
+    }
+
+    // Only a prefix of the packets may be protected
+    if (length > fec->payload_len) return false;
+
+    uint8_t *recovered = receiver->recovered;
+    memcpy(recovered + RTP_HEADER_SIZE, fec->payload, length);
+
+    for (size_t i = 0; i < 128; i++) {
+        if (!mask_get(fec->mask, i)) continue;
+
+        uint16_t protected_sequence_number = fec->base_sequence_number + i;
+        if (protected_sequence_number == sequence_number) continue;
+
+        struct history_packet *packet =
+            find_packet(receiver, protected_sequence_number);
+        size_t packet_len = packet->len - RTP_HEADER_SIZE;
+        if (packet_len > length) {
+            packet_len = length;
+        }
+
+        for (size_t j = 0; j < packet_len; j++) {
+            recovered[RTP_HEADER_SIZE + j] ^= packet->data[RTP_HEADER_SIZE + j];
+        }
+    }
+
+    // The version is not protected, and always 2
+    recovered[0] = 0x80 | (header[0] & 0x3f);
+    recovered[1] = header[1];
+    recovered[2] = sequence_number >> 8;
+    recovered[3] = sequence_number;
+    set_32bit_number(&recovered[4], timestamp);
+    set_32bit_number(&recovered[8], fec->protected_ssrc);
+
+    return add_packet(
+        receiver,
+        sequence_number,
+        recovered,
+        RTP_HEADER_SIZE + length,
+        false,
+        time
+    );
+}
+
+/**
+ * Uses the FEC packets that protect exactly one missing packet, until none
+ * are left. Every recovered packet can make another FEC packet usable.
+ */
+static void recover_packets(struct rtp_receiver *receiver, uint64_t time) {
+    bool recovered_any = true;
+
+    while (recovered_any) {
+        recovered_any = false;
+
+        for (size_t i = 0; i < MAX_FEC_PACKETS; i++) {
+            struct fec_packet *fec = &receiver->fec_packets[i];
+            if (!fec->used) continue;
+
+            if (!receiver->started || fec->protected_ssrc != receiver->ssrc) {
+                // It belongs to a stream we have not seen yet, or no more
+                if (receiver->started) fec->used = false;
+                continue;
+            }
+
+            size_t missing_count = 0;
+            uint16_t missing = 0;
+            for (size_t bit = 0; bit < 128; bit++) {
+                if (!mask_get(fec->mask, bit)) continue;
+
+                uint16_t sequence_number = fec->base_sequence_number + bit;
+                if (!find_packet(receiver, sequence_number)) {
+                    missing = sequence_number;
+                    missing_count++;
+                }
+            }
+
+            if (missing_count == 0) {
+                fec->used = false;
+            } else if (missing_count == 1) {
+                fec->used = false;
+
+                // Recovering a packet that was given up on is of no use
+                if (sequence_diff(missing, receiver->next_sequence_number) >= 0
+                    && recover_packet(receiver, fec, missing, time)) {
+                    receiver->stats.recovered++;
+                    recovered_any = true;
+                }
+            } else if (sequence_diff(
+                fec->base_sequence_number,
+                receiver->next_sequence_number
+            ) < -HISTORY_SIZE / 2) {
+                // The packets it protects have long been passed on
+                fec->used = false;
+            }
+        }
+    }
+}
+
+/**
+ * Passes on the packets that are in order, and skips gaps that have not
+ * been filled in time.
+ */
+static void release_packets(struct rtp_receiver *receiver, uint64_t time) {
+    if (!receiver->started) return;
+
+    while (true) {
+        struct history_packet *packet =
+            find_packet(receiver, receiver->next_sequence_number);
+        if (packet) {
+            pass_on(receiver, packet);
+            receiver->next_sequence_number++;
+            continue;
+        }
+
+        // Find the first packet that is held back by the gap
+        struct history_packet *held = NULL;
+        uint16_t sequence_number = receiver->next_sequence_number + 1;
+        while (sequence_diff(
+            receiver->highest_sequence_number,
+            sequence_number
+        ) >= 0) {
+            held = find_packet(receiver, sequence_number);
+            if (held) break;
+            sequence_number++;
+        }
+
+        if (!held || time - held->arrival_time < receiver->config.max_hold_ns) {
+            return;
+        }
+
+        give_up_until(receiver, sequence_number);
+    }
+}
+
+/**
+ * Takes the primary data out of a RED packet (RFC 2198). Browsers only send
+ * redundant data for audio, so the redundant blocks are skipped.
+ *
+ * @return The length of the unwrapped packet in receiver->unwrapped, or 0
+ * if the RED packet is malformed.
+ */
+static size_t unwrap_red_packet(
+    struct rtp_receiver *receiver,
+    const uint8_t *data,
+    const struct rtp_packet *packet
+) {
+    const uint8_t *block = packet->payload;
+    size_t remaining = packet->payload_size;
+    size_t redundant_len = 0;
+
+    // Every redundant block has a 4 byte header with the F bit set
+    while (remaining >= 4 && (block[0] & 0x80)) {
+        redundant_len += ((block[2] & 0x03) << 8) | block[3];
+        block += 4;
+        remaining -= 4;
+    }
+
+    // The primary block has a 1 byte header
+    if (remaining < 1 || (block[0] & 0x80)) return 0;
+    uint8_t payload_type = block[0] & 0x7f;
+    block++;
+    remaining--;
+
+    if (redundant_len > remaining) return 0;
+    block += redundant_len;
+    remaining -= redundant_len;
+
+    size_t header_len = packet->payload - data;
+    uint8_t *unwrapped = receiver->unwrapped;
+    memcpy(unwrapped, data, header_len);
+    memcpy(unwrapped + header_len, block, remaining);
+
+    // The padding belonged to the RED packet
+    unwrapped[0] &= ~0x20;
+    unwrapped[1] = (unwrapped[1] & 0x80) | payload_type;
+
+    return header_len + remaining;
+}
+
+static bool is_payload_type(uint8_t payload_type, uint8_t negotiated) {
+    return negotiated != 0 && payload_type == negotiated;
+}
+
+/**
+ * Adds a packet of the media stream, which may be wrapped in RED and may be
+ * a ULPFEC packet.
+ */
+static void add_media_packet(
+    struct rtp_receiver *receiver,
+    uint8_t *data,
+    size_t len,
+    const struct rtp_packet *packet,
+    bool retransmission,
+    uint64_t time
+) {
+    const struct rtp_receiver_config *config = &receiver->config;
+
+    if (receiver->started && packet->ssrc != receiver->ssrc) {
+        forget_stream(receiver);
+    }
+    receiver->ssrc = packet->ssrc;
+
+    uint8_t *media = data;
+    size_t media_len = len;
+    uint8_t payload_type = packet->payload_type;
+
+    if (is_payload_type(payload_type, config->red_payload_type)) {
+        media = receiver->unwrapped;
+        media_len = unwrap_red_packet(receiver, data, packet);
+        payload_type = media[1] & 0x7f;
+    }
+
+    uint16_t sequence_number = packet->sequence_number;
+    bool added;
+    if (media_len == 0) {
+        // Keep the malformed packet from being counted as lost
+        added = add_packet(receiver, sequence_number, NULL, 0, false, time);
+    } else if (is_payload_type(payload_type, config->ulpfec_payload_type)) {
+        receiver->stats.fec_received++;
+        size_t header_len = packet->payload - data;
+        add_ulpfec_packet(
+            receiver,
+            packet->ssrc,
+            media + header_len,
+            media_len - header_len
+        );
+        added = add_packet(receiver, sequence_number, NULL, 0, false, time);
+    } else {
+        added = add_packet(
+            receiver,
+            sequence_number,
+            media,
+            media_len,
+            retransmission,
+            time
+        );
+
+        if (added && retransmission) {
+            receiver->stats.retransmitted++;
+        } else if (added) {
+            receiver->stats.received++;
+        }
+    }
+
+    if (!added) {
+        receiver->stats.discarded++;
+    }
+}
+
+/**
+ * @return The payload type of the media that an RTX payload type
+ * retransmits, or 0 if it is not one.
+ */
+static uint8_t rtx_associated_payload_type(
+    const struct rtp_receiver_config *config,
+    uint8_t payload_type
+) {
+    for (size_t i = 0; i < RTP_RECEIVER_MAX_RTX; i++) {
+        if (is_payload_type(payload_type, config->rtx[i].payload_type)) {
+            return config->rtx[i].associated_payload_type;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Adds a retransmission (RFC 4588). RTX has an SSRC and sequence numbers of
+ * its own, the original sequence number comes first in the payload.
+ */
+static void add_rtx_packet(
+    struct rtp_receiver *receiver,
+    const uint8_t *data,
+    const struct rtp_packet *packet,
+    uint8_t associated_payload_type,
+    uint64_t time
+) {
+    // Packets without an original sequence number are only padding, which
+    // the sender uses to probe the bandwidth
+    if (!receiver->started || packet->payload_size < 2) return;
+
+    size_t header_len = packet->payload - data;
+    size_t len = header_len + packet->payload_size - 2;
+    uint8_t *original = receiver->retransmitted;
+
+    memcpy(original, data, header_len);
+    memcpy(original + header_len, packet->payload + 2, packet->payload_size - 2);
+
+    // The padding belonged to the RTX packet
+    original[0] &= ~0x20;
+    original[1] = (original[1] & 0x80) | associated_payload_type;
+    original[2] = packet->payload[0];
+    original[3] = packet->payload[1];
+    set_32bit_number(&original[8], receiver->ssrc);
+
+    struct rtp_packet *parsed = rtp_packet_parse(original, len);
+    if (!parsed) return;
+
+    add_media_packet(receiver, original, len, parsed, true, time);
+    rtp_packet_free(parsed);
+}
+
+/**
+ * Picks the missing packets that are due to be asked for, either for the
+ * first time or again after a round trip without an answer.
+ *
+ * @return The number of sequence numbers written to nacks.
+ */
+static size_t collect_nacks(
+    struct rtp_receiver *receiver,
+    uint64_t time,
+    uint16_t nacks[HISTORY_SIZE]
+) {
+    if (!receiver->started || !receiver->nack_callback) return 0;
+
+    uint64_t interval = receiver->stats.rtt_ns;
+    if (interval < MIN_NACK_INTERVAL_NS) {
+        interval = MIN_NACK_INTERVAL_NS;
+    }
+
+    size_t count = 0;
+    for (uint16_t sequence_number = receiver->next_sequence_number;
+        sequence_diff(receiver->highest_sequence_number, sequence_number) > 0;
+        sequence_number++) {
+        struct missing_packet *missing = find_missing(receiver, sequence_number);
+        if (!missing || missing->nack_count >= MAX_NACKS) continue;
+        if (missing->nack_count > 0 && time - missing->nack_time < interval) {
+            continue;
+        }
+
+        missing->nack_count++;
+        missing->nack_time = time;
+        nacks[count++] = sequence_number;
+    }
+
+    receiver->stats.nacks_sent += count;
+    return count;
+}
+
+void rtp_receiver_push(
+    struct rtp_receiver *receiver,
+    uint8_t *data,
+    size_t len,
+    uint64_t time
+) {
+    if (len > MAX_PACKET_SIZE) return;
+
+    uint64_t trace = trace_begin();
+    struct rtp_packet *packet = rtp_packet_parse(data, len);
+    trace_end("parse", trace);
+    if (!packet) return;
+
+    pthread_mutex_lock(&receiver->mutex);
+
+    const struct rtp_receiver_config *config = &receiver->config;
+    uint8_t associated_payload_type =
+        rtx_associated_payload_type(config, packet->payload_type);
+
+    if (is_payload_type(packet->payload_type, config->flexfec_payload_type)) {
+        // FlexFEC has its own SSRC and sequence numbers
+        receiver->stats.fec_received++;
+        add_flexfec_packet(receiver, packet->payload, packet->payload_size);
+    } else if (associated_payload_type != 0) {
+        add_rtx_packet(receiver, data, packet, associated_payload_type, time);
+    } else {
+        add_media_packet(receiver, data, len, packet, false, time);
+    }
+
+    rtp_packet_free(packet);
+
+    recover_packets(receiver, time);
+    release_packets(receiver, time);
+
+    uint16_t nacks[HISTORY_SIZE];
+    size_t nack_count = collect_nacks(receiver, time, nacks);
+    uint32_t ssrc = receiver->ssrc;
+    rtp_receiver_nack_callback_t nack_callback = receiver->nack_callback;
+    void *nack_callback_data = receiver->nack_callback_data;
+
+    pthread_mutex_unlock(&receiver->mutex);
+
+    // Outside of the lock, since it sends through the peer connection
+    if (nack_count > 0) {
+        nack_callback(ssrc, nacks, nack_count, nack_callback_data);
+    }
+}
+
+void rtp_receiver_reset(struct rtp_receiver *receiver) {
+    pthread_mutex_lock(&receiver->mutex);
+    forget_stream(receiver);
+    pthread_mutex_unlock(&receiver->mutex);
+}
+
+void rtp_receiver_reset_stats(struct rtp_receiver *receiver) {
+    pthread_mutex_lock(&receiver->mutex);
+    memset(&receiver->stats, 0, sizeof(receiver->stats));
+    receiver->stats.rtt_ns = INITIAL_RTT_NS;
+    pthread_mutex_unlock(&receiver->mutex);
+}
+
+void rtp_receiver_get_stats(
+    struct rtp_receiver *receiver,
+    struct rtp_receiver_stats *stats
+) {
+    pthread_mutex_lock(&receiver->mutex);
+    *stats = receiver->stats;
+    pthread_mutex_unlock(&receiver->mutex);
+}
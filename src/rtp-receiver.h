@@ -0,0 +1,161 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rtp-parser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The receive path between the RTP parser and the depacketizer. It unwraps
+ * RED (RFC 2198) and RTX (RFC 4588), repairs lost packets with ULPFEC
+ * (RFC 5109) or FlexFEC (draft-ietf-payload-flexible-fec-scheme-03), asks
+ * for the others with NACKs (RFC 4585), and puts the media packets back in
+ * sequence order.
+ *
+ * Packets are passed on as soon as they are in order. Only the packets after
+ * a gap are held back, until the gap has been repaired or max_hold_ns has
+ * passed, after which the missing packets are counted as lost.
+ *
+ * There is no timer: NACKs are repeated, and gaps given up on, when the next
+ * packet arrives.
+ */
+
+// Long enough for a few rounds of NACKs on a local network
+#define RTP_RECEIVER_DEFAULT_HOLD_NS 100000000ULL
+
+struct rtp_receiver;
+
+// How many media payload types can have retransmissions
+#define RTP_RECEIVER_MAX_RTX 4
+
+struct rtp_receiver_config {
+    // The negotiated payload types, 0 for those that are not used
+    uint8_t red_payload_type;
+    uint8_t ulpfec_payload_type;
+    uint8_t flexfec_payload_type;
+
+    // The RTX payload types, each with the payload type of the media that it
+    // retransmits
+    struct {
+        uint8_t payload_type;
+        uint8_t associated_payload_type;
+    } rtx[RTP_RECEIVER_MAX_RTX];
+
+    // How long packets are held back behind a gap
+    uint64_t max_hold_ns;
+};
+
+/**
+ * Called with every media packet, in sequence order.
+ *
+ * @param packet The packet, which is only valid during the call.
+ * @param arrival_time When the packet arrived, or was recovered.
+ */
+typedef void (*rtp_receiver_callback_t)(
+    struct rtp_packet *packet,
+    uint64_t arrival_time,
+    void *data
+);
+
+/**
+ * Called with the sequence numbers of lost packets that should be
+ * retransmitted, in order. Called from within rtp_receiver_push.
+ */
+typedef void (*rtp_receiver_nack_callback_t)(
+    uint32_t ssrc,
+    const uint16_t *sequence_numbers,
+    size_t count,
+    void *data
+);
+
+struct rtp_receiver_stats {
+    // Media packets that arrived
+    uint64_t received;
+    // Media packets that arrived again after a NACK
+    uint64_t retransmitted;
+    // FEC packets that arrived
+    uint64_t fec_received;
+    // Media packets that were recovered with FEC
+    uint64_t recovered;
+    // Packets that were neither received nor recovered in time
+    uint64_t lost;
+    // Packets that arrived twice, or after they were given up on
+    uint64_t discarded;
+    // Sequence numbers that were asked for, counting every repetition
+    uint64_t nacks_sent;
+    // The round trip time, measured from NACKs to their retransmissions
+    uint64_t rtt_ns;
+};
+
+struct rtp_receiver* rtp_receiver_create(
+    const struct rtp_receiver_config *config,
+    rtp_receiver_callback_t callback,
+    void *callback_data
+);
+
+void rtp_receiver_destroy(struct rtp_receiver **receiver);
+
+/**
+ * Enables NACKs. Without a callback, lost packets are only waited for.
+ */
+void rtp_receiver_set_nack_callback(
+    struct rtp_receiver *receiver,
+    rtp_receiver_nack_callback_t callback,
+    void *data
+);
+
+/**
+ * Processes a packet as it was received. The callback is called from within
+ * for every packet that is now in order.
+ */
+void rtp_receiver_push(
+    struct rtp_receiver *receiver,
+    uint8_t *data,
+    size_t len,
+    uint64_t time
+);
+
+/**
+ * Forgets the stream, without counting what is missing as lost, e.g. after
+ * packets were dropped on purpose. The counters are kept.
+ */
+void rtp_receiver_reset(struct rtp_receiver *receiver);
+
+/**
+ * Resets the counters and the round trip time, e.g. for a new client.
+ */
+void rtp_receiver_reset_stats(struct rtp_receiver *receiver);
+
+/**
+ * Can be called from any thread.
+ */
+void rtp_receiver_get_stats(
+    struct rtp_receiver *receiver,
+    struct rtp_receiver_stats *stats
+);
+
+#ifdef __cplusplus
+}
+#endif
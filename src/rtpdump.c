@@ -0,0 +1,175 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#include "rtpdump.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <obs.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+#include "plugin-support.h"
+
+#define RTPDUMP_MAGIC "#!rtpplay1.0 "
+
+// The file header after the first line: start time, source address and port
+#define RTPDUMP_HEADER_SIZE 16
+
+// Every packet is preceded by its total length, the length of the RTP packet
+// (0 for RTCP) and its time offset
+#define RTPDUMP_PACKET_HEADER_SIZE 8
+
+struct rtpdump_writer {
+    pthread_mutex_t mutex;
+    FILE *file;
+    uint64_t start_time;
+};
+
+struct rtpdump_reader {
+    FILE *file;
+};
+
+static inline void put_16bit_number(uint8_t *data, uint16_t value) {
+    data[0] = value >> 8;
+    data[1] = value;
+}
+
+static inline void put_32bit_number(uint8_t *data, uint32_t value) {
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+
+static inline uint16_t get_16bit_number(const uint8_t *data) {
+    return (data[0] << 8) | data[1];
+}
+
+static inline uint32_t get_32bit_number(const uint8_t *data) {
+    return ((uint32_t) data[0] << 24) | (data[1] << 16) | (data[2] << 8)
+        | data[3];
+}
+
+struct rtpdump_writer* rtpdump_writer_open(const char *path) {
+    FILE *file = os_fopen(path, "wb");
+    if (!file) {
+        obs_log(LOG_ERROR, "Could not create RTP capture %s", path);
+        return NULL;
+    }
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    uint8_t header[RTPDUMP_HEADER_SIZE] = {0};
+    put_32bit_number(header, now.tv_sec);
+    put_32bit_number(header + 4, now.tv_usec);
+
+    fprintf(file, RTPDUMP_MAGIC "0.0.0.0/0\n");
+    fwrite(header, 1, sizeof(header), file);
+
+    struct rtpdump_writer *writer = bzalloc(sizeof(struct rtpdump_writer));
+    pthread_mutex_init(&writer->mutex, NULL);
+    writer->file = file;
+    writer->start_time = os_gettime_ns();
+
+    obs_log(LOG_INFO, "Capturing RTP to %s", path);
+    return writer;
+}
+
+void rtpdump_writer_close(struct rtpdump_writer **writer) {
+    if (!*writer) return;
+
+    fclose((*writer)->file);
+    pthread_mutex_destroy(&(*writer)->mutex);
+    bfree(*writer);
+    *writer = NULL;
+}
+
+void rtpdump_writer_write(
+    struct rtpdump_writer *writer,
+    const uint8_t *data,
+    size_t len,
+    bool rtcp
+) {
+    if (len > RTPDUMP_MAX_PACKET_SIZE - RTPDUMP_PACKET_HEADER_SIZE) return;
+
+    uint8_t header[RTPDUMP_PACKET_HEADER_SIZE];
+    put_16bit_number(header, len + RTPDUMP_PACKET_HEADER_SIZE);
+    put_16bit_number(header + 2, rtcp ? 0 : len);
+
+    // The stream is buffered, so this rarely reaches the disk
+    pthread_mutex_lock(&writer->mutex);
+    uint64_t elapsed = os_gettime_ns() - writer->start_time;
+    put_32bit_number(header + 4, elapsed / 1000000);
+    fwrite(header, 1, sizeof(header), writer->file);
+    fwrite(data, 1, len, writer->file);
+    pthread_mutex_unlock(&writer->mutex);
+}
+
+struct rtpdump_reader* rtpdump_reader_open(const char *path) {
+    FILE *file = os_fopen(path, "rb");
+    if (!file) {
+        obs_log(LOG_ERROR, "Could not open RTP capture %s", path);
+        return NULL;
+    }
+
+    // The first line has the address the capture was made on
+    char line[256];
+    uint8_t header[RTPDUMP_HEADER_SIZE];
+    if (!fgets(line, sizeof(line), file)
+        || strncmp(line, RTPDUMP_MAGIC, strlen(RTPDUMP_MAGIC)) != 0
+        || fread(header, 1, sizeof(header), file) != sizeof(header)) {
+        obs_log(LOG_ERROR, "%s is not an rtpdump file", path);
+        fclose(file);
+        return NULL;
+    }
+
+    struct rtpdump_reader *reader = bzalloc(sizeof(struct rtpdump_reader));
+    reader->file = file;
+    return reader;
+}
+
+void rtpdump_reader_close(struct rtpdump_reader **reader) {
+    if (!*reader) return;
+
+    fclose((*reader)->file);
+    bfree(*reader);
+    *reader = NULL;
+}
+
+bool rtpdump_reader_next(
+    struct rtpdump_reader *reader,
+    struct rtpdump_packet *packet
+) {
+    uint8_t header[RTPDUMP_PACKET_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), reader->file) != sizeof(header)) {
+        return false;
+    }
+
+    uint16_t length = get_16bit_number(header);
+    uint16_t rtp_length = get_16bit_number(header + 2);
+    if (length < RTPDUMP_PACKET_HEADER_SIZE) return false;
+
+    packet->len = length - RTPDUMP_PACKET_HEADER_SIZE;
+    packet->rtcp = rtp_length == 0;
+    packet->time = get_32bit_number(header + 4);
+
+    return fread(packet->data, 1, packet->len, reader->file) == packet->len;
+}
@@ -0,0 +1,89 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Reading and writing of RTP captures in the rtpdump format of rtptools,
+ * which Wireshark can open as well. Every RTP and RTCP packet is stored with
+ * its arrival time, in milliseconds since the start of the capture.
+ */
+
+#define RTPDUMP_MAX_PACKET_SIZE 65535
+
+struct rtpdump_writer;
+struct rtpdump_reader;
+
+struct rtpdump_packet {
+    uint8_t data[RTPDUMP_MAX_PACKET_SIZE];
+    size_t len;
+    bool rtcp;
+    // Milliseconds since the start of the capture
+    uint32_t time;
+};
+
+/**
+ * Creates a capture file.
+ *
+ * @return The writer, or NULL if the file could not be created.
+ */
+struct rtpdump_writer* rtpdump_writer_open(const char *path);
+
+void rtpdump_writer_close(struct rtpdump_writer **writer);
+
+/**
+ * Appends a packet, with the current time as its arrival time. Can be called
+ * from any thread.
+ */
+void rtpdump_writer_write(
+    struct rtpdump_writer *writer,
+    const uint8_t *data,
+    size_t len,
+    bool rtcp
+);
+
+/**
+ * Opens a capture file.
+ *
+ * @return The reader, or NULL if the file could not be opened or is not an
+ * rtpdump file.
+ */
+struct rtpdump_reader* rtpdump_reader_open(const char *path);
+
+void rtpdump_reader_close(struct rtpdump_reader **reader);
+
+/**
+ * Reads the next packet.
+ *
+ * @return false at the end of the file, or if it is truncated.
+ */
+bool rtpdump_reader_next(
+    struct rtpdump_reader *reader,
+    struct rtpdump_packet *packet
+);
+
+#ifdef __cplusplus
+}
+#endif
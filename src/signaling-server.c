@@ -0,0 +1,283 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#include "signaling-server.h"
+
+#include <ctype.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <obs-module.h>
+#include "plugin-support.h"
+
+#include "http-server.h"
+
+struct signaling_room {
+    char id[SIGNALING_MAX_ROOM_ID + 1];
+    struct signaling_room_callbacks callbacks;
+    void *data;
+
+    // The WebSocket connection of the guest, 0 if there is none
+    uint64_t client_id;
+
+    // Held while a callback of the room runs, so that unregistering can wait
+    // for it
+    pthread_mutex_t callback_mutex;
+
+    struct signaling_room *next;
+};
+
+static struct {
+    struct http_server *http_server;
+    int port;
+
+    // Guards the room list and the rooms' client IDs
+    pthread_mutex_t mutex;
+    struct signaling_room *rooms;
+} server = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static bool room_id_valid(const char *room_id) {
+    size_t len = strlen(room_id);
+    if (len == 0 || len > SIGNALING_MAX_ROOM_ID) return false;
+
+    for (size_t i = 0; i < len; i++) {
+        char c = room_id[i];
+        if (!isalnum((unsigned char) c) && c != '-' && c != '_') return false;
+    }
+
+    return true;
+}
+
+/**
+ * Extracts the room ID from a request path like /guest/3 or /guest/3/.
+ */
+static bool room_id_from_path(const char *path, char *room_id) {
+    size_t prefix_len = strlen(SIGNALING_ROOM_PREFIX);
+    if (strncmp(path, SIGNALING_ROOM_PREFIX, prefix_len) != 0) return false;
+
+    const char *start = path + prefix_len;
+    size_t len = strcspn(start, "/?#");
+    if (len == 0 || len > SIGNALING_MAX_ROOM_ID) return false;
+
+    memcpy(room_id, start, len);
+    room_id[len] = '\0';
+    return true;
+}
+
+// Must be called with the mutex held
+static struct signaling_room* find_room_by_id(const char *room_id) {
+    for (struct signaling_room *room = server.rooms; room; room = room->next) {
+        if (strcmp(room->id, room_id) == 0) return room;
+    }
+    return NULL;
+}
+
+// Must be called with the mutex held
+static struct signaling_room* find_room_by_client(uint64_t client_id) {
+    for (struct signaling_room *room = server.rooms; room; room = room->next) {
+        if (room->client_id == client_id) return room;
+    }
+    return NULL;
+}
+
+static bool signaling_ws_open(
+    void *data,
+    uint64_t connection_id,
+    const char *path
+) {
+    UNUSED_PARAMETER(data);
+
+    char room_id[SIGNALING_MAX_ROOM_ID + 1];
+    if (!room_id_from_path(path, room_id)) return false;
+
+    pthread_mutex_lock(&server.mutex);
+    struct signaling_room *room = find_room_by_id(room_id);
+    if (!room || room->client_id != 0) {
+        pthread_mutex_unlock(&server.mutex);
+        return false;
+    }
+    room->client_id = connection_id;
+    pthread_mutex_lock(&room->callback_mutex);
+    pthread_mutex_unlock(&server.mutex);
+
+    obs_log(LOG_INFO, "Guest connected to room %s", room->id);
+    if (room->callbacks.connected) {
+        room->callbacks.connected(room->data);
+    }
+    pthread_mutex_unlock(&room->callback_mutex);
+
+    return true;
+}
+
+static void signaling_ws_message(
+    void *data,
+    uint64_t connection_id,
+    const char *message,
+    size_t len
+) {
+    UNUSED_PARAMETER(data);
+    UNUSED_PARAMETER(len);
+
+    pthread_mutex_lock(&server.mutex);
+    struct signaling_room *room = find_room_by_client(connection_id);
+    if (!room) {
+        pthread_mutex_unlock(&server.mutex);
+        return;
+    }
+    pthread_mutex_lock(&room->callback_mutex);
+    pthread_mutex_unlock(&server.mutex);
+
+    if (room->callbacks.message) {
+        room->callbacks.message(room->data, message);
+    }
+    pthread_mutex_unlock(&room->callback_mutex);
+}
+
+static void signaling_ws_close(void *data, uint64_t connection_id) {
+    UNUSED_PARAMETER(data);
+
+    pthread_mutex_lock(&server.mutex);
+    struct signaling_room *room = find_room_by_client(connection_id);
+    if (!room) {
+        pthread_mutex_unlock(&server.mutex);
+        return;
+    }
+    room->client_id = 0;
+    pthread_mutex_lock(&room->callback_mutex);
+    pthread_mutex_unlock(&server.mutex);
+
+    obs_log(LOG_INFO, "Guest disconnected from room %s", room->id);
+    if (room->callbacks.disconnected) {
+        room->callbacks.disconnected(room->data);
+    }
+    pthread_mutex_unlock(&room->callback_mutex);
+}
+
+static const struct http_server_ws_callbacks signaling_ws_callbacks = {
+    .open = signaling_ws_open,
+    .message = signaling_ws_message,
+    .close = signaling_ws_close,
+};
+
+bool signaling_server_start(int port) {
+    obs_log(LOG_INFO, "Starting HTTP server on port %d", port);
+
+    server.http_server = http_server_create(port, &signaling_ws_callbacks, NULL);
+    if (!server.http_server) {
+        obs_log(LOG_ERROR, "HTTP server could not be created");
+        return false;
+    }
+
+    server.port = port;
+    return true;
+}
+
+void signaling_server_stop(void) {
+    if (server.http_server) {
+        obs_log(LOG_INFO, "Stopping HTTP server");
+        http_server_destroy(&server.http_server);
+        server.port = 0;
+    }
+}
+
+int signaling_server_get_port(void) {
+    return server.port;
+}
+
+bool signaling_server_room_available(const char *room_id) {
+    if (!room_id_valid(room_id)) return false;
+
+    pthread_mutex_lock(&server.mutex);
+    bool available = find_room_by_id(room_id) == NULL;
+    pthread_mutex_unlock(&server.mutex);
+
+    return available;
+}
+
+struct signaling_room* signaling_server_register(
+    const char *room_id,
+    const struct signaling_room_callbacks *callbacks,
+    void *data
+) {
+    if (!room_id_valid(room_id)) return NULL;
+
+    pthread_mutex_lock(&server.mutex);
+    if (find_room_by_id(room_id)) {
+        pthread_mutex_unlock(&server.mutex);
+        return NULL;
+    }
+
+    struct signaling_room *room = bzalloc(sizeof(struct signaling_room));
+    strcpy(room->id, room_id);
+    room->callbacks = *callbacks;
+    room->data = data;
+    pthread_mutex_init(&room->callback_mutex, NULL);
+
+    room->next = server.rooms;
+    server.rooms = room;
+    pthread_mutex_unlock(&server.mutex);
+
+    obs_log(LOG_INFO, "Registered room %s", room_id);
+    return room;
+}
+
+void signaling_server_unregister(struct signaling_room **room_ptr) {
+    struct signaling_room *room = *room_ptr;
+    if (!room) return;
+
+    pthread_mutex_lock(&server.mutex);
+    struct signaling_room **link = &server.rooms;
+    while (*link && *link != room) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = room->next;
+    }
+    uint64_t client_id = room->client_id;
+    pthread_mutex_unlock(&server.mutex);
+
+    if (client_id != 0 && server.http_server) {
+        http_server_ws_close(server.http_server, client_id);
+    }
+
+    // Wait for a callback that may be running
+    pthread_mutex_lock(&room->callback_mutex);
+    pthread_mutex_unlock(&room->callback_mutex);
+
+    obs_log(LOG_INFO, "Unregistered room %s", room->id);
+
+    pthread_mutex_destroy(&room->callback_mutex);
+    bfree(room);
+    *room_ptr = NULL;
+}
+
+void signaling_room_send(struct signaling_room *room, const char *message) {
+    pthread_mutex_lock(&server.mutex);
+    uint64_t client_id = room->client_id;
+    pthread_mutex_unlock(&server.mutex);
+
+    if (client_id != 0 && server.http_server) {
+        http_server_ws_send(
+            server.http_server,
+            client_id,
+            message,
+            strlen(message)
+        );
+    }
+}
@@ -0,0 +1,99 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * The plugin-wide server. It serves the client page and the signaling
+ * WebSockets of all the sources on a single port. Every source registers a
+ * room, which guests join at /guest/<room>.
+ */
+
+#define SIGNALING_ROOM_PREFIX "/guest/"
+#define SIGNALING_MAX_ROOM_ID 64
+
+/**
+ * Callbacks of a room. They are called from the server's thread, never after
+ * the room has been unregistered.
+ */
+struct signaling_room_callbacks {
+    /**
+     * Called when a guest connects to the room. Only one guest can be
+     * connected at a time, others are refused.
+     */
+    void (*connected)(void *data);
+
+    /**
+     * Called for every signaling message from the guest.
+     */
+    void (*message)(void *data, const char *message);
+
+    /**
+     * Called when the guest disconnects.
+     */
+    void (*disconnected)(void *data);
+};
+
+struct signaling_room;
+
+/**
+ * Starts the server. Called once when the module is loaded.
+ */
+bool signaling_server_start(int port);
+
+/**
+ * Stops the server. All rooms must have been unregistered.
+ */
+void signaling_server_stop(void);
+
+/**
+ * @return The port the server listens on, or 0 if it is not running.
+ */
+int signaling_server_get_port(void);
+
+/**
+ * Registers a room.
+ *
+ * @param room_id The ID that appears in the URL. Only letters, digits, '-'
+ * and '_' are allowed.
+ * @return The room, or NULL if the ID is invalid or already taken.
+ */
+struct signaling_room* signaling_server_register(
+    const char *room_id,
+    const struct signaling_room_callbacks *callbacks,
+    void *data
+);
+
+/**
+ * Unregisters a room, disconnecting its guest. Waits for any callback of the
+ * room that is running to return.
+ */
+void signaling_server_unregister(struct signaling_room **room);
+
+/**
+ * Checks whether a room ID is free to be registered.
+ */
+bool signaling_server_room_available(const char *room_id);
+
+/**
+ * Sends a signaling message to the guest of a room, if there is one. Can be
+ * called from any thread.
+ */
+void signaling_room_send(struct signaling_room *room, const char *message);
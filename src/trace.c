@@ -0,0 +1,196 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#include "trace.h"
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include <obs-module.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include "plugin-support.h"
+
+#ifdef _MSC_VER
+#define TRACE_THREAD_LOCAL __declspec(thread)
+#else
+#define TRACE_THREAD_LOCAL _Thread_local
+#endif
+
+struct trace_event {
+    const char *name;
+    uint64_t begin;
+    uint64_t end;
+};
+
+struct trace_ring {
+    struct trace_ring *next;
+    int thread_id;
+
+    // The trace that the events belong to. Only touched by the thread.
+    long generation;
+    // The number of events of the trace, of which the last TRACE_RING_SIZE
+    // are kept. Only written by the thread.
+    volatile long count;
+    struct trace_event events[TRACE_RING_SIZE];
+};
+
+static struct {
+    // Guards the list of rings and the start time
+    pthread_mutex_t mutex;
+    struct trace_ring *rings;
+    int ring_count;
+    uint64_t start_time;
+
+    volatile bool enabled;
+    volatile long generation;
+} trace = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static TRACE_THREAD_LOCAL struct trace_ring *thread_ring = NULL;
+
+static struct trace_ring* trace_ring_create(void) {
+    struct trace_ring *ring = bmalloc(sizeof(struct trace_ring));
+    ring->generation = 0;
+    ring->count = 0;
+
+    pthread_mutex_lock(&trace.mutex);
+    ring->thread_id = ++trace.ring_count;
+    ring->next = trace.rings;
+    trace.rings = ring;
+    pthread_mutex_unlock(&trace.mutex);
+
+    return ring;
+}
+
+void trace_start(void) {
+    pthread_mutex_lock(&trace.mutex);
+    trace.start_time = os_gettime_ns();
+    // The threads drop their old events when they see the new generation
+    os_atomic_inc_long(&trace.generation);
+    pthread_mutex_unlock(&trace.mutex);
+
+    os_atomic_set_bool(&trace.enabled, true);
+    obs_log(LOG_INFO, "Tracing started");
+}
+
+void trace_stop(void) {
+    os_atomic_set_bool(&trace.enabled, false);
+    obs_log(LOG_INFO, "Tracing stopped");
+}
+
+bool trace_is_enabled(void) {
+    return os_atomic_load_bool(&trace.enabled);
+}
+
+uint64_t trace_begin(void) {
+    if (!os_atomic_load_bool(&trace.enabled)) return 0;
+    return os_gettime_ns();
+}
+
+void trace_end(const char *name, uint64_t begin) {
+    if (begin == 0 || !os_atomic_load_bool(&trace.enabled)) return;
+
+    uint64_t end = os_gettime_ns();
+
+    struct trace_ring *ring = thread_ring;
+    if (!ring) {
+        ring = thread_ring = trace_ring_create();
+    }
+
+    long generation = os_atomic_load_long(&trace.generation);
+    if (ring->generation != generation) {
+        ring->generation = generation;
+        os_atomic_set_long(&ring->count, 0);
+    }
+
+    long count = ring->count;
+    struct trace_event *event = &ring->events[count % TRACE_RING_SIZE];
+    event->name = name;
+    event->begin = begin;
+    event->end = end;
+
+    // Published after the event, for trace_save
+    os_atomic_set_long(&ring->count, count + 1);
+}
+
+bool trace_save(const char *path) {
+    FILE *file = os_fopen(path, "wb");
+    if (!file) {
+        obs_log(LOG_WARNING, "Could not write the trace to %s", path);
+        return false;
+    }
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", file);
+    bool first = true;
+    size_t events = 0;
+
+    pthread_mutex_lock(&trace.mutex);
+    long generation = os_atomic_load_long(&trace.generation);
+    uint64_t start_time = trace.start_time;
+
+    for (struct trace_ring *ring = trace.rings; ring; ring = ring->next) {
+        long count = os_atomic_load_long(&ring->count);
+        if (ring->generation != generation || count == 0) continue;
+
+        long first_event = count > TRACE_RING_SIZE ? count - TRACE_RING_SIZE : 0;
+        for (long i = first_event; i < count; i++) {
+            const struct trace_event *event = &ring->events[i % TRACE_RING_SIZE];
+            if (event->begin < start_time) continue;
+
+            // Chrome expects microseconds
+            fprintf(file,
+                "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                "\"ts\":%.3f,\"dur\":%.3f}",
+                first ? "" : ",",
+                event->name,
+                ring->thread_id,
+                (event->begin - start_time) / 1000.0,
+                (event->end - event->begin) / 1000.0);
+            first = false;
+            events++;
+        }
+    }
+    pthread_mutex_unlock(&trace.mutex);
+
+    fputs("\n]}\n", file);
+    bool ok = ferror(file) == 0;
+    fclose(file);
+
+    if (ok) {
+        obs_log(LOG_INFO, "Saved %zu trace events to %s", events, path);
+    } else {
+        obs_log(LOG_WARNING, "Could not write the trace to %s", path);
+    }
+    return ok;
+}
+
+void trace_free(void) {
+    os_atomic_set_bool(&trace.enabled, false);
+
+    pthread_mutex_lock(&trace.mutex);
+    struct trace_ring *ring = trace.rings;
+    trace.rings = NULL;
+    pthread_mutex_unlock(&trace.mutex);
+
+    while (ring) {
+        struct trace_ring *next = ring->next;
+        bfree(ring);
+        ring = next;
+    }
+}
@@ -0,0 +1,81 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Timing of the stages of the receive path, for finding out where the time
+ * of a frame goes with many sources. Every thread records its events to a
+ * ring of its own, so recording takes no lock, and only the last
+ * TRACE_RING_SIZE events of every thread are kept. The events are saved in
+ * the Chrome trace format, which chrome://tracing and Perfetto open.
+ *
+ * Tracing is off by default, in which case a stage costs a single atomic
+ * load.
+ *
+ *     uint64_t begin = trace_begin();
+ *     ...
+ *     trace_end("parse", begin);
+ */
+
+#define TRACE_RING_SIZE 65536
+
+/**
+ * Starts recording, dropping the events of any previous trace.
+ */
+void trace_start(void);
+
+void trace_stop(void);
+
+bool trace_is_enabled(void);
+
+/**
+ * @return The start time of a stage, or 0 if tracing is off.
+ */
+uint64_t trace_begin(void);
+
+/**
+ * Records a stage that started at begin.
+ *
+ * @param name The name of the stage, which must be a string literal, since
+ * only the pointer is kept.
+ */
+void trace_end(const char *name, uint64_t begin);
+
+/**
+ * Writes the events since trace_start to a Chrome trace file. Best called
+ * after trace_stop, since events that are recorded meanwhile may come out
+ * garbled.
+ */
+bool trace_save(const char *path);
+
+/**
+ * Frees the rings of all threads. Called once when the module is unloaded,
+ * after all the threads that recorded events have stopped.
+ */
+void trace_free(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -17,48 +17,272 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 */
 
 #include <obs-module.h>
+#include <time.h>
+
+#include <util/dstr.h>
 #include <util/platform.h>
+#include <util/threading.h>
 #include "plugin-support.h"
 
-#include "http-server.h"
+#include "plugin-config.h"
+#include "signaling-server.h"
 #include "webrtc.h"
 #include "rtp-parser.h"
+#include "rtp-receiver.h"
+#include "decode-scheduler.h"
 #include "h264-decoder.h"
+#include "frame-scaler.h"
+#include "frame-hash.h"
+#include "frame-ring.h"
+#include "gop-cache.h"
+#include "trace.h"
+#include "latency-stats.h"
+#include "h264-recorder.h"
+
+// How often the latency percentiles are written to the log
+#define STATS_LOG_INTERVAL_NS 10000000000ULL
+
+// How often a frame is output even if it did not change, in case OBS missed
+// the last one
+#define STATIC_FRAME_REFRESH_NS 1000000000ULL
 
 struct webrtc_source {
     obs_source_t *source;
     obs_data_t *settings;
-    struct http_server *http_server;
     struct webrtc_connection *webrtc_conn;
+    struct rtp_receiver *receiver;
+    // The ordered packets wait here for one of the decoding threads
+    struct decode_queue *decode_queue;
+
+    // Created on the decoding thread when the first packet arrives, so that
+    // sources that never get a guest do not hold a decoder
     struct h264_decoder *decoder;
+    bool decoder_failed;
+    // The parameter sets from the guest's SDP, until the decoding thread
+    // hands them to the decoder
+    pthread_mutex_t parameter_sets_mutex;
+    char *parameter_sets;
+
+    // Decoded frames are scaled down to fit within the output size, if it is
+    // set. Written from the OBS thread and read on the decoding thread.
+    struct frame_scaler *scaler;
+    volatile long output_width;
+    volatile long output_height;
+
+    // Frames that did not change are not output, since OBS would copy and
+    // upload them again. Only touched from the decoding thread, except for
+    // the counter.
+    bool have_output_frame;
+    uint64_t output_frame_hash;
+    uint64_t output_frame_time;
+    volatile long suppressed_frames;
+
+    // Whether the source is shown anywhere, or active in the program. Only
+    // touched from the OBS thread that calls the show/activate callbacks.
+    bool showing;
+    bool active;
+    // Whether the video currently goes through, any of the above or recording
+    // or sharing
+    bool video_active;
+    // Set when decoding resumes, since the decoder missed the packets that
+    // were dropped in the meantime
+    volatile bool decoder_stale;
+    // Set with decoder_stale, but cleared on the decoding thread, which is
+    // the only one that may touch the decoder
+    volatile bool flush_decoder;
+
+    // Whether only keyframes are decoded while the source is not in the
+    // program, e.g. in a multiview thumbnail, and how many seconds apart
+    // keyframes are asked for meanwhile, 0 for never. Only touched from the
+    // OBS threads, except for keyframes_only which the decoding thread
+    // applies to the decoder.
+    bool preview_keyframes_only;
+    long preview_keyframe_interval;
+    float keyframe_request_elapsed;
+    volatile bool keyframes_only;
+    // Only touched from the decoding thread
+    bool decoding_keyframes_only;
+    // Set on the decoding thread when a keyframe is needed, which the OBS
+    // thread asks for, since the connection may be gone by the time a
+    // packet is decoded
+    volatile bool keyframe_wanted;
+
+    // The access units since the last keyframe, so that full decoding can
+    // resume without waiting for a new one. NULL if it is disabled. Only
+    // touched from the decoding thread.
+    struct gop_cache *gop_cache;
+
+    struct latency_stats *stats;
+    // Only touched from the decoding thread
+    uint64_t last_stats_log;
+
+    // The recording settings that are in effect
+    bool recording;
+    char *record_path;
+    char *record_format;
+    // Guards recorder, which is written to from libdatachannel's threads
+    pthread_mutex_t recorder_mutex;
+    struct h264_recorder *recorder;
+
+    // The decoded frames are shared with other processes under share_name
+    // while sharing is on. Guards frame_ring, which is written to from the
+    // decoding thread.
+    bool sharing;
+    char *share_name;
+    pthread_mutex_t frame_ring_mutex;
+    struct frame_ring *frame_ring;
+
+    // The ID of the registered room, empty if there is none
+    char room_id[SIGNALING_MAX_ROOM_ID + 1];
+
+    // Guards room for the signaling callback, which is called from
+    // libdatachannel's threads
+    pthread_mutex_t signal_mutex;
+    struct signaling_room *room;
 };
 
-void webrtc_video_callback(uint8_t *buffer, size_t len, void *data) {
+static void log_percentiles(
+    const char *room_id,
+    const char *name,
+    const struct latency_percentiles *percentiles
+) {
+    if (percentiles->count == 0) return;
+
+    obs_log(LOG_INFO, "Room %s %s latency: p50 %.1f ms, p95 %.1f ms, "
+        "p99 %.1f ms (%zu frames)", room_id, name, percentiles->p50,
+        percentiles->p95, percentiles->p99, percentiles->count);
+}
+
+static void webrtc_source_log_stats(struct webrtc_source *src) {
+    struct latency_report report;
+    latency_stats_get_report(src->stats, &report);
+
+    log_percentiles(src->room_id, "network", &report.network);
+    log_percentiles(src->room_id, "jitter buffer", &report.jitter_buffer);
+    log_percentiles(src->room_id, "queue", &report.queue);
+    log_percentiles(src->room_id, "decode", &report.decode);
+    log_percentiles(src->room_id, "output", &report.output);
+    log_percentiles(src->room_id, "total", &report.total);
+
+    struct rtp_receiver_stats packets;
+    rtp_receiver_get_stats(src->receiver, &packets);
+
+    obs_log(LOG_INFO, "Room %s packets: %llu received, %llu FEC, "
+        "%llu recovered, %llu retransmitted, %llu lost, RTT %.1f ms",
+        src->room_id,
+        (unsigned long long) packets.received,
+        (unsigned long long) packets.fec_received,
+        (unsigned long long) packets.recovered,
+        (unsigned long long) packets.retransmitted,
+        (unsigned long long) packets.lost,
+        packets.rtt_ns / 1000000.0);
+
+    obs_log(LOG_INFO, "Room %s unchanged frames not output: %ld",
+        src->room_id, os_atomic_load_long(&src->suppressed_frames));
+
+    struct decode_queue_stats decode;
+    decode_queue_get_stats(src->decode_queue, &decode);
+
+    obs_log(LOG_INFO, "Room %s decoding: %.1f%% of a core, "
+        "%llu packets dropped", src->room_id, decode.cpu_share * 100.0,
+        (unsigned long long) decode.dropped);
+}
+
+/**
+ * Called by the receiver with the media packets, in order. They are decoded
+ * on the plugin's decoding threads.
+ */
+static void webrtc_source_receiver_packet(
+    struct rtp_packet *packet,
+    uint64_t arrival_time,
+    void *data
+) {
     struct webrtc_source *src = data;
 
-    struct rtp_packet *packet = rtp_packet_parse(buffer, len);
+    latency_stats_packet_received(
+        src->stats,
+        packet->timestamp,
+        arrival_time,
+        os_gettime_ns()
+    );
 
-    rtp_process_h264_packet(src->decoder, packet);
+    decode_queue_push(src->decode_queue, packet, arrival_time);
+}
 
-    AVFrame *f = h264_decoder_get_frame(src->decoder);
-    if (!f) return;
+/**
+ * Passes the received access units to the recorder, if there is one, and
+ * keeps them for resuming. They are handed to the decoder right after.
+ */
+static void webrtc_source_access_unit(
+    const struct h264_access_unit *access_unit,
+    void *data
+) {
+    struct webrtc_source *src = data;
+
+    latency_stats_frame_decoding(
+        src->stats,
+        access_unit->rtp_timestamp,
+        os_gettime_ns()
+    );
+
+    if (src->gop_cache && !gop_cache_add(src->gop_cache, access_unit)
+        && src->decoding_keyframes_only) {
+        // Start a group of pictures that fits, so that there is one to
+        // resume from
+        os_atomic_set_bool(&src->keyframe_wanted, true);
+    }
+
+    pthread_mutex_lock(&src->recorder_mutex);
+    if (src->recorder) {
+        h264_recorder_write(src->recorder, access_unit);
+    }
+    pthread_mutex_unlock(&src->recorder_mutex);
+}
+
+/**
+ * Hands a decoded frame to OBS, scaled down to the output size, unless it is
+ * the same as the last one.
+ *
+ * @return Whether the frame was output.
+ */
+static bool webrtc_source_output_frame(
+    struct webrtc_source *src,
+    const AVFrame *f
+) {
+    const AVFrame *scaled = frame_scaler_scale(
+        src->scaler,
+        f,
+        os_atomic_load_long(&src->output_width),
+        os_atomic_load_long(&src->output_height)
+    );
 
     struct obs_source_frame frame = {
         .data = {
-            [0] = f->data[0],
-            [1] = f->data[1],
-            [2] = f->data[2],
+            [0] = scaled->data[0],
+            [1] = scaled->data[1],
+            [2] = scaled->data[2],
         },
         .linesize = {
-            [0] = f->linesize[0],
-            [1] = f->linesize[1],
-            [2] = f->linesize[2],
+            [0] = scaled->linesize[0],
+            [1] = scaled->linesize[1],
+            [2] = scaled->linesize[2],
         },
-        .width = f->width,
-        .height = f->height,
+        .width = scaled->width,
+        .height = scaled->height,
         .format = VIDEO_FORMAT_I420,
     };
 
+    uint64_t hash = frame_hash(scaled);
+    uint64_t now = os_gettime_ns();
+    if (src->have_output_frame && hash == src->output_frame_hash
+        && now - src->output_frame_time < STATIC_FRAME_REFRESH_NS) {
+        os_atomic_inc_long(&src->suppressed_frames);
+        return false;
+    }
+    src->have_output_frame = true;
+    src->output_frame_hash = hash;
+    src->output_frame_time = now;
+
     video_format_get_parameters_for_format(
         VIDEO_CS_DEFAULT,
         VIDEO_RANGE_DEFAULT,
@@ -69,232 +293,1183 @@ void webrtc_video_callback(uint8_t *buffer, size_t len, void *data) {
     );
 
     obs_source_output_video(src->source, &frame);
+    return true;
+}
+
+/**
+ * Publishes a decoded frame to the other processes, at its full size, if
+ * sharing is on.
+ */
+static void webrtc_source_share_frame(
+    struct webrtc_source *src,
+    const AVFrame *f
+) {
+    pthread_mutex_lock(&src->frame_ring_mutex);
+    if (src->frame_ring) {
+        uint64_t trace = trace_begin();
+        frame_ring_write(src->frame_ring, f, (uint32_t) f->pts);
+        trace_end("share", trace);
+    }
+    pthread_mutex_unlock(&src->frame_ring_mutex);
+}
+
+struct fast_forward {
+    struct webrtc_source *src;
+    AVFrame *last_frame;
+};
+
+static void webrtc_source_fast_forward_access_unit(
+    const struct h264_access_unit *access_unit,
+    void *data
+) {
+    struct fast_forward *ff = data;
+    h264_decoder_decode_access_unit(ff->src->decoder, access_unit);
+
+    AVFrame *f;
+    while ((f = h264_decoder_get_frame(ff->src->decoder))) {
+        av_frame_free(&ff->last_frame);
+        ff->last_frame = f;
+    }
+}
+
+/**
+ * Decodes the cached access units from their keyframe, so that the decoder
+ * catches up with the stream without asking for a keyframe. Only the last
+ * frame is output.
+ *
+ * @return false if there was nothing to resume from.
+ */
+static bool webrtc_source_fast_forward(struct webrtc_source *src) {
+    if (!src->gop_cache) return false;
+
+    h264_decoder_reset(src->decoder);
+
+    struct fast_forward ff = {.src = src};
+    if (!gop_cache_replay(src->gop_cache, webrtc_source_fast_forward_access_unit, &ff)) {
+        return false;
+    }
+
+    if (ff.last_frame) {
+        webrtc_source_share_frame(src, ff.last_frame);
+        webrtc_source_output_frame(src, ff.last_frame);
+        av_frame_free(&ff.last_frame);
+    }
+    return true;
+}
+
+/**
+ * Creates the decoder if it does not exist yet, and applies what was asked
+ * of it from the other threads. Called on the decoding thread.
+ *
+ * @return false if there is no decoder.
+ */
+static bool webrtc_source_prepare_decoder(struct webrtc_source *src) {
+    if (!src->decoder && !src->decoder_failed) {
+        src->decoder = h264_decoder_create();
+        if (!src->decoder) {
+            obs_log(LOG_ERROR, "Room %s: The decoder could not be created",
+                src->room_id);
+            src->decoder_failed = true;
+            return false;
+        }
+
+        h264_decoder_set_access_unit_callback(
+            src->decoder,
+            webrtc_source_access_unit,
+            src
+        );
+    }
+    if (!src->decoder) return false;
+
+    if (os_atomic_exchange_bool(&src->flush_decoder, false)) {
+        h264_decoder_flush(src->decoder);
+        if (src->gop_cache) {
+            gop_cache_clear(src->gop_cache);
+        }
+    }
+
+    bool keyframes_only = os_atomic_load_bool(&src->keyframes_only);
+    if (keyframes_only != src->decoding_keyframes_only) {
+        h264_decoder_set_keyframes_only(src->decoder, keyframes_only);
+        src->decoding_keyframes_only = keyframes_only;
+
+        // The frames since the last keyframe were skipped
+        if (!keyframes_only && !webrtc_source_fast_forward(src)) {
+            os_atomic_set_bool(&src->keyframe_wanted, true);
+        }
+    }
+
+    pthread_mutex_lock(&src->parameter_sets_mutex);
+    char *parameter_sets = src->parameter_sets;
+    src->parameter_sets = NULL;
+    pthread_mutex_unlock(&src->parameter_sets_mutex);
+
+    if (parameter_sets) {
+        h264_decoder_set_parameter_sets(src->decoder, parameter_sets);
+        bfree(parameter_sets);
+    }
+
+    return true;
+}
+
+/**
+ * Called on one of the decoding threads with the media packets, in order.
+ */
+static void webrtc_source_rtp_packet(
+    struct rtp_packet *packet,
+    uint64_t arrival_time,
+    void *data
+) {
+    struct webrtc_source *src = data;
+
+    UNUSED_PARAMETER(arrival_time);
+
+    if (!webrtc_source_prepare_decoder(src)) return;
+
+    rtp_process_h264_packet(src->decoder, packet);
+
+    AVFrame *f = h264_decoder_get_frame(src->decoder);
+    if (!f) return;
+
+    uint32_t rtp_timestamp = (uint32_t) f->pts;
+    latency_stats_frame_decoded(src->stats, rtp_timestamp, os_gettime_ns());
+
+    webrtc_source_share_frame(src, f);
 
+    uint64_t trace = trace_begin();
+    webrtc_source_output_frame(src, f);
+    trace_end("output", trace);
     av_frame_free(&f);
-    rtp_packet_free(packet);
+
+    // Frames that did not change are done when they are suppressed. Leaving
+    // them out would keep them pending, and bias the report of a static
+    // screen toward the few frames that changed.
+    uint64_t now = os_gettime_ns();
+    latency_stats_frame_output(src->stats, rtp_timestamp, now);
+
+    if (now - src->last_stats_log >= STATS_LOG_INTERVAL_NS) {
+        src->last_stats_log = now;
+        webrtc_source_log_stats(src);
+    }
 }
 
-void* webrtc_source_create(obs_data_t *settings, obs_source_t *source) {
-    obs_data_set_default_int(settings, "http_server_port", 3080);
-    obs_data_set_default_int(settings, "websocket_server_port", 3081);
+static void webrtc_source_nack(
+    uint32_t ssrc,
+    const uint16_t *sequence_numbers,
+    size_t count,
+    void *data
+) {
+    struct webrtc_source *src = data;
+    webrtc_connection_send_nack(src->webrtc_conn, ssrc, sequence_numbers, count);
+}
 
-    struct webrtc_source *src = bzalloc(sizeof(struct webrtc_source));
-    src->source = source;
-    src->settings = settings;
+void webrtc_video_callback(uint8_t *buffer, size_t len, void *data) {
+    struct webrtc_source *src = data;
 
-    src->decoder = h264_decoder_create();
+    if (os_atomic_exchange_bool(&src->decoder_stale, false)) {
+        // Set before the queue is cleared, so that the decoder is flushed
+        // before the next packet that is pushed
+        os_atomic_set_bool(&src->flush_decoder, true);
+        decode_queue_clear(src->decode_queue);
+        // The packets that were dropped in the meantime are not lost
+        rtp_receiver_reset(src->receiver);
+    }
 
-    return src;
+    rtp_receiver_push(src->receiver, buffer, len, os_gettime_ns());
+}
+
+static void webrtc_source_parameter_sets(
+    const char *sprop_parameter_sets,
+    void *data
+) {
+    struct webrtc_source *src = data;
+
+    pthread_mutex_lock(&src->parameter_sets_mutex);
+    bfree(src->parameter_sets);
+    src->parameter_sets = bstrdup(sprop_parameter_sets);
+    pthread_mutex_unlock(&src->parameter_sets_mutex);
 }
 
-static void webrtc_source_stop_http_server(struct webrtc_source *src) {
-    if (src->http_server) {
-        obs_log(LOG_INFO, "Stopping HTTP server");
-        http_server_destroy(&src->http_server);
+static void webrtc_source_sender_report(
+    uint64_t ntp_timestamp,
+    uint32_t rtp_timestamp,
+    void *data
+) {
+    struct webrtc_source *src = data;
+    latency_stats_sender_report(src->stats, ntp_timestamp, rtp_timestamp);
+}
+
+static void set_percentiles(
+    obs_data_t *data,
+    const char *name,
+    const struct latency_percentiles *percentiles
+) {
+    obs_data_t *obj = obs_data_create();
+    obs_data_set_double(obj, "p50", percentiles->p50);
+    obs_data_set_double(obj, "p95", percentiles->p95);
+    obs_data_set_double(obj, "p99", percentiles->p99);
+    obs_data_set_int(obj, "count", percentiles->count);
+
+    obs_data_set_obj(data, name, obj);
+    obs_data_release(obj);
+}
+
+/**
+ * Procedure "get_stats", which returns the latency percentiles in
+ * milliseconds, the packet and frame counters and the decoding load as a JSON
+ * string.
+ */
+static void webrtc_source_get_stats(void *data, calldata_t *cd) {
+    struct webrtc_source *src = data;
+
+    struct latency_report report;
+    latency_stats_get_report(src->stats, &report);
+
+    obs_data_t *latency = obs_data_create();
+    set_percentiles(latency, "network", &report.network);
+    set_percentiles(latency, "jitter_buffer", &report.jitter_buffer);
+    set_percentiles(latency, "queue", &report.queue);
+    set_percentiles(latency, "decode", &report.decode);
+    set_percentiles(latency, "output", &report.output);
+    set_percentiles(latency, "total", &report.total);
+
+    struct rtp_receiver_stats receiver_stats;
+    rtp_receiver_get_stats(src->receiver, &receiver_stats);
+
+    obs_data_t *packets = obs_data_create();
+    obs_data_set_int(packets, "received", receiver_stats.received);
+    obs_data_set_int(packets, "fec_received", receiver_stats.fec_received);
+    obs_data_set_int(packets, "recovered", receiver_stats.recovered);
+    obs_data_set_int(packets, "lost", receiver_stats.lost);
+    obs_data_set_int(packets, "discarded", receiver_stats.discarded);
+    obs_data_set_int(packets, "retransmitted", receiver_stats.retransmitted);
+    obs_data_set_int(packets, "nacks_sent", receiver_stats.nacks_sent);
+    obs_data_set_double(packets, "rtt_ms", receiver_stats.rtt_ns / 1000000.0);
+
+    obs_data_t *frames = obs_data_create();
+    obs_data_set_int(frames, "suppressed",
+        os_atomic_load_long(&src->suppressed_frames));
+
+    struct decode_queue_stats decode_stats;
+    decode_queue_get_stats(src->decode_queue, &decode_stats);
+
+    obs_data_t *decode = obs_data_create();
+    obs_data_set_double(decode, "cpu_percent", decode_stats.cpu_share * 100.0);
+    obs_data_set_double(decode, "cpu_total_ms", decode_stats.cpu_ns / 1000000.0);
+    obs_data_set_int(decode, "queued", decode_stats.queued);
+    obs_data_set_int(decode, "dropped", decode_stats.dropped);
+    obs_data_set_int(decode, "threads", decode_scheduler_get_threads());
+
+    obs_data_t *stats = obs_data_create();
+    obs_data_set_obj(stats, "latency", latency);
+    obs_data_set_obj(stats, "packets", packets);
+    obs_data_set_obj(stats, "frames", frames);
+    obs_data_set_obj(stats, "decode", decode);
+
+    struct webrtc_negotiated_codec negotiated;
+    if (src->webrtc_conn
+        && webrtc_connection_get_negotiated_codec(src->webrtc_conn, &negotiated)) {
+        char level[8];
+        snprintf(level, sizeof(level), "%d.%d",
+            negotiated.level / 10, negotiated.level % 10);
+
+        obs_data_t *codec = obs_data_create();
+        obs_data_set_int(codec, "payload_type", negotiated.payload_type);
+        obs_data_set_string(codec, "profile",
+            webrtc_h264_profile_name(negotiated.profile));
+        obs_data_set_string(codec, "level", level);
+        obs_data_set_int(codec, "packetization_mode",
+            negotiated.packetization_mode);
+        obs_data_set_obj(stats, "codec", codec);
+        obs_data_release(codec);
     }
+
+    calldata_set_string(cd, "stats", obs_data_get_json(stats));
+
+    obs_data_release(latency);
+    obs_data_release(packets);
+    obs_data_release(frames);
+    obs_data_release(decode);
+    obs_data_release(stats);
 }
 
-static void webrtc_source_stop_ws_server(struct webrtc_source *src) {
-    if (src->webrtc_conn) {
-        obs_log(LOG_INFO, "Stopping WebSocket server");
-        webrtc_connection_delete(&src->webrtc_conn);
+/**
+ * Computes the capture constraints for the client from the source settings.
+ * Limits that are left at 0 are taken from the OBS canvas, since anything
+ * larger than the canvas will be scaled down anyway.
+ */
+static void webrtc_source_get_constraints(
+    obs_data_t *settings,
+    struct webrtc_capture_constraints *constraints
+) {
+    struct obs_video_info ovi = {0};
+    bool have_canvas = obs_get_video_info(&ovi);
+
+    constraints->max_width = obs_data_get_int(settings, "max_width");
+    constraints->max_height = obs_data_get_int(settings, "max_height");
+    constraints->max_framerate = obs_data_get_int(settings, "max_fps");
+
+    if (have_canvas) {
+        if (constraints->max_width == 0) {
+            constraints->max_width = ovi.base_width;
+        }
+        if (constraints->max_height == 0) {
+            constraints->max_height = ovi.base_height;
+        }
+        if (constraints->max_framerate == 0 && ovi.fps_den > 0) {
+            // Round up, so that e.g. 29.97 fps is not capped to 29
+            constraints->max_framerate =
+                (ovi.fps_num + ovi.fps_den - 1) / ovi.fps_den;
+        }
     }
 }
 
-static bool webrtc_source_start_http_server(
-    struct webrtc_source *src,
-    int port
+/**
+ * Reads the encoding profile that the client is asked to use from the source
+ * settings.
+ */
+static void webrtc_source_get_encoding_profile(
+    obs_data_t *settings,
+    struct webrtc_encoding_profile *profile
 ) {
-    if (src->http_server) {
-        webrtc_source_stop_http_server(src);
+    const char *content_type = obs_data_get_string(settings, "content_type");
+    if (strcmp(content_type, "screen") == 0) {
+        profile->content_type = WEBRTC_CONTENT_SCREEN;
+    } else if (strcmp(content_type, "camera") == 0) {
+        profile->content_type = WEBRTC_CONTENT_CAMERA;
+    } else {
+        profile->content_type = WEBRTC_CONTENT_AUTO;
     }
 
-    obs_log(LOG_INFO, "Starting HTTP server");
-    src->http_server = http_server_create(port);
+    profile->max_bitrate = obs_data_get_int(settings, "max_bitrate");
 
-    if (!src->http_server) {
-        obs_log(LOG_ERROR, "HTTP server could not be created");
-        return false;
+    const char *h264_profile = obs_data_get_string(settings, "h264_profile");
+    if (strcmp(h264_profile, "constrained_baseline") == 0) {
+        profile->h264_profile = WEBRTC_H264_PROFILE_CONSTRAINED_BASELINE;
+    } else if (strcmp(h264_profile, "main") == 0) {
+        profile->h264_profile = WEBRTC_H264_PROFILE_MAIN;
+    } else if (strcmp(h264_profile, "high") == 0) {
+        profile->h264_profile = WEBRTC_H264_PROFILE_HIGH;
+    } else {
+        profile->h264_profile = WEBRTC_H264_PROFILE_ANY;
     }
 
+    const char *codec_policy = obs_data_get_string(settings, "codec_policy");
+    if (strcmp(codec_policy, "quality") == 0) {
+        profile->codec_policy = WEBRTC_CODEC_POLICY_QUALITY;
+    } else {
+        profile->codec_policy = WEBRTC_CODEC_POLICY_DECODE_COST;
+    }
+}
+
+static void webrtc_source_room_message(void *data, const char *message) {
+    struct webrtc_source *src = data;
+    webrtc_connection_handle_message(src->webrtc_conn, message);
+}
+
+/**
+ * Formats the current local time for use in file names.
+ */
+static void get_file_date(char *date, size_t size) {
+    time_t now = time(NULL);
+    struct tm tm;
+    strftime(date, size, "%Y-%m-%d %H-%M-%S", localtime_r(&now, &tm));
+}
+
+/**
+ * Captures the RTP of the guest if it is enabled in the plugin config, so
+ * that problems can be reproduced with webrtc-replay.
+ */
+static void webrtc_source_room_connected(void *data) {
+    struct webrtc_source *src = data;
+
+    const char *dir = obs_data_get_string(plugin_config_get(), "rtp_capture_dir");
+    if (!*dir) return;
+
+    char date[32];
+    get_file_date(date, sizeof(date));
+
+    struct dstr path = {0};
+    dstr_printf(&path, "%s/room-%s %s.rtpdump", dir, src->room_id, date);
+    webrtc_connection_set_capture(src->webrtc_conn, path.array);
+    dstr_free(&path);
+}
+
+static void webrtc_source_room_disconnected(void *data) {
+    struct webrtc_source *src = data;
+    webrtc_connection_set_capture(src->webrtc_conn, NULL);
+    webrtc_connection_client_disconnected(src->webrtc_conn);
+
+    // The next guest has a different clock and network, and their stream
+    // starts from scratch
+    os_atomic_set_bool(&src->flush_decoder, true);
+    latency_stats_reset(src->stats);
+    rtp_receiver_reset(src->receiver);
+    rtp_receiver_reset_stats(src->receiver);
+    os_atomic_set_long(&src->suppressed_frames, 0);
+}
+
+static const struct signaling_room_callbacks webrtc_source_room_callbacks = {
+    .connected = webrtc_source_room_connected,
+    .message = webrtc_source_room_message,
+    .disconnected = webrtc_source_room_disconnected,
+};
+
+static void webrtc_source_signal(const char *message, void *data) {
+    struct webrtc_source *src = data;
+
+    pthread_mutex_lock(&src->signal_mutex);
+    if (src->room) {
+        signaling_room_send(src->room, message);
+    }
+    pthread_mutex_unlock(&src->signal_mutex);
+}
+
+static void webrtc_source_unregister_room(struct webrtc_source *src) {
+    pthread_mutex_lock(&src->signal_mutex);
+    struct signaling_room *room = src->room;
+    src->room = NULL;
+    pthread_mutex_unlock(&src->signal_mutex);
+
+    signaling_server_unregister(&room);
+    src->room_id[0] = '\0';
+}
+
+static bool webrtc_source_register_room(
+    struct webrtc_source *src,
+    const char *room_id
+) {
+    struct signaling_room *room = signaling_server_register(
+        room_id,
+        &webrtc_source_room_callbacks,
+        src
+    );
+    if (!room) return false;
+
+    pthread_mutex_lock(&src->signal_mutex);
+    src->room = room;
+    pthread_mutex_unlock(&src->signal_mutex);
+
+    snprintf(src->room_id, sizeof(src->room_id), "%s", room_id);
     return true;
 }
 
-static bool webrtc_source_start_ws_server(struct webrtc_source *src, int port) {
-    if (src->webrtc_conn) {
-        webrtc_connection_delete(&src->webrtc_conn);
+/**
+ * Registers the room from the settings. If it is empty or taken, e.g. because
+ * the source was duplicated, the lowest free number is used instead and
+ * written back to the settings.
+ */
+static bool webrtc_source_register_room_from_settings(
+    struct webrtc_source *src
+) {
+    const char *room_id = obs_data_get_string(src->settings, "room");
+    if (*room_id && webrtc_source_register_room(src, room_id)) {
+        return true;
+    }
+
+    char free_id[16];
+    for (int i = 1; i < 10000; i++) {
+        snprintf(free_id, sizeof(free_id), "%d", i);
+        if (!signaling_server_room_available(free_id)) continue;
+
+        if (webrtc_source_register_room(src, free_id)) {
+            if (*room_id) {
+                obs_log(LOG_WARNING,
+                    "Room %s is taken, using room %s", room_id, free_id);
+            }
+            obs_data_set_string(src->settings, "room", free_id);
+            return true;
+        }
     }
 
-    obs_log(LOG_INFO, "Starting WebSocket server");
+    obs_log(LOG_ERROR, "No free room could be found");
+    return false;
+}
+
+/**
+ * Decodes only keyframes while the source is not in the program, if it is
+ * enabled.
+ */
+static void webrtc_source_update_decode_mode(struct webrtc_source *src) {
+    bool keyframes_only = src->preview_keyframes_only && !src->active
+        && !src->sharing;
+    // The decoding thread catches up when it switches back
+    os_atomic_set_bool(&src->keyframes_only, keyframes_only);
+}
+
+/**
+ * Pauses the video while the source is neither shown nor active, so that
+ * sources in unused scenes do not decode frames nobody sees. Recording and
+ * sharing keep the video going regardless.
+ */
+static void webrtc_source_update_activity(struct webrtc_source *src) {
+    webrtc_source_update_decode_mode(src);
+
+    if (!src->webrtc_conn) return;
+
+    bool active = src->showing || src->active || src->recording
+        || src->sharing;
+    if (active == src->video_active) return;
+    src->video_active = active;
+
+    if (active) {
+        os_atomic_set_bool(&src->decoder_stale, true);
+    }
+
+    obs_log(LOG_INFO, "%s video of room %s",
+        active ? "Resuming" : "Pausing", src->room_id);
+    webrtc_connection_set_active(src->webrtc_conn, active);
+}
+
+/**
+ * Starts a new recording file in the configured directory.
+ */
+static void webrtc_source_start_recording(
+    struct webrtc_source *src,
+    obs_data_t *settings
+) {
+    const char *dir = obs_data_get_string(settings, "record_path");
+    const char *format = obs_data_get_string(settings, "record_format");
+    if (!*dir) {
+        obs_log(LOG_WARNING, "No recording directory is set");
+        return;
+    }
+
+    char date[32];
+    get_file_date(date, sizeof(date));
+
+    struct dstr path = {0};
+    dstr_printf(&path, "%s/%s %s.%s",
+        dir, obs_source_get_name(src->source), date, format);
+
+    struct h264_recorder *recorder = h264_recorder_create(path.array);
+    dstr_free(&path);
+
+    pthread_mutex_lock(&src->recorder_mutex);
+    src->recorder = recorder;
+    pthread_mutex_unlock(&src->recorder_mutex);
+}
+
+static void webrtc_source_stop_recording(struct webrtc_source *src) {
+    pthread_mutex_lock(&src->recorder_mutex);
+    struct h264_recorder *recorder = src->recorder;
+    src->recorder = NULL;
+    pthread_mutex_unlock(&src->recorder_mutex);
+
+    // Outside of the lock, since it waits for the queue to be written
+    h264_recorder_destroy(&recorder);
+}
+
+/**
+ * Applies the recording settings. Any change starts a new file.
+ */
+static void webrtc_source_update_recording(
+    struct webrtc_source *src,
+    obs_data_t *settings
+) {
+    bool record = obs_data_get_bool(settings, "record");
+    const char *record_path = obs_data_get_string(settings, "record_path");
+    const char *record_format = obs_data_get_string(settings, "record_format");
+    bool recording_changed = record != src->recording
+        || strcmp(record_path, src->record_path ? src->record_path : "") != 0
+        || strcmp(record_format, src->record_format ? src->record_format : "") != 0;
+
+    if (recording_changed) {
+        webrtc_source_stop_recording(src);
+        if (record) {
+            webrtc_source_start_recording(src, settings);
+        }
+
+        bfree(src->record_path);
+        bfree(src->record_format);
+        src->record_path = bstrdup(record_path);
+        src->record_format = bstrdup(record_format);
+        src->recording = record;
+
+        webrtc_source_update_activity(src);
+    }
+}
+
+static void webrtc_source_stop_sharing(struct webrtc_source *src) {
+    pthread_mutex_lock(&src->frame_ring_mutex);
+    frame_ring_destroy(&src->frame_ring);
+    pthread_mutex_unlock(&src->frame_ring_mutex);
+}
+
+/**
+ * Applies the sharing settings. The frames are shared under the name of the
+ * room, so a new room starts a new ring.
+ */
+static void webrtc_source_update_sharing(
+    struct webrtc_source *src,
+    obs_data_t *settings
+) {
+    bool share = obs_data_get_bool(settings, "share_frames") && *src->room_id;
+
+    struct dstr name = {0};
+    dstr_printf(&name, "/obs-webrtc-%s", src->room_id);
+    bool sharing_changed = share != src->sharing
+        || (share && strcmp(name.array, src->share_name) != 0);
+
+    if (sharing_changed) {
+        webrtc_source_stop_sharing(src);
+        if (share) {
+            // The ring grows by itself if the frames turn out to be larger
+            struct webrtc_capture_constraints constraints;
+            webrtc_source_get_constraints(settings, &constraints);
+            struct frame_ring *ring = frame_ring_create(
+                name.array,
+                constraints.max_width ? constraints.max_width : 1280,
+                constraints.max_height ? constraints.max_height : 720
+            );
+
+            pthread_mutex_lock(&src->frame_ring_mutex);
+            src->frame_ring = ring;
+            pthread_mutex_unlock(&src->frame_ring_mutex);
+        }
+
+        bfree(src->share_name);
+        src->share_name = share ? bstrdup(name.array) : NULL;
+        src->sharing = share;
+
+        webrtc_source_update_activity(src);
+    }
+
+    dstr_free(&name);
+}
+
+static void webrtc_source_update_output_size(
+    struct webrtc_source *src,
+    obs_data_t *settings
+) {
+    os_atomic_set_long(
+        &src->output_width,
+        (long) obs_data_get_int(settings, "output_width")
+    );
+    os_atomic_set_long(
+        &src->output_height,
+        (long) obs_data_get_int(settings, "output_height")
+    );
+}
+
+static void webrtc_source_update_preview(
+    struct webrtc_source *src,
+    obs_data_t *settings
+) {
+    src->preview_keyframes_only =
+        obs_data_get_bool(settings, "preview_keyframes_only");
+    src->preview_keyframe_interval =
+        (long) obs_data_get_int(settings, "preview_keyframe_interval");
+
+    webrtc_source_update_decode_mode(src);
+}
+
+void* webrtc_source_create(obs_data_t *settings, obs_source_t *source) {
+    obs_data_set_default_string(settings, "room", "");
+    obs_data_set_default_int(settings, "max_width", 0);
+    obs_data_set_default_int(settings, "max_height", 0);
+    obs_data_set_default_int(settings, "max_fps", 0);
+    obs_data_set_default_string(settings, "content_type", "auto");
+    obs_data_set_default_int(settings, "max_bitrate", 0);
+    obs_data_set_default_string(settings, "h264_profile", "any");
+    obs_data_set_default_string(settings, "codec_policy", "decode_cost");
+    obs_data_set_default_int(settings, "output_width", 0);
+    obs_data_set_default_int(settings, "output_height", 0);
+    obs_data_set_default_bool(settings, "preview_keyframes_only", false);
+    obs_data_set_default_int(settings, "preview_keyframe_interval", 0);
+    obs_data_set_default_bool(settings, "record", false);
+    obs_data_set_default_string(settings, "record_path", "");
+    obs_data_set_default_string(settings, "record_format", "mkv");
+    obs_data_set_default_bool(settings, "share_frames", false);
+
+    struct webrtc_source *src = bzalloc(sizeof(struct webrtc_source));
+    src->source = source;
+    src->settings = settings;
+    pthread_mutex_init(&src->signal_mutex, NULL);
+    pthread_mutex_init(&src->recorder_mutex, NULL);
+    pthread_mutex_init(&src->frame_ring_mutex, NULL);
+
+    pthread_mutex_init(&src->parameter_sets_mutex, NULL);
+
+    src->scaler = frame_scaler_create();
+    webrtc_source_update_output_size(src, settings);
+
+    uint64_t gop_cache_mb = obs_data_get_int(plugin_config_get(), "gop_cache_mb");
+    if (gop_cache_mb > 0) {
+        src->gop_cache = gop_cache_create(gop_cache_mb * 1024 * 1024);
+    }
+    src->stats = latency_stats_create();
+    src->decode_queue = decode_scheduler_add_queue(webrtc_source_rtp_packet, src);
+
+    uint64_t hold_ms = obs_data_get_int(plugin_config_get(), "loss_wait_ms");
+    struct rtp_receiver_config receiver_conf = {
+        .red_payload_type = WEBRTC_PAYLOAD_TYPE_RED,
+        .ulpfec_payload_type = WEBRTC_PAYLOAD_TYPE_ULPFEC,
+        .flexfec_payload_type = WEBRTC_PAYLOAD_TYPE_FLEXFEC,
+        .rtx = {
+            {WEBRTC_PAYLOAD_TYPE_RTX, WEBRTC_PAYLOAD_TYPE_H264},
+            {WEBRTC_PAYLOAD_TYPE_RTX_MAIN, WEBRTC_PAYLOAD_TYPE_H264_MAIN},
+            {WEBRTC_PAYLOAD_TYPE_RTX_HIGH, WEBRTC_PAYLOAD_TYPE_H264_HIGH},
+        },
+        .max_hold_ns = hold_ms * 1000000,
+    };
+    src->receiver = rtp_receiver_create(
+        &receiver_conf,
+        webrtc_source_receiver_packet,
+        src
+    );
+    rtp_receiver_set_nack_callback(src->receiver, webrtc_source_nack, src);
+
+    proc_handler_add(
+        obs_source_get_proc_handler(source),
+        "void get_stats(out string stats)",
+        webrtc_source_get_stats,
+        src
+    );
+
+    obs_log(LOG_INFO, "Creating WebRTC connection");
     struct webrtc_connection_config webrtc_conf = {
-        .port = port,
         .video_callback = webrtc_video_callback,
         .video_callback_data = src,
+        .signal_callback = webrtc_source_signal,
+        .signal_callback_data = src,
+        .sender_report_callback = webrtc_source_sender_report,
+        .sender_report_callback_data = src,
+        .parameter_sets_callback = webrtc_source_parameter_sets,
+        .parameter_sets_callback_data = src,
     };
+    webrtc_source_get_constraints(settings, &webrtc_conf.constraints);
+    webrtc_source_get_encoding_profile(settings, &webrtc_conf.encoding_profile);
     src->webrtc_conn = webrtc_connection_create(&webrtc_conf);
 
     if (!src->webrtc_conn) {
-        obs_log(LOG_ERROR, "WebSocket server could not be started");
-        return false;
+        obs_log(LOG_ERROR, "WebRTC connection could not be created");
+    } else {
+        // Stay paused until the source is shown
+        webrtc_connection_set_active(src->webrtc_conn, false);
+
+        // The connection has to exist before guests can be routed to it
+        webrtc_source_register_room_from_settings(src);
     }
 
-    http_server_set_ws_port(src->http_server, port);
+    webrtc_source_update_preview(src, settings);
+    webrtc_source_update_recording(src, settings);
+    webrtc_source_update_sharing(src, settings);
 
-    return true;
+    return src;
 }
 
-bool webrtc_source_start_servers(
-    obs_properties_t *props,
-    obs_property_t *property,
-    void *data
+/**
+ * Builds the description of the info text with the guest URL.
+ */
+static void webrtc_source_set_url_text(
+    obs_property_t *url_text,
+    obs_data_t *settings
 ) {
-    struct webrtc_source *src = data;
-    char error_desc[1024];
+    char desc[256];
+    int port = signaling_server_get_port();
 
-    obs_property_t *error_text = obs_properties_get(props, "error_text");
-    obs_property_set_visible(error_text, false);
-
-    int http_port = obs_data_get_int(src->settings, "http_server_port");
-    if (!webrtc_source_start_http_server(src, http_port)) {
-        snprintf(
-            error_desc, 1024,
-            "Error while starting HTTP server: %s", strerror(errno)
+    if (port == 0) {
+        snprintf(desc, sizeof(desc),
+            "The server is not running, see the log for details");
+        obs_property_text_set_info_type(url_text, OBS_TEXT_INFO_ERROR);
+    } else {
+        snprintf(desc, sizeof(desc),
+            "Guests join at http://<this computer's address>:%d%s%s",
+            port, SIGNALING_ROOM_PREFIX, obs_data_get_string(settings, "room")
         );
-
-        obs_property_set_description(error_text, error_desc);
-        obs_property_text_set_info_type(error_text, OBS_TEXT_INFO_ERROR);
-        obs_property_set_visible(error_text, true);
-        return true;
+        obs_property_text_set_info_type(url_text, OBS_TEXT_INFO_NORMAL);
     }
 
-    int ws_port = obs_data_get_int(src->settings, "websocket_server_port");
-    if (!webrtc_source_start_ws_server(src, ws_port)) {
-        webrtc_source_stop_http_server(src);
-
-        snprintf(
-            error_desc, 1024,
-            "Error while starting WebSocket server: %s", strerror(errno)
-        );
-
-        obs_property_set_description(error_text, error_desc);
-        obs_property_text_set_info_type(error_text, OBS_TEXT_INFO_ERROR);
-        obs_property_set_visible(error_text, true);
-        return true;
-    }
+    obs_property_set_description(url_text, desc);
+}
 
-    // Hide the "Start Servers" button
-    obs_property_set_visible(property, false);
-    // Show the "Stop Servers" button
-    obs_property_set_visible(
-        obs_properties_get(props, "stop_servers_button"),
-        true
-    );
+static bool webrtc_source_room_modified(
+    obs_properties_t *props,
+    obs_property_t *property,
+    obs_data_t *settings
+) {
+    UNUSED_PARAMETER(property);
 
+    webrtc_source_set_url_text(obs_properties_get(props, "url_text"), settings);
     return true;
 }
 
-bool webrtc_source_stop_servers(
+static const char* webrtc_source_trace_text(void) {
+    return trace_is_enabled() ? "Stop tracing and save" : "Start tracing";
+}
+
+/**
+ * Starts tracing all the sources, or stops and saves the trace to the
+ * plugin's configuration directory.
+ */
+static bool webrtc_source_trace_clicked(
     obs_properties_t *props,
     obs_property_t *property,
     void *data
 ) {
-    struct webrtc_source *src = data;
+    UNUSED_PARAMETER(props);
+    UNUSED_PARAMETER(data);
 
-    webrtc_source_stop_http_server(src);
+    if (!trace_is_enabled()) {
+        trace_start();
+    } else {
+        trace_stop();
 
-    webrtc_source_stop_ws_server(src);
+        char date[32];
+        get_file_date(date, sizeof(date));
 
-    // Hide the "Stop Servers" button
-    obs_property_set_visible(property, false);
-    // Show the "Start Servers" button
-    obs_property_set_visible(
-        obs_properties_get(props, "start_servers_button"),
-        true
-    );
+        char *dir = obs_module_config_path("");
+        struct dstr path = {0};
+        dstr_printf(&path, "%strace %s.json", dir, date);
+        trace_save(path.array);
+        dstr_free(&path);
+        bfree(dir);
+    }
 
+    obs_property_set_description(property, webrtc_source_trace_text());
     return true;
 }
 
 obs_properties_t* webrtc_source_get_properties(void *data) {
     struct webrtc_source *src = data;
-    UNUSED_PARAMETER(src);
 
     obs_properties_t *props = obs_properties_create();
 
-    obs_properties_add_int(props,
-        "http_server_port",
-        "HTTP server port",
-        1024, 65535, 1
+    obs_property_t *room = obs_properties_add_text(props,
+        "room",
+        "Room",
+        OBS_TEXT_DEFAULT
+    );
+    obs_property_set_long_description(room,
+        "The guest of this source joins at /guest/<room>. "
+        "Only letters, digits, '-' and '_' are allowed."
     );
+    obs_property_set_modified_callback(room, webrtc_source_room_modified);
 
-    obs_properties_add_int(props,
-        "websocket_server_port",
-        "WebSocket server port",
-        1024, 65535, 1
+    obs_property_t *url_text = obs_properties_add_text(props,
+        "url_text",
+        "",
+        OBS_TEXT_INFO
     );
+    webrtc_source_set_url_text(url_text, src->settings);
 
-    obs_property_t *start_servers_button = obs_properties_add_button2(props,
-        "start_servers_button",
-        "Start servers",
-        webrtc_source_start_servers,
-        src
+    obs_property_t *max_width = obs_properties_add_int(props,
+        "max_width",
+        "Maximum capture width",
+        0, 16384, 1
+    );
+    obs_property_set_long_description(max_width,
+        "The browser scales the capture down to this width. "
+        "0 uses the canvas width."
     );
 
-    obs_property_t *stop_servers_button = obs_properties_add_button2(props,
-        "stop_servers_button",
-        "Stop servers",
-        webrtc_source_stop_servers,
-        src
+    obs_property_t *max_height = obs_properties_add_int(props,
+        "max_height",
+        "Maximum capture height",
+        0, 16384, 1
+    );
+    obs_property_set_long_description(max_height,
+        "The browser scales the capture down to this height. "
+        "0 uses the canvas height."
     );
 
-    if (src->http_server) {
-        obs_property_set_visible(start_servers_button, false);
-        obs_property_set_visible(stop_servers_button, true);
-    } else {
-        obs_property_set_visible(start_servers_button, true);
-        obs_property_set_visible(stop_servers_button, false);
-    }
+    obs_property_t *max_fps = obs_properties_add_int(props,
+        "max_fps",
+        "Maximum capture frame rate",
+        0, 240, 1
+    );
+    obs_property_set_long_description(max_fps,
+        "The browser sends at most this many frames per second. "
+        "0 uses the canvas frame rate."
+    );
 
-    obs_property_t *error_text = obs_properties_add_text(props,
-        "error_text",
-        "",
-        OBS_TEXT_INFO
+    obs_property_t *content_type = obs_properties_add_list(props,
+        "content_type",
+        "Content",
+        OBS_COMBO_TYPE_LIST,
+        OBS_COMBO_FORMAT_STRING
+    );
+    obs_property_list_add_string(content_type, "Let the browser decide", "auto");
+    obs_property_list_add_string(content_type, "Screen (keep text sharp)", "screen");
+    obs_property_list_add_string(content_type, "Camera (keep motion smooth)", "camera");
+    obs_property_set_long_description(content_type,
+        "Tells the browser's encoder what to give up when the bandwidth "
+        "runs short: frame rate for screens, resolution for cameras."
+    );
+
+    obs_property_t *max_bitrate = obs_properties_add_int(props,
+        "max_bitrate",
+        "Maximum bitrate",
+        0, 100000, 100
+    );
+    obs_property_int_set_suffix(max_bitrate, " kbps");
+    obs_property_set_long_description(max_bitrate,
+        "The browser encodes the video with at most this bitrate. "
+        "0 leaves it to the browser."
+    );
+
+    obs_property_t *h264_profile = obs_properties_add_list(props,
+        "h264_profile",
+        "Preferred H.264 profile",
+        OBS_COMBO_TYPE_LIST,
+        OBS_COMBO_FORMAT_STRING
+    );
+    obs_property_list_add_string(h264_profile, "Any", "any");
+    obs_property_list_add_string(h264_profile, "Constrained Baseline",
+        "constrained_baseline");
+    obs_property_list_add_string(h264_profile, "Main", "main");
+    obs_property_list_add_string(h264_profile, "High", "high");
+    obs_property_set_long_description(h264_profile,
+        "The profile that the browser is asked to prefer, if its encoder "
+        "supports several. Takes effect when the guest reconnects."
+    );
+
+    obs_property_t *codec_policy = obs_properties_add_list(props,
+        "codec_policy",
+        "H.264 profile order",
+        OBS_COMBO_TYPE_LIST,
+        OBS_COMBO_FORMAT_STRING
+    );
+    obs_property_list_add_string(codec_policy, "Lowest decoding cost first",
+        "decode_cost");
+    obs_property_list_add_string(codec_policy, "Best quality per bit first",
+        "quality");
+    obs_property_set_long_description(codec_policy,
+        "The order in which the profiles are offered, which decides the "
+        "profile unless a preferred one is set. Constrained Baseline is the "
+        "cheapest to decode, High needs the fewest bits for the same quality. "
+        "Takes effect when the guest reconnects."
+    );
+
+    obs_property_t *output_width = obs_properties_add_int(props,
+        "output_width",
+        "Maximum output width",
+        0, 16384, 1
+    );
+    obs_property_set_long_description(output_width,
+        "Received frames that are wider are scaled down before they are "
+        "handed to OBS, which saves uploading them at full resolution. "
+        "0 for no limit."
+    );
+
+    obs_property_t *output_height = obs_properties_add_int(props,
+        "output_height",
+        "Maximum output height",
+        0, 16384, 1
+    );
+    obs_property_set_long_description(output_height,
+        "Received frames that are taller are scaled down before they are "
+        "handed to OBS. 0 for no limit."
+    );
+
+    obs_property_t *preview_keyframes_only = obs_properties_add_bool(props,
+        "preview_keyframes_only",
+        "Decode only keyframes outside of the program"
+    );
+    obs_property_set_long_description(preview_keyframes_only,
+        "Saves decoding every frame while the source is only in the "
+        "preview or a multiview. Full decoding resumes as soon as the "
+        "source goes to the program, with a keyframe that is asked for."
+    );
+
+    obs_property_t *preview_keyframe_interval = obs_properties_add_int(props,
+        "preview_keyframe_interval",
+        "Keyframe interval outside of the program",
+        0, 60, 1
+    );
+    obs_property_int_set_suffix(preview_keyframe_interval, " s");
+    obs_property_set_long_description(preview_keyframe_interval,
+        "Asks the guest for a keyframe this often while only keyframes are "
+        "decoded, so that the preview stays live. 0 only shows the "
+        "keyframes that the guest sends by itself."
+    );
+
+    obs_property_t *record = obs_properties_add_bool(props,
+        "record",
+        "Record the received video"
+    );
+    obs_property_set_long_description(record,
+        "Writes the video as it was received, without re-encoding it. "
+        "The video keeps being received while recording, even if the "
+        "source is not shown."
+    );
+
+    obs_properties_add_path(props,
+        "record_path",
+        "Recording directory",
+        OBS_PATH_DIRECTORY,
+        NULL,
+        NULL
+    );
+
+    obs_property_t *record_format = obs_properties_add_list(props,
+        "record_format",
+        "Recording format",
+        OBS_COMBO_TYPE_LIST,
+        OBS_COMBO_FORMAT_STRING
+    );
+    obs_property_list_add_string(record_format, "Matroska (.mkv)", "mkv");
+    obs_property_list_add_string(record_format, "Fragmented MP4 (.mp4)", "mp4");
+
+    obs_property_t *share_frames = obs_properties_add_bool(props,
+        "share_frames",
+        "Share the decoded video"
+    );
+    obs_property_set_long_description(share_frames,
+        "Publishes the decoded frames at their full size to the shared "
+        "memory object /obs-webrtc-<room>, for other programs on this "
+        "computer to read with frame-ring-reader. The video keeps being "
+        "received and decoded while it is shared, even if the source is not "
+        "shown. Not available on Windows."
+    );
+
+    obs_property_t *trace = obs_properties_add_button2(props,
+        "trace",
+        webrtc_source_trace_text(),
+        webrtc_source_trace_clicked,
+        src
+    );
+    obs_property_set_long_description(trace,
+        "Records the timing of every stage of receiving and decoding, for "
+        "all the sources, to a file in the plugin's configuration directory "
+        "that chrome://tracing or Perfetto can open."
     );
-    obs_property_set_visible(error_text, false);
 
     return props;
 }
 
-void webrtc_source_destroy(void *data) {
+void webrtc_source_update(void *data, obs_data_t *settings) {
     struct webrtc_source *src = data;
 
-    webrtc_source_stop_http_server(src);
+    const char *room_id = obs_data_get_string(settings, "room");
+    if (src->webrtc_conn && strcmp(room_id, src->room_id) != 0) {
+        char old_room_id[SIGNALING_MAX_ROOM_ID + 1];
+        snprintf(old_room_id, sizeof(old_room_id), "%s", src->room_id);
 
-    webrtc_source_stop_ws_server(src);
+        if (!signaling_server_room_available(room_id)) {
+            obs_log(LOG_WARNING,
+                "Room %s is invalid or taken, keeping room %s",
+                room_id, old_room_id);
+            obs_data_set_string(settings, "room", old_room_id);
+        } else {
+            // The guest of the old room is disconnected, so the peer
+            // connection has to be reset for the next one
+            webrtc_source_unregister_room(src);
+            webrtc_connection_client_disconnected(src->webrtc_conn);
 
-    h264_decoder_destroy(&src->decoder);
+            if (!webrtc_source_register_room(src, room_id)) {
+                webrtc_source_register_room_from_settings(src);
+            }
+        }
+    }
 
-    bfree(src);
+    if (src->webrtc_conn) {
+        struct webrtc_capture_constraints constraints;
+        webrtc_source_get_constraints(settings, &constraints);
+        webrtc_connection_set_capture_constraints(
+            src->webrtc_conn,
+            &constraints
+        );
+
+        struct webrtc_encoding_profile profile;
+        webrtc_source_get_encoding_profile(settings, &profile);
+        webrtc_connection_set_encoding_profile(src->webrtc_conn, &profile);
+    }
+
+    webrtc_source_update_output_size(src, settings);
+    webrtc_source_update_preview(src, settings);
+    webrtc_source_update_recording(src, settings);
+    webrtc_source_update_sharing(src, settings);
 }
 
-const char* webrtc_source_name(void *data) {
-    UNUSED_PARAMETER(data);
-    return "WebRTC Source";
+void webrtc_source_activate(void *data) {
+    struct webrtc_source *src = data;
+    src->active = true;
+    webrtc_source_update_activity(src);
 }
 
-uint32_t webrtc_source_width(void *data) {
-    UNUSED_PARAMETER(data);
-    return 400;
+void webrtc_source_deactivate(void *data) {
+    struct webrtc_source *src = data;
+    src->active = false;
+    webrtc_source_update_activity(src);
 }
 
-uint32_t webrtc_source_height(void *data) {
-    UNUSED_PARAMETER(data);
-    return 300;
+void webrtc_source_show(void *data) {
+    struct webrtc_source *src = data;
+    src->showing = true;
+    webrtc_source_update_activity(src);
+}
+
+void webrtc_source_hide(void *data) {
+    struct webrtc_source *src = data;
+    src->showing = false;
+    webrtc_source_update_activity(src);
 }
 
-void webrtc_source_render(void *data, gs_effect_t *effect) {
+/**
+ * Asks for the keyframes that the decoding thread wants, and for keyframes
+ * at the preview interval while only keyframes are decoded.
+ */
+void webrtc_source_video_tick(void *data, float seconds) {
+    struct webrtc_source *src = data;
+
+    if (os_atomic_exchange_bool(&src->keyframe_wanted, false)
+        && src->webrtc_conn) {
+        webrtc_connection_request_keyframe(src->webrtc_conn);
+    }
+
+    if (!src->webrtc_conn || !src->showing
+        || !os_atomic_load_bool(&src->keyframes_only)
+        || src->preview_keyframe_interval <= 0) {
+        src->keyframe_request_elapsed = 0.0f;
+        return;
+    }
+
+    src->keyframe_request_elapsed += seconds;
+    if (src->keyframe_request_elapsed >= src->preview_keyframe_interval) {
+        src->keyframe_request_elapsed = 0.0f;
+        webrtc_connection_request_keyframe(src->webrtc_conn);
+    }
+}
+
+void webrtc_source_destroy(void *data) {
+    struct webrtc_source *src = data;
+
+    webrtc_source_unregister_room(src);
+
+    if (src->webrtc_conn) {
+        obs_log(LOG_INFO, "Closing WebRTC connection");
+        webrtc_connection_delete(&src->webrtc_conn);
+    }
+
+    webrtc_source_stop_recording(src);
+    bfree(src->record_path);
+    bfree(src->record_format);
+
+    // Waits for the decoder to be done with the last frame, which may still
+    // read the receiver's statistics
+    decode_scheduler_remove_queue(&src->decode_queue);
+    rtp_receiver_destroy(&src->receiver);
+    webrtc_source_stop_sharing(src);
+    bfree(src->share_name);
+    h264_decoder_destroy(&src->decoder);
+    gop_cache_destroy(&src->gop_cache);
+    bfree(src->parameter_sets);
+    frame_scaler_destroy(&src->scaler);
+    latency_stats_destroy(&src->stats);
+
+    pthread_mutex_destroy(&src->signal_mutex);
+    pthread_mutex_destroy(&src->recorder_mutex);
+    pthread_mutex_destroy(&src->frame_ring_mutex);
+    pthread_mutex_destroy(&src->parameter_sets_mutex);
+
+    bfree(src);
+}
+
+const char* webrtc_source_name(void *data) {
     UNUSED_PARAMETER(data);
-    UNUSED_PARAMETER(effect);
+    return "WebRTC Source";
 }
 
 struct obs_source_info webrtc_source = {
@@ -305,4 +1480,10 @@ struct obs_source_info webrtc_source = {
     .get_properties = webrtc_source_get_properties,
     .create = webrtc_source_create,
     .destroy = webrtc_source_destroy,
+    .update = webrtc_source_update,
+    .activate = webrtc_source_activate,
+    .deactivate = webrtc_source_deactivate,
+    .show = webrtc_source_show,
+    .hide = webrtc_source_hide,
+    .video_tick = webrtc_source_video_tick,
 };
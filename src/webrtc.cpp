@@ -17,52 +17,336 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 */
 #include "webrtc.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <mutex>
 #include <string>
+#include <vector>
 #include <rtc/rtc.hpp>
 
 #include <obs/obs-module.h>
 #include "plugin-support.h"
+#include "rtp-parser.h"
+#include "rtpdump.h"
+#include "trace.h"
+
+// The bitrate offered in the SDP, in kbps
+#define VIDEO_BITRATE 9000
+
+// The bitrate requested through REMB while the video is not used, in bps. It
+// only matters for clients that do not understand the pause message.
+#define PAUSED_BITRATE 50000
+
+// The SSRC of our RTCP feedback. We send no media, so any will do.
+#define FEEDBACK_SSRC 1
+
+// How long unloading waits for libdatachannel's threads to finish
+#define CLEANUP_TIMEOUT std::chrono::seconds(10)
+
+// The ports of all the peer connections, set once by webrtc_init
+static webrtc_ice_config ice_config = {};
+
+/**
+ * An H.264 profile that is offered to the client, see webrtc_codec_policy.
+ */
+struct OfferedCodec {
+    int payloadType;
+    int rtxPayloadType;
+    webrtc_h264_profile profile;
+    // The profile_idc and the constraint flags of profile-level-id, in hex
+    const char *profileIop;
+};
+
+// In the order of their decoding cost: Main adds CABAC and B-frames to
+// Constrained Baseline, High adds 8x8 transforms to Main.
+static const OfferedCodec h264_codecs[] = {
+    {
+        WEBRTC_PAYLOAD_TYPE_H264,
+        WEBRTC_PAYLOAD_TYPE_RTX,
+        WEBRTC_H264_PROFILE_CONSTRAINED_BASELINE,
+        "42e0",
+    },
+    {
+        WEBRTC_PAYLOAD_TYPE_H264_MAIN,
+        WEBRTC_PAYLOAD_TYPE_RTX_MAIN,
+        WEBRTC_H264_PROFILE_MAIN,
+        "4d00",
+    },
+    {
+        WEBRTC_PAYLOAD_TYPE_H264_HIGH,
+        WEBRTC_PAYLOAD_TYPE_RTX_HIGH,
+        WEBRTC_H264_PROFILE_HIGH,
+        "6400",
+    },
+};
+
+/**
+ * Receiving session that also passes the incoming RTCP packets on, e.g. for
+ * their sender reports, and that can send RTCP feedback of our own.
+ */
+class ReceivingSession : public rtc::RtcpReceivingSession {
+    std::function<void(const uint8_t *data, size_t len)> rtcpCallback;
+
+    // The way back to the sender, which the track only hands out along with
+    // incoming packets
+    std::mutex sendMutex;
+    rtc::message_callback send;
+
+public:
+    ReceivingSession(
+        std::function<void(const uint8_t *data, size_t len)> rtcpCallback
+    ) : rtcpCallback(std::move(rtcpCallback)) {}
+
+    void incoming(
+        rtc::message_vector &messages,
+        const rtc::message_callback &send
+    ) override {
+        {
+            std::lock_guard lock(this->sendMutex);
+            if (!this->send) {
+                this->send = send;
+            }
+        }
+
+        for (const auto &message : messages) {
+            if (message->type != rtc::Message::Control) continue;
+
+            this->rtcpCallback(
+                (const uint8_t *) message->data(),
+                message->size()
+            );
+        }
+
+        rtc::RtcpReceivingSession::incoming(messages, send);
+    }
+
+    /**
+     * Sends an RTCP packet to the sender.
+     *
+     * @return false if nothing has been received yet, so that there is no
+     * way to send.
+     */
+    bool sendRtcp(const uint8_t *data, size_t len) {
+        rtc::message_callback send;
+        {
+            std::lock_guard lock(this->sendMutex);
+            send = this->send;
+        }
+        if (!send) return false;
+
+        auto bytes = (const std::byte *) data;
+        send(rtc::make_message(bytes, bytes + len, rtc::Message::Control));
+        return true;
+    }
+};
 
 class WebRTCConnection {
-    std::shared_ptr<rtc::WebSocketServer> wsServer;
-    std::shared_ptr<rtc::WebSocket> activeSocket;
     std::shared_ptr<rtc::PeerConnection> peerConnection;
     std::shared_ptr<rtc::Track> videoTrack;
-    std::shared_ptr<rtc::RtcpReceivingSession> session;
+    std::shared_ptr<ReceivingSession> session;
     bool clientReady = false;
 
+    // Guards the client state, the constraints and the encoding profile,
+    // which are accessed both from libdatachannel's threads and from OBS
+    std::mutex mutex;
+    webrtc_capture_constraints constraints = {};
+    webrtc_encoding_profile encodingProfile = {};
+    webrtc_negotiated_codec negotiatedCodec = {};
+
+    // What the offer of the current peer connection was made with
+    webrtc_codec_policy offeredPolicy = WEBRTC_CODEC_POLICY_DECODE_COST;
+    uint8_t offeredLevel = 0;
+
+    // Held while the peer connection is replaced and while a client gets
+    // ready, so that no client is sent an offer that is being replaced
+    std::mutex negotiationMutex;
+
+    // Checked for every received packet, so it is kept out of the mutex
+    std::atomic<bool> active = true;
+
+    // Guards capture, which is written to from libdatachannel's threads
+    std::mutex captureMutex;
+    rtpdump_writer *capture = nullptr;
 
 public:
-    WebRTCConnection(uint16_t port);
+    WebRTCConnection(const webrtc_connection_config &config);
+    ~WebRTCConnection();
 
     webrtc_video_callback_t videoCallback;
     void *videoCallbackData;
+    webrtc_signal_callback_t signalCallback;
+    void *signalCallbackData;
+    webrtc_sender_report_callback_t senderReportCallback;
+    void *senderReportCallbackData;
+    webrtc_parameter_sets_callback_t parameterSetsCallback;
+    void *parameterSetsCallbackData;
+
+    /**
+     * Changes the capture constraints, sending them to the client if it is
+     * already connected.
+     */
+    void setCaptureConstraints(const webrtc_capture_constraints &constraints);
+
+    /**
+     * Changes the encoding profile, sending it to the client if it is
+     * already connected.
+     */
+    void setEncodingProfile(const webrtc_encoding_profile &profile);
+
+    /**
+     * @return false if no client has answered yet.
+     */
+    bool getNegotiatedCodec(webrtc_negotiated_codec &codec);
+
+    /**
+     * Handles a signaling message from the client.
+     */
+    void onMessage(const std::string &message);
+
+    /**
+     * Forgets the current client and prepares a new peer connection for the
+     * next one.
+     */
+    void onClientDisconnected();
+
+    /**
+     * Pauses or resumes the video, see webrtc_connection_set_active.
+     */
+    void setActive(bool active);
+
+    /**
+     * Starts capturing the received RTP and RTCP packets to a file, replacing
+     * any capture in progress. An empty path stops capturing.
+     */
+    void setCapture(const std::string &path);
+
+    /**
+     * Asks the client to retransmit lost packets.
+     */
+    void sendNack(uint32_t ssrc, const uint16_t *sequenceNumbers, size_t count);
+
+    /**
+     * Asks the client for a keyframe, if the video is flowing.
+     */
+    void requestKeyframe();
 private:
+    void onVideoPacket(const rtc::binary &message);
+
+    void onRtcpPacket(const uint8_t *data, size_t len);
+
+    /**
+     * Creates the peer connection with its video track and starts gathering
+     * candidates for the offer.
+     */
+    void createPeerConnection();
+
+    /**
+     * Replaces the peer connection if the settings call for a different
+     * offer and no client has been sent the current one yet.
+     */
+    void renewOffer();
+
     /**
      * Tries to send the local session description to the client, if possible.
+     * The capture constraints and the encoding profile are sent along with
+     * it.
      *
      * @return Whether the session description was sent or not.
      */
     bool sendLocalDescription();
 
-    void onSocket(std::shared_ptr<rtc::WebSocket> socket);
-    void onMessage(rtc::message_variant data);
+    void sendSignal(const std::string &message);
 };
 
-WebRTCConnection::WebRTCConnection(uint16_t port) {
+WebRTCConnection::WebRTCConnection(const webrtc_connection_config &config)
+    : videoCallback(config.video_callback),
+      videoCallbackData(config.video_callback_data),
+      signalCallback(config.signal_callback),
+      signalCallbackData(config.signal_callback_data),
+      senderReportCallback(config.sender_report_callback),
+      senderReportCallbackData(config.sender_report_callback_data),
+      parameterSetsCallback(config.parameter_sets_callback),
+      parameterSetsCallbackData(config.parameter_sets_callback_data) {
     obs_log(LOG_INFO, "WebRTCConnection constructor");
-    rtc::WebSocketServerConfiguration wsServerConf = {
-        .port = port,
-        .enableTls = false,
+
+    // The offer depends on them
+    this->constraints = config.constraints;
+    this->encodingProfile = config.encoding_profile;
+
+    this->createPeerConnection();
+}
+
+WebRTCConnection::~WebRTCConnection() {
+    this->peerConnection->close();
+    this->setCapture("");
+}
+
+/**
+ * The lowest H.264 level (as level_idc) that allows the video that the
+ * constraints let through, so that the browser does not send more than we
+ * asked for. Never below 3.1, which is what browsers offer by default.
+ */
+static uint8_t h264_level(const webrtc_capture_constraints &c) {
+    // Table A-1 of H.264: the maximum frame size in macroblocks and the
+    // maximum macroblocks per second
+    static const struct {
+        uint8_t level;
+        uint32_t maxFrameSize;
+        uint32_t maxMacroblockRate;
+    } levels[] = {
+        {31, 3600, 108000},
+        {32, 5120, 216000},
+        {40, 8192, 245760},
+        {42, 8704, 522240},
+        {50, 22080, 589824},
+        {51, 36864, 983040},
     };
+    const uint8_t highestLevel = 52;
 
-    this->wsServer = std::make_shared<rtc::WebSocketServer>(wsServerConf);
-    this->wsServer->onClient([this](std::shared_ptr<rtc::WebSocket> socket) {
-        this->onSocket(socket);
-    });
+    if (c.max_width == 0 || c.max_height == 0 || c.max_framerate == 0) {
+        return highestLevel;
+    }
+
+    uint64_t frameSize =
+        (uint64_t) ((c.max_width + 15) / 16) * ((c.max_height + 15) / 16);
+    uint64_t macroblockRate = frameSize * c.max_framerate;
+
+    for (const auto &level : levels) {
+        if (frameSize <= level.maxFrameSize
+            && macroblockRate <= level.maxMacroblockRate) {
+            return level.level;
+        }
+    }
 
-    this->peerConnection = std::make_shared<rtc::PeerConnection>();
-    this->peerConnection->onGatheringStateChange(
+    return highestLevel;
+}
+
+void WebRTCConnection::createPeerConnection() {
+    webrtc_codec_policy policy;
+    uint8_t level;
+    {
+        std::lock_guard lock(this->mutex);
+        policy = this->encodingProfile.codec_policy;
+        level = h264_level(this->constraints);
+        this->offeredPolicy = policy;
+        this->offeredLevel = level;
+    }
+
+    rtc::Configuration config;
+    config.enableIceUdpMux = ice_config.udp_mux;
+    if (ice_config.port_range_begin != 0) {
+        config.portRangeBegin = ice_config.port_range_begin;
+    }
+    if (ice_config.port_range_end != 0) {
+        config.portRangeEnd = ice_config.port_range_end;
+    }
+
+    auto peerConnection = std::make_shared<rtc::PeerConnection>(config);
+    peerConnection->onGatheringStateChange(
         [this](rtc::PeerConnection::GatheringState state) {
             if (state == rtc::PeerConnection::GatheringState::Complete) {
                 this->sendLocalDescription();
@@ -75,60 +359,530 @@ WebRTCConnection::WebRTCConnection(uint16_t port) {
         rtc::Description::Direction::RecvOnly
     );
 
-    media.addH264Codec(96);
-    media.setBitrate(9000);
+    // Browsers send the first profile that they support, so the order is
+    // what decides it. Only packetization mode 1 is offered, since mode 0
+    // needs a packet per NAL unit, which slices large frames.
+    char levelHex[3];
+    snprintf(levelHex, sizeof(levelHex), "%02x", level);
+
+    std::vector<const OfferedCodec *> codecs;
+    for (const auto &codec : h264_codecs) {
+        codecs.push_back(&codec);
+    }
+    if (policy == WEBRTC_CODEC_POLICY_QUALITY) {
+        std::reverse(codecs.begin(), codecs.end());
+    }
+
+    for (const OfferedCodec *codec : codecs) {
+        media.addH264Codec(
+            codec->payloadType,
+            std::string("level-asymmetry-allowed=1;packetization-mode=1;")
+                + "profile-level-id=" + codec->profileIop + levelHex
+        );
+    }
+
+    // Forward error correction, so that lost packets can be repaired without
+    // waiting a round trip for a retransmission or a keyframe. Browsers send
+    // ULPFEC inside RED, and FlexFEC on a stream of its own.
+    media.addRtpMap(rtc::Description::Media::RtpMap(
+        std::to_string(WEBRTC_PAYLOAD_TYPE_RED) + " red/90000"
+    ));
+    media.addRtpMap(rtc::Description::Media::RtpMap(
+        std::to_string(WEBRTC_PAYLOAD_TYPE_ULPFEC) + " ulpfec/90000"
+    ));
+    rtc::Description::Media::RtpMap flexfec(
+        std::to_string(WEBRTC_PAYLOAD_TYPE_FLEXFEC) + " flexfec-03/90000"
+    );
+    flexfec.addParameter("repair-window=10000000");
+    media.addRtpMap(flexfec);
+
+    // Retransmissions on a stream of their own, so that they do not mess up
+    // the statistics of the video
+    for (const OfferedCodec *codec : codecs) {
+        rtc::Description::Media::RtpMap rtx(
+            std::to_string(codec->rtxPayloadType) + " rtx/90000"
+        );
+        rtx.addParameter("apt=" + std::to_string(codec->payloadType));
+        media.addRtpMap(rtx);
+    }
+
+    media.setBitrate(VIDEO_BITRATE);
+
+    auto videoTrack = peerConnection->addTrack(media);
 
-    this->videoTrack = this->peerConnection->addTrack(media);
+    auto session = std::make_shared<ReceivingSession>(
+        [this](const uint8_t *data, size_t len) {
+            this->onRtcpPacket(data, len);
+        }
+    );
+    videoTrack->setMediaHandler(session);
 
-    this->session = std::make_shared<rtc::RtcpReceivingSession>();
-    this->videoTrack->setMediaHandler(this->session);
+    videoTrack->onOpen([this, weakTrack = std::weak_ptr(videoTrack)]() {
+        auto videoTrack = weakTrack.lock();
+        if (videoTrack && !this->active) {
+            videoTrack->requestBitrate(PAUSED_BITRATE);
+        }
+    });
 
-    this->videoTrack->onMessage(
+    videoTrack->onMessage(
         [this](rtc::binary message) {
-            this->videoCallback(
-                (uint8_t *) message.data(),
-                message.size(),
-                this->videoCallbackData
-            );
+            this->onVideoPacket(message);
         },
         nullptr
     );
 
-    this->peerConnection->setLocalDescription(rtc::Description::Type::Offer);
+    {
+        std::lock_guard lock(this->mutex);
+        this->peerConnection = peerConnection;
+        this->videoTrack = videoTrack;
+        this->session = session;
+    }
+
+    // Outside of the lock, since gathering may complete synchronously
+    peerConnection->setLocalDescription(rtc::Description::Type::Offer);
+}
+
+void WebRTCConnection::renewOffer() {
+    std::lock_guard negotiation(this->negotiationMutex);
+
+    std::shared_ptr<rtc::PeerConnection> oldPeerConnection;
+    {
+        std::lock_guard lock(this->mutex);
+        if (this->clientReady) return;
+
+        if (this->offeredPolicy == this->encodingProfile.codec_policy
+            && this->offeredLevel == h264_level(this->constraints)) {
+            return;
+        }
+        oldPeerConnection = this->peerConnection;
+    }
+
+    obs_log(LOG_INFO, "Renewing the offer for the changed settings");
+    oldPeerConnection->close();
+    this->createPeerConnection();
+}
+
+void WebRTCConnection::onVideoPacket(const rtc::binary &message) {
+    uint64_t trace = trace_begin();
+
+    {
+        std::lock_guard lock(this->captureMutex);
+        if (this->capture) {
+            rtpdump_writer_write(
+                this->capture,
+                (const uint8_t *) message.data(),
+                message.size(),
+                false
+            );
+        }
+    }
+
+    // Nobody is looking, so there is no point in decoding. The packet still
+    // shows up in the trace, as dropped.
+    if (!this->active) {
+        trace_end("drop", trace);
+        return;
+    }
+
+    this->videoCallback(
+        (uint8_t *) message.data(),
+        message.size(),
+        this->videoCallbackData
+    );
+
+    trace_end("receive", trace);
+}
+
+void WebRTCConnection::onRtcpPacket(const uint8_t *data, size_t len) {
+    {
+        std::lock_guard lock(this->captureMutex);
+        if (this->capture) {
+            rtpdump_writer_write(this->capture, data, len, true);
+        }
+    }
+
+    if (!this->senderReportCallback) return;
+
+    uint64_t ntpTimestamp;
+    uint32_t rtpTimestamp;
+    if (rtcp_find_sender_report(data, len, &ntpTimestamp, &rtpTimestamp)) {
+        this->senderReportCallback(
+            ntpTimestamp,
+            rtpTimestamp,
+            this->senderReportCallbackData
+        );
+    }
+}
+
+void WebRTCConnection::setCapture(const std::string &path) {
+    rtpdump_writer *capture = nullptr;
+    if (!path.empty()) {
+        capture = rtpdump_writer_open(path.c_str());
+    }
+
+    std::lock_guard lock(this->captureMutex);
+    rtpdump_writer_close(&this->capture);
+    this->capture = capture;
+}
+
+void WebRTCConnection::requestKeyframe() {
+    std::shared_ptr<rtc::Track> videoTrack;
+    {
+        std::lock_guard lock(this->mutex);
+        videoTrack = this->videoTrack;
+    }
+
+    if (videoTrack->isOpen()) {
+        videoTrack->requestKeyframe();
+    }
+}
+
+void WebRTCConnection::sendNack(
+    uint32_t ssrc,
+    const uint16_t *sequenceNumbers,
+    size_t count
+) {
+    std::shared_ptr<ReceivingSession> session;
+    {
+        std::lock_guard lock(this->mutex);
+        session = this->session;
+    }
+
+    // Header, SSRCs and at most one entry per sequence number
+    std::vector<uint8_t> buffer(12 + count * 4);
+    size_t len = rtcp_write_nack(
+        buffer.data(),
+        buffer.size(),
+        FEEDBACK_SSRC,
+        ssrc,
+        sequenceNumbers,
+        count
+    );
+
+    if (len > 0) {
+        session->sendRtcp(buffer.data(), len);
+    }
+}
+
+void WebRTCConnection::sendSignal(const std::string &message) {
+    if (this->signalCallback) {
+        this->signalCallback(message.c_str(), this->signalCallbackData);
+    }
+}
+
+/**
+ * Escapes a string so that it can be placed inside a JSON string literal.
+ */
+static std::string json_escape(const std::string &str) {
+    std::string escaped;
+    escaped.reserve(str.size());
+
+    for (char c : str) {
+        switch (c) {
+            case '"': escaped += "\\\""; break;
+            case '\\': escaped += "\\\\"; break;
+            case '\n': escaped += "\\n"; break;
+            case '\r': escaped += "\\r"; break;
+            case '\t': escaped += "\\t"; break;
+            default:
+                if ((unsigned char) c < 0x20) {
+                    char buf[7];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    escaped += buf;
+                } else {
+                    escaped += c;
+                }
+        }
+    }
+
+    return escaped;
+}
+
+static std::string constraints_to_json(const webrtc_capture_constraints &c) {
+    return "{\"maxWidth\":" + std::to_string(c.max_width)
+        + ",\"maxHeight\":" + std::to_string(c.max_height)
+        + ",\"maxFramerate\":" + std::to_string(c.max_framerate)
+        + "}";
+}
+
+/**
+ * Describes the encoding profile in the terms of the WebRTC API, for the
+ * client page to apply as is. Settings that are left to the browser are
+ * empty.
+ */
+static std::string encoding_profile_to_json(const webrtc_encoding_profile &p) {
+    const char *contentHint = "";
+    const char *degradationPreference = "";
+    switch (p.content_type) {
+        case WEBRTC_CONTENT_SCREEN:
+            contentHint = "detail";
+            degradationPreference = "maintain-resolution";
+            break;
+        case WEBRTC_CONTENT_CAMERA:
+            contentHint = "motion";
+            degradationPreference = "maintain-framerate";
+            break;
+        case WEBRTC_CONTENT_AUTO:
+            break;
+    }
+
+    // The profile_idc of profile-level-id (RFC 6184)
+    const char *h264Profile = "";
+    switch (p.h264_profile) {
+        case WEBRTC_H264_PROFILE_CONSTRAINED_BASELINE: h264Profile = "42"; break;
+        case WEBRTC_H264_PROFILE_MAIN: h264Profile = "4d"; break;
+        case WEBRTC_H264_PROFILE_HIGH: h264Profile = "64"; break;
+        case WEBRTC_H264_PROFILE_ANY: break;
+    }
+
+    return std::string("{\"contentHint\":\"") + contentHint + "\""
+        + ",\"degradationPreference\":\"" + degradationPreference + "\""
+        + ",\"maxBitrate\":" + std::to_string((uint64_t) p.max_bitrate * 1000)
+        + ",\"h264Profile\":\"" + h264Profile + "\""
+        + "}";
+}
+
+/**
+ * Looks for a format parameter of a payload type in an SDP.
+ *
+ * @return The value, or an empty string if there is none.
+ */
+static std::string find_fmtp_parameter(
+    const std::string &sdp,
+    int payloadType,
+    const std::string &parameter
+) {
+    const std::string fmtp = "a=fmtp:" + std::to_string(payloadType) + " ";
+    const std::string name = parameter + "=";
+
+    size_t line = sdp.find(fmtp);
+    while (line != std::string::npos) {
+        size_t line_end = sdp.find_first_of("\r\n", line);
+        size_t param = sdp.find(name, line);
+        if (param != std::string::npos && param < line_end) {
+            size_t start = param + name.size();
+            size_t end = sdp.find_first_of(";\r\n", start);
+            return sdp.substr(start, end == std::string::npos ? end : end - start);
+        }
+
+        line = sdp.find(fmtp, line + 1);
+    }
+
+    return "";
+}
+
+/**
+ * Finds the codec of the video in an answer, which is the first payload type
+ * of its media line.
+ *
+ * @return The codec, with a payload type of 0 if the video was rejected.
+ */
+static webrtc_negotiated_codec find_negotiated_codec(const std::string &sdp) {
+    webrtc_negotiated_codec codec = {};
+
+    size_t line = sdp.find("m=video ");
+    if (line == std::string::npos) return codec;
+
+    // m=video <port> <protocol> <payload types>
+    int port, payloadType;
+    char protocol[32];
+    int matched = sscanf(
+        sdp.c_str() + line,
+        "m=video %d %31s %d",
+        &port,
+        protocol,
+        &payloadType
+    );
+    if (matched != 3 || port == 0 || payloadType <= 0 || payloadType > 127) {
+        return codec;
+    }
+
+    codec.payload_type = payloadType;
+    for (const auto &offered : h264_codecs) {
+        if (offered.payloadType == payloadType) {
+            codec.profile = offered.profile;
+        }
+    }
+
+    std::string profileLevelId =
+        find_fmtp_parameter(sdp, payloadType, "profile-level-id");
+    if (profileLevelId.size() == 6) {
+        codec.level = strtoul(profileLevelId.substr(4).c_str(), nullptr, 16);
+    }
+
+    codec.packetization_mode =
+        find_fmtp_parameter(sdp, payloadType, "packetization-mode") == "1";
+
+    return codec;
 }
 
 bool WebRTCConnection::sendLocalDescription() {
-    auto description = this->peerConnection->localDescription();
-    if (this->clientReady && description.has_value()) {
-        this->activeSocket->send(description.value());
-        return true;
+    std::string message;
+
+    {
+        std::lock_guard lock(this->mutex);
+
+        auto description = this->peerConnection->localDescription();
+        if (!this->clientReady || !description.has_value()) {
+            return false;
+        }
+
+        std::string sdp = description.value();
+        message = "{\"type\":\"offer\",\"sdp\":\"" + json_escape(sdp) + "\","
+            "\"constraints\":" + constraints_to_json(this->constraints) + ","
+            "\"encoding\":" + encoding_profile_to_json(this->encodingProfile) + ","
+            "\"paused\":" + (this->active ? "false" : "true") + "}";
+    }
+
+    // Never call out while holding the lock, the signaling transport has
+    // locks of its own
+    this->sendSignal(message);
+    return true;
+}
+
+void WebRTCConnection::setCaptureConstraints(
+    const webrtc_capture_constraints &newConstraints
+) {
+    std::string message;
+
+    {
+        std::lock_guard lock(this->mutex);
+
+        this->constraints = newConstraints;
+        if (this->clientReady) {
+            message = "{\"type\":\"constraints\",\"constraints\":"
+                + constraints_to_json(this->constraints) + "}";
+        }
+    }
+
+    if (message.empty()) {
+        // The level of the offer follows the constraints
+        this->renewOffer();
     } else {
-        return false;
+        this->sendSignal(message);
     }
 }
 
-void WebRTCConnection::onSocket(std::shared_ptr<rtc::WebSocket> socket) {
-    if (this->activeSocket == nullptr) {
-        this->activeSocket = socket;
-        socket->onMessage([this](rtc::message_variant data) {
-            this->onMessage(data);
-        });
+void WebRTCConnection::setEncodingProfile(
+    const webrtc_encoding_profile &newProfile
+) {
+    std::string message;
+
+    {
+        std::lock_guard lock(this->mutex);
+
+        this->encodingProfile = newProfile;
+        if (this->clientReady) {
+            message = "{\"type\":\"encoding\",\"encoding\":"
+                + encoding_profile_to_json(this->encodingProfile) + "}";
+        }
+    }
+
+    if (message.empty()) {
+        this->renewOffer();
     } else {
-        socket->close();
+        this->sendSignal(message);
     }
 }
 
-void WebRTCConnection::onMessage(rtc::message_variant data) {
-    if (std::holds_alternative<std::string>(data)) {
-        std::string strData = std::get<std::string>(data);
-        obs_log(LOG_INFO, "%s", strData.c_str());
-        if (strData == "ready") {
+bool WebRTCConnection::getNegotiatedCodec(webrtc_negotiated_codec &codec) {
+    std::lock_guard lock(this->mutex);
+    codec = this->negotiatedCodec;
+    return codec.payload_type != 0;
+}
+
+void WebRTCConnection::onMessage(const std::string &message) {
+    obs_log(LOG_INFO, "%s", message.c_str());
+    if (message == "ready") {
+        {
+            std::lock_guard negotiation(this->negotiationMutex);
+            std::lock_guard lock(this->mutex);
             this->clientReady = true;
-            this->sendLocalDescription();
+        }
+        this->sendLocalDescription();
+    } else {
+        std::shared_ptr<rtc::PeerConnection> peerConnection;
+        {
+            std::lock_guard lock(this->mutex);
+            peerConnection = this->peerConnection;
+        }
+
+        rtc::Description answer (message, "answer");
+        peerConnection->setRemoteDescription(answer);
+
+        webrtc_negotiated_codec codec = find_negotiated_codec(message);
+        {
+            std::lock_guard lock(this->mutex);
+            this->negotiatedCodec = codec;
+        }
+
+        if (codec.payload_type == 0) {
+            obs_log(LOG_WARNING, "The client did not accept any video codec");
         } else {
-            rtc::Description answer (strData, "answer");
-            this->peerConnection->setRemoteDescription(answer);
+            obs_log(LOG_INFO,
+                "Negotiated H.264 %s, level %d.%d, packetization mode %d",
+                webrtc_h264_profile_name(codec.profile),
+                codec.level / 10, codec.level % 10,
+                codec.packetization_mode);
         }
+
+        std::string sprop = find_fmtp_parameter(
+            message,
+            codec.payload_type,
+            "sprop-parameter-sets"
+        );
+        if (!sprop.empty() && this->parameterSetsCallback) {
+            this->parameterSetsCallback(
+                sprop.c_str(),
+                this->parameterSetsCallbackData
+            );
+        }
+    }
+}
+
+void WebRTCConnection::onClientDisconnected() {
+    std::lock_guard negotiation(this->negotiationMutex);
+
+    std::shared_ptr<rtc::PeerConnection> oldPeerConnection;
+    {
+        std::lock_guard lock(this->mutex);
+        this->clientReady = false;
+        this->negotiatedCodec = {};
+        oldPeerConnection = this->peerConnection;
+    }
+
+    // A peer connection cannot be renegotiated from scratch, so the next
+    // client gets a new one
+    oldPeerConnection->close();
+    this->createPeerConnection();
+}
+
+void WebRTCConnection::setActive(bool active) {
+    if (this->active.exchange(active) == active) return;
+
+    std::shared_ptr<rtc::Track> videoTrack;
+    bool clientReady;
+    {
+        std::lock_guard lock(this->mutex);
+        videoTrack = this->videoTrack;
+        clientReady = this->clientReady;
+    }
+
+    if (clientReady) {
+        this->sendSignal(active
+            ? "{\"type\":\"resume\"}"
+            : "{\"type\":\"pause\"}"
+        );
+    }
+
+    if (!videoTrack->isOpen()) return;
+
+    if (active) {
+        videoTrack->requestBitrate(VIDEO_BITRATE * 1000);
+        // Decoding starts from scratch, so it has to wait for a keyframe
+        videoTrack->requestKeyframe();
+    } else {
+        videoTrack->requestBitrate(PAUSED_BITRATE);
     }
 }
 
@@ -154,21 +908,83 @@ static void webrtc_log_callback(rtc::LogLevel level, std::string message) {
     }
 }
 
+/**
+ * @return The log level with the given name, or Warning if it is unknown.
+ */
+static rtc::LogLevel webrtc_log_level(const char *name) {
+    static const struct {
+        const char *name;
+        rtc::LogLevel level;
+    } levels[] = {
+        {"none", rtc::LogLevel::None},
+        {"fatal", rtc::LogLevel::Fatal},
+        {"error", rtc::LogLevel::Error},
+        {"warning", rtc::LogLevel::Warning},
+        {"info", rtc::LogLevel::Info},
+        {"debug", rtc::LogLevel::Debug},
+        {"verbose", rtc::LogLevel::Verbose},
+    };
+
+    for (const auto &level : levels) {
+        if (strcmp(name, level.name) == 0) return level.level;
+    }
+
+    obs_log(LOG_WARNING, "Unknown log level %s, using warning", name);
+    return rtc::LogLevel::Warning;
+}
+
+const char* webrtc_h264_profile_name(enum webrtc_h264_profile profile) {
+    switch (profile) {
+        case WEBRTC_H264_PROFILE_CONSTRAINED_BASELINE:
+            return "constrained_baseline";
+        case WEBRTC_H264_PROFILE_MAIN: return "main";
+        case WEBRTC_H264_PROFILE_HIGH: return "high";
+        case WEBRTC_H264_PROFILE_ANY: break;
+    }
+    return "unknown";
+}
+
+void webrtc_init(const char *log_level, const webrtc_ice_config *ice) {
+    // Every message goes through the OBS log, which is slow, so debug
+    // messages are only for when something is being investigated
+    rtc::InitLogger(webrtc_log_level(log_level), webrtc_log_callback);
+
+    ice_config = ice ? *ice : webrtc_ice_config {};
+    if (ice_config.port_range_end != 0
+        && ice_config.port_range_begin > ice_config.port_range_end) {
+        obs_log(LOG_WARNING, "Invalid port range %d-%d, using any port",
+            ice_config.port_range_begin, ice_config.port_range_end);
+        ice_config.port_range_begin = 0;
+        ice_config.port_range_end = 0;
+    }
+
+    if (ice_config.udp_mux) {
+        obs_log(LOG_INFO, "All peer connections share a single UDP port");
+    }
+
+    // Start libdatachannel's thread pool once, for all the sources
+    rtc::Preload();
+}
+
+void webrtc_shutdown(void) {
+    // The thread pool may still be running callbacks into the plugin, which
+    // must be done before the module is unloaded
+    auto cleanup = rtc::Cleanup();
+    if (cleanup.wait_for(CLEANUP_TIMEOUT) != std::future_status::ready) {
+        obs_log(LOG_ERROR, "libdatachannel did not shut down in time");
+    }
+}
+
 struct webrtc_connection *webrtc_connection_create(
     webrtc_connection_config *config
 ) {
-    rtc::InitLogger(rtc::LogLevel::Debug, webrtc_log_callback);
-
     WebRTCConnection *connection;
     try {
-        connection = new WebRTCConnection(config->port);
+        connection = new WebRTCConnection(*config);
     } catch (std::runtime_error e) {
         return NULL;
     };
 
-    connection->videoCallback = config->video_callback;
-    connection->videoCallbackData = config->video_callback_data;
-
     return (struct webrtc_connection *) connection;
 }
 
@@ -176,4 +992,65 @@ void webrtc_connection_delete(struct webrtc_connection **pconn) {
     WebRTCConnection *conn = (WebRTCConnection*) *pconn;
     delete conn;
     *pconn = nullptr;
-}
\ No newline at end of file
+}
+
+void webrtc_connection_set_capture_constraints(
+    struct webrtc_connection *conn,
+    const struct webrtc_capture_constraints *constraints
+) {
+    ((WebRTCConnection *) conn)->setCaptureConstraints(*constraints);
+}
+
+void webrtc_connection_set_encoding_profile(
+    struct webrtc_connection *conn,
+    const struct webrtc_encoding_profile *profile
+) {
+    ((WebRTCConnection *) conn)->setEncodingProfile(*profile);
+}
+
+bool webrtc_connection_get_negotiated_codec(
+    struct webrtc_connection *conn,
+    struct webrtc_negotiated_codec *codec
+) {
+    return ((WebRTCConnection *) conn)->getNegotiatedCodec(*codec);
+}
+
+void webrtc_connection_handle_message(
+    struct webrtc_connection *conn,
+    const char *message
+) {
+    try {
+        ((WebRTCConnection *) conn)->onMessage(message);
+    } catch (const std::exception &e) {
+        // Do not let a malformed message from a client take OBS down
+        obs_log(LOG_ERROR, "Invalid signaling message: %s", e.what());
+    }
+}
+
+void webrtc_connection_client_disconnected(struct webrtc_connection *conn) {
+    ((WebRTCConnection *) conn)->onClientDisconnected();
+}
+
+void webrtc_connection_set_active(struct webrtc_connection *conn, bool active) {
+    ((WebRTCConnection *) conn)->setActive(active);
+}
+
+void webrtc_connection_set_capture(
+    struct webrtc_connection *conn,
+    const char *path
+) {
+    ((WebRTCConnection *) conn)->setCapture(path ? path : "");
+}
+
+void webrtc_connection_send_nack(
+    struct webrtc_connection *conn,
+    uint32_t ssrc,
+    const uint16_t *sequence_numbers,
+    size_t count
+) {
+    ((WebRTCConnection *) conn)->sendNack(ssrc, sequence_numbers, count);
+}
+
+void webrtc_connection_request_keyframe(struct webrtc_connection *conn) {
+    ((WebRTCConnection *) conn)->requestKeyframe();
+}
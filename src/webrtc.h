@@ -15,6 +15,7 @@ GNU General Public License for more details.
 You should have received a copy of the GNU General Public License along
 with this program. If not, see <https://www.gnu.org/licenses/>
 */
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -22,22 +23,256 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 extern "C" {
 #endif
 
+// The payload types of the video that are offered to the client. Every
+// H.264 profile has a payload type of its own, with one for its
+// retransmissions.
+#define WEBRTC_PAYLOAD_TYPE_H264 96
+#define WEBRTC_PAYLOAD_TYPE_RED 97
+#define WEBRTC_PAYLOAD_TYPE_ULPFEC 98
+#define WEBRTC_PAYLOAD_TYPE_FLEXFEC 99
+#define WEBRTC_PAYLOAD_TYPE_RTX 100
+#define WEBRTC_PAYLOAD_TYPE_H264_MAIN 101
+#define WEBRTC_PAYLOAD_TYPE_RTX_MAIN 102
+#define WEBRTC_PAYLOAD_TYPE_H264_HIGH 103
+#define WEBRTC_PAYLOAD_TYPE_RTX_HIGH 104
+
 struct webrtc_connection;
 
 typedef void (*webrtc_video_callback_t)(uint8_t *buffer, size_t len, void *data);
 
+/**
+ * Sends a signaling message to the client. The transport is up to the caller.
+ */
+typedef void (*webrtc_signal_callback_t)(const char *message, void *data);
+
+/**
+ * Called for every RTCP sender report of the video, with the sender's wall
+ * clock in the NTP format and the RTP timestamp it corresponds to.
+ */
+typedef void (*webrtc_sender_report_callback_t)(
+    uint64_t ntp_timestamp,
+    uint32_t rtp_timestamp,
+    void *data
+);
+
+/**
+ * Called when the client's answer gives the SPS and PPS of the video in
+ * advance, with the value of its sprop-parameter-sets (RFC 6184).
+ */
+typedef void (*webrtc_parameter_sets_callback_t)(
+    const char *sprop_parameter_sets,
+    void *data
+);
+
+/**
+ * Limits on the captured video that the client is asked to respect, so that
+ * the browser does not send more pixels than we are going to display.
+ *
+ * A value of 0 means no limit.
+ */
+struct webrtc_capture_constraints {
+    uint32_t max_width;
+    uint32_t max_height;
+    uint32_t max_framerate;
+};
+
+/**
+ * What the video shows, which tells the browser's encoder what to keep when
+ * the bandwidth runs short.
+ */
+enum webrtc_content_type {
+    // The browser decides
+    WEBRTC_CONTENT_AUTO,
+    // Screens and slides: sharp detail, at the cost of frame rate
+    WEBRTC_CONTENT_SCREEN,
+    // Cameras: smooth motion, at the cost of resolution
+    WEBRTC_CONTENT_CAMERA,
+};
+
+// WEBRTC_PAYLOAD_TYPE_H264 carries Constrained Baseline
+enum webrtc_h264_profile {
+    WEBRTC_H264_PROFILE_ANY,
+    WEBRTC_H264_PROFILE_CONSTRAINED_BASELINE,
+    WEBRTC_H264_PROFILE_MAIN,
+    WEBRTC_H264_PROFILE_HIGH,
+};
+
+/**
+ * The order in which the H.264 profiles are offered. Browsers send the first
+ * one that their encoder supports.
+ */
+enum webrtc_codec_policy {
+    // Constrained Baseline, Main, High: the cheapest to decode first
+    WEBRTC_CODEC_POLICY_DECODE_COST,
+    // High, Main, Constrained Baseline: the best quality per bit first
+    WEBRTC_CODEC_POLICY_QUALITY,
+};
+
+/**
+ * How the client is asked to encode the video.
+ */
+struct webrtc_encoding_profile {
+    enum webrtc_content_type content_type;
+    // In kbit/s, 0 for the browser's default
+    uint32_t max_bitrate;
+    // The H.264 profile the client prefers, if it offers several
+    enum webrtc_h264_profile h264_profile;
+    // Changing it only affects the next client, the current one keeps what
+    // it negotiated
+    enum webrtc_codec_policy codec_policy;
+};
+
+/**
+ * The video codec that the client's answer settled on.
+ */
+struct webrtc_negotiated_codec {
+    uint8_t payload_type;
+    // ANY if the payload type is not one of ours
+    enum webrtc_h264_profile profile;
+    // The level_idc of the answer, e.g. 31 for level 3.1, 0 if not given
+    uint8_t level;
+    // 1 if NAL units can be fragmented and aggregated, 0 if every packet
+    // carries a single one
+    uint8_t packetization_mode;
+};
+
+/**
+ * The local UDP ports of the peer connections.
+ */
+struct webrtc_ice_config {
+    // Whether all the peer connections share a single UDP socket, which
+    // tells them apart by their ICE credentials
+    bool udp_mux;
+    // The range that the ports are taken from, 0 for any
+    uint16_t port_range_begin;
+    uint16_t port_range_end;
+};
+
 struct webrtc_connection_config {
-    uint16_t port;
     webrtc_video_callback_t video_callback;
     void *video_callback_data;
+    webrtc_signal_callback_t signal_callback;
+    void *signal_callback_data;
+    webrtc_sender_report_callback_t sender_report_callback;
+    void *sender_report_callback_data;
+    webrtc_parameter_sets_callback_t parameter_sets_callback;
+    void *parameter_sets_callback_data;
+    struct webrtc_capture_constraints constraints;
+    struct webrtc_encoding_profile encoding_profile;
 };
 
+/**
+ * Initializes libdatachannel. Called once when the module is loaded, so that
+ * all the connections share its logger, its thread pool and their ports.
+ *
+ * @param log_level The least severe messages of libdatachannel that are
+ * logged: "none", "fatal", "error", "warning", "info", "debug" or "verbose".
+ * @param ice The ports of the connections, or NULL to give every connection
+ * a port of its own from any that are free.
+ */
+void webrtc_init(const char *log_level, const struct webrtc_ice_config *ice);
+
+/**
+ * Shuts down libdatachannel. All connections must have been deleted.
+ */
+void webrtc_shutdown(void);
+
+/**
+ * @return The name of an H.264 profile as in the source settings, e.g.
+ * "main", or "unknown" for WEBRTC_H264_PROFILE_ANY.
+ */
+const char* webrtc_h264_profile_name(enum webrtc_h264_profile profile);
+
 struct webrtc_connection* webrtc_connection_create(
     struct webrtc_connection_config *config
 );
 
 void webrtc_connection_delete(struct webrtc_connection **);
 
+/**
+ * Handles a signaling message received from the client.
+ */
+void webrtc_connection_handle_message(
+    struct webrtc_connection *conn,
+    const char *message
+);
+
+/**
+ * Notifies the connection that the signaling channel to the client was
+ * closed, so that it gets ready for a new client.
+ */
+void webrtc_connection_client_disconnected(struct webrtc_connection *conn);
+
+/**
+ * Changes the capture constraints of the connection. If a client is connected,
+ * the new constraints are sent to it immediately. They also set the H.264
+ * level that is offered to the next client.
+ */
+void webrtc_connection_set_capture_constraints(
+    struct webrtc_connection *conn,
+    const struct webrtc_capture_constraints *constraints
+);
+
+/**
+ * Changes the encoding profile of the connection. If a client is connected,
+ * the new profile is sent to it immediately.
+ */
+void webrtc_connection_set_encoding_profile(
+    struct webrtc_connection *conn,
+    const struct webrtc_encoding_profile *profile
+);
+
+/**
+ * Gets the codec that the current client negotiated.
+ *
+ * @return false if no client has answered yet.
+ */
+bool webrtc_connection_get_negotiated_codec(
+    struct webrtc_connection *conn,
+    struct webrtc_negotiated_codec *codec
+);
+
+/**
+ * Sets whether the video is being used. While inactive, received video is
+ * dropped instead of being passed to the video callback, and the client is
+ * asked to pause sending, so that the connection stays up at almost no cost.
+ * When it becomes active again a keyframe is requested, so that decoding can
+ * resume right away.
+ */
+void webrtc_connection_set_active(struct webrtc_connection *conn, bool active);
+
+/**
+ * Starts capturing the received RTP and RTCP packets to an rtpdump file, for
+ * replaying them later with webrtc-replay. Any capture in progress is
+ * finished first.
+ *
+ * @param path The file to write, or NULL to stop capturing.
+ */
+void webrtc_connection_set_capture(
+    struct webrtc_connection *conn,
+    const char *path
+);
+
+/**
+ * Asks the client to retransmit lost packets of the video, with a generic
+ * NACK. Can be called from the video callback.
+ *
+ * @param ssrc The SSRC of the video.
+ * @param sequence_numbers The lost packets, in order.
+ */
+void webrtc_connection_send_nack(
+    struct webrtc_connection *conn,
+    uint32_t ssrc,
+    const uint16_t *sequence_numbers,
+    size_t count
+);
+
+/**
+ * Asks the client for a keyframe, e.g. to resume full decoding without
+ * waiting for the next regular one. Can be called from any thread.
+ */
+void webrtc_connection_request_keyframe(struct webrtc_connection *conn);
+
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
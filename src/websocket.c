@@ -0,0 +1,228 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#include "websocket.h"
+
+#include <string.h>
+
+static const char websocket_guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+static inline uint32_t rotl32(uint32_t value, int bits) {
+    return (value << bits) | (value >> (32 - bits));
+}
+
+static void sha1_block(uint32_t state[5], const uint8_t block[64]) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t) block[i*4] << 24) | ((uint32_t) block[i*4 + 1] << 16)
+            | ((uint32_t) block[i*4 + 2] << 8) | block[i*4 + 3];
+    }
+    for (int i = 16; i < 80; i++) {
+        w[i] = rotl32(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+
+        uint32_t temp = rotl32(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotl32(b, 30);
+        b = a;
+        a = temp;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+/**
+ * SHA-1 of a short message. Only used for the handshake, where the input is
+ * well below a hundred bytes.
+ */
+static void sha1(const uint8_t *data, size_t len, uint8_t digest[20]) {
+    uint32_t state[5] = {
+        0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+    };
+
+    size_t offset = 0;
+    for (; offset + 64 <= len; offset += 64) {
+        sha1_block(state, data + offset);
+    }
+
+    // Padding: 0x80, zeros, and the message length in bits
+    uint8_t tail[128] = {0};
+    size_t remaining = len - offset;
+    memcpy(tail, data + offset, remaining);
+    tail[remaining] = 0x80;
+
+    size_t tail_len = remaining + 9 <= 64 ? 64 : 128;
+    uint64_t bit_len = (uint64_t) len * 8;
+    for (int i = 0; i < 8; i++) {
+        tail[tail_len - 1 - i] = (uint8_t) (bit_len >> (i * 8));
+    }
+
+    for (size_t i = 0; i < tail_len; i += 64) {
+        sha1_block(state, tail + i);
+    }
+
+    for (int i = 0; i < 5; i++) {
+        digest[i*4] = state[i] >> 24;
+        digest[i*4 + 1] = state[i] >> 16;
+        digest[i*4 + 2] = state[i] >> 8;
+        digest[i*4 + 3] = state[i];
+    }
+}
+
+static void base64_encode(const uint8_t *data, size_t len, char *out) {
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    size_t i;
+    for (i = 0; i + 2 < len; i += 3) {
+        uint32_t triple = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+        *out++ = alphabet[(triple >> 18) & 0x3f];
+        *out++ = alphabet[(triple >> 12) & 0x3f];
+        *out++ = alphabet[(triple >> 6) & 0x3f];
+        *out++ = alphabet[triple & 0x3f];
+    }
+
+    if (i < len) {
+        uint32_t triple = data[i] << 16;
+        if (i + 1 < len) triple |= data[i + 1] << 8;
+
+        *out++ = alphabet[(triple >> 18) & 0x3f];
+        *out++ = alphabet[(triple >> 12) & 0x3f];
+        *out++ = i + 1 < len ? alphabet[(triple >> 6) & 0x3f] : '=';
+        *out++ = '=';
+    }
+
+    *out = '\0';
+}
+
+void websocket_accept_key(
+    const char *key,
+    char accept[WEBSOCKET_ACCEPT_KEY_SIZE]
+) {
+    uint8_t input[128];
+    size_t key_len = strnlen(key, sizeof(input) - sizeof(websocket_guid));
+
+    memcpy(input, key, key_len);
+    memcpy(input + key_len, websocket_guid, sizeof(websocket_guid) - 1);
+
+    uint8_t digest[20];
+    sha1(input, key_len + sizeof(websocket_guid) - 1, digest);
+
+    base64_encode(digest, sizeof(digest), accept);
+}
+
+long websocket_parse_frame(
+    uint8_t *buffer,
+    size_t len,
+    size_t max_payload_len,
+    struct websocket_frame *frame
+) {
+    if (len < 2) return 0;
+
+    frame->fin = buffer[0] >> 7;
+    frame->opcode = buffer[0] & 0x0f;
+
+    // Reserved bits are only used by extensions, which we do not negotiate
+    if (buffer[0] & 0x70) return -1;
+
+    bool masked = buffer[1] >> 7;
+    if (!masked) return -1;
+
+    size_t header_len = 2;
+    uint64_t payload_len = buffer[1] & 0x7f;
+    if (payload_len == 126) {
+        header_len += 2;
+        if (len < header_len) return 0;
+        payload_len = ((uint64_t) buffer[2] << 8) | buffer[3];
+    } else if (payload_len == 127) {
+        header_len += 8;
+        if (len < header_len) return 0;
+        payload_len = 0;
+        for (int i = 0; i < 8; i++) {
+            payload_len = (payload_len << 8) | buffer[2 + i];
+        }
+    }
+
+    if (payload_len > max_payload_len) return -1;
+
+    // Control frames cannot be fragmented, and are short (RFC 6455 5.5)
+    if ((frame->opcode & 0x8)
+        && (!frame->fin
+            || payload_len > WEBSOCKET_MAX_CONTROL_PAYLOAD_SIZE)) {
+        return -1;
+    }
+
+    const uint8_t *mask = buffer + header_len;
+    header_len += 4;
+
+    if (len < header_len || len - header_len < payload_len) return 0;
+
+    frame->payload = buffer + header_len;
+    frame->payload_len = payload_len;
+
+    for (size_t i = 0; i < payload_len; i++) {
+        frame->payload[i] ^= mask[i & 3];
+    }
+
+    return header_len + payload_len;
+}
+
+size_t websocket_write_header(
+    uint8_t header[WEBSOCKET_MAX_HEADER_SIZE],
+    enum websocket_opcode opcode,
+    size_t payload_len
+) {
+    header[0] = 0x80 | opcode;
+
+    if (payload_len < 126) {
+        header[1] = payload_len;
+        return 2;
+    } else if (payload_len <= 0xffff) {
+        header[1] = 126;
+        header[2] = payload_len >> 8;
+        header[3] = payload_len;
+        return 4;
+    } else {
+        header[1] = 127;
+        for (int i = 0; i < 8; i++) {
+            header[9 - i] = (uint8_t) ((uint64_t) payload_len >> (i * 8));
+        }
+        return 10;
+    }
+}
@@ -0,0 +1,86 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Helpers for the server side of the WebSocket protocol (RFC 6455).
+ */
+
+#define WEBSOCKET_ACCEPT_KEY_SIZE 29
+#define WEBSOCKET_MAX_HEADER_SIZE 10
+// Control frames have to fit in the shortest header
+#define WEBSOCKET_MAX_CONTROL_PAYLOAD_SIZE 125
+
+enum websocket_opcode {
+    WEBSOCKET_OPCODE_CONTINUATION = 0x0,
+    WEBSOCKET_OPCODE_TEXT = 0x1,
+    WEBSOCKET_OPCODE_BINARY = 0x2,
+    WEBSOCKET_OPCODE_CLOSE = 0x8,
+    WEBSOCKET_OPCODE_PING = 0x9,
+    WEBSOCKET_OPCODE_PONG = 0xa,
+};
+
+struct websocket_frame {
+    bool fin;
+    enum websocket_opcode opcode;
+
+    // Points into the parsed buffer, which gets unmasked in place
+    uint8_t *payload;
+    size_t payload_len;
+};
+
+/**
+ * Computes the Sec-WebSocket-Accept value for a Sec-WebSocket-Key.
+ *
+ * @param accept Receives the null-terminated base64 value.
+ */
+void websocket_accept_key(
+    const char *key,
+    char accept[WEBSOCKET_ACCEPT_KEY_SIZE]
+);
+
+/**
+ * Parses a frame from the client. Client frames are always masked, and the
+ * payload is unmasked in place.
+ *
+ * @param max_payload_len Frames that declare a larger payload are invalid,
+ * which is known as soon as their header is in the buffer.
+ * @return The size of the frame, 0 if the buffer does not contain the whole
+ * frame yet, or -1 if the frame is invalid.
+ */
+long websocket_parse_frame(
+    uint8_t *buffer,
+    size_t len,
+    size_t max_payload_len,
+    struct websocket_frame *frame
+);
+
+/**
+ * Writes the header of an unmasked, unfragmented server frame.
+ *
+ * @return The size of the header.
+ */
+size_t websocket_write_header(
+    uint8_t header[WEBSOCKET_MAX_HEADER_SIZE],
+    enum websocket_opcode opcode,
+    size_t payload_len
+);
@@ -0,0 +1,404 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/*
+ * Writes frames with frame-ring and reads them back with frame-ring-reader:
+ * the round trip, the rejection of frames that are overwritten while they
+ * are read, the replacement of the object with a larger one, and the bounds
+ * that the reader checks in objects that it cannot trust.
+ *
+ * Usage: frame-ring-test
+ *
+ * Exits with 0 if all checks pass, run by CTest as "frame-ring".
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "frame-ring.h"
+#include "frame-ring-format.h"
+#include "frame-ring-reader.h"
+
+#define MAX_WIDTH 320
+#define MAX_HEIGHT 240
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", \
+            __FILE__, __LINE__, #condition); \
+        failures++; \
+    } \
+} while (0)
+
+static char ring_name[64];
+
+static uint8_t planes[3][MAX_WIDTH * MAX_HEIGHT];
+
+/**
+ * Writes a frame whose planes are filled with the low byte of the frame
+ * number, plus the index of the plane.
+ */
+static void write_frame(
+    struct frame_ring *ring,
+    uint32_t width,
+    uint32_t height,
+    uint64_t frame_number
+) {
+    AVFrame frame = {0};
+    frame.format = AV_PIX_FMT_YUV420P;
+    frame.width = width;
+    frame.height = height;
+
+    for (int plane = 0; plane < 3; plane++) {
+        memset(planes[plane], (uint8_t) (frame_number + plane),
+            sizeof(planes[plane]));
+        frame.data[plane] = planes[plane];
+        // Tighter than the ring's rows, which start on cache lines
+        frame.linesize[plane] = plane == 0 ? width : (width + 1) / 2;
+    }
+
+    frame_ring_write(ring, &frame, (uint32_t) frame_number * 3000);
+}
+
+/**
+ * @return Whether the frame has the size and the contents that write_frame
+ * gave it, in rows that start on cache lines.
+ */
+static bool frame_matches(
+    const struct frame_ring_frame *frame,
+    uint32_t width,
+    uint32_t height,
+    uint64_t frame_number
+) {
+    if (frame->frame_number != frame_number || frame->width != width
+        || frame->height != height
+        || frame->rtp_timestamp != (uint32_t) frame_number * 3000) {
+        return false;
+    }
+
+    for (int plane = 0; plane < 3; plane++) {
+        uint32_t plane_width = plane == 0 ? width : (width + 1) / 2;
+        uint32_t plane_height = plane == 0 ? height : (height + 1) / 2;
+
+        if ((uintptr_t) frame->data[plane] % FRAME_RING_CACHE_LINE != 0
+            || frame->linesize[plane] % FRAME_RING_CACHE_LINE != 0
+            || frame->linesize[plane] < plane_width) {
+            return false;
+        }
+
+        for (uint32_t y = 0; y < plane_height; y++) {
+            const uint8_t *row = frame->data[plane] + y * frame->linesize[plane];
+            for (uint32_t x = 0; x < plane_width; x++) {
+                if (row[x] != (uint8_t) (frame_number + plane)) return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static void test_round_trip(void) {
+    struct frame_ring *ring = frame_ring_create(ring_name, 64, 48);
+    CHECK(ring);
+    if (!ring) return;
+
+    struct frame_ring_reader *reader = frame_ring_reader_open(ring_name);
+    CHECK(reader);
+    if (reader) {
+        struct frame_ring_frame frame;
+        CHECK(!frame_ring_reader_next(reader, 0, &frame));
+
+        // Odd sizes, whose chroma planes round up
+        write_frame(ring, 63, 47, 1);
+        CHECK(frame_ring_reader_next(reader, 0, &frame));
+        CHECK(frame_matches(&frame, 63, 47, 1));
+        CHECK(frame_ring_reader_check(reader, &frame));
+        CHECK(!frame_ring_reader_next(reader, 1, &frame));
+
+        // Frames in between are skipped
+        write_frame(ring, 64, 48, 2);
+        write_frame(ring, 64, 48, 3);
+        CHECK(frame_ring_reader_next(reader, 1, &frame));
+        CHECK(frame_matches(&frame, 64, 48, 3));
+
+        CHECK(!frame_ring_reader_closed(reader));
+        frame_ring_reader_close(&reader);
+        CHECK(!reader);
+    }
+
+    frame_ring_destroy(&ring);
+    CHECK(!ring);
+
+    // Removed along with the ring
+    reader = frame_ring_reader_open(ring_name);
+    CHECK(!reader);
+    frame_ring_reader_close(&reader);
+}
+
+static void test_torn_read(void) {
+    struct frame_ring *ring = frame_ring_create(ring_name, 64, 48);
+    CHECK(ring);
+    if (!ring) return;
+
+    struct frame_ring_reader *reader = frame_ring_reader_open(ring_name);
+    CHECK(reader);
+    if (!reader) {
+        frame_ring_destroy(&ring);
+        return;
+    }
+
+    write_frame(ring, 64, 48, 1);
+    struct frame_ring_frame frame;
+    CHECK(frame_ring_reader_next(reader, 0, &frame));
+
+    // The next frame goes to another slot
+    write_frame(ring, 64, 48, 2);
+    CHECK(frame_ring_reader_check(reader, &frame));
+    CHECK(frame_matches(&frame, 64, 48, 1));
+
+    // Until the writer comes around to the slot of the frame again, which is
+    // what the reader has to notice, since the contents are not the frame's
+    // anymore
+    uint64_t frame_number = 2;
+    while (frame_ring_reader_check(reader, &frame) && frame_number < 64) {
+        write_frame(ring, 64, 48, ++frame_number);
+    }
+    CHECK(!frame_ring_reader_check(reader, &frame));
+    CHECK(!frame_matches(&frame, 64, 48, 1));
+
+    // The newest frame is still good
+    CHECK(frame_ring_reader_next(reader, 1, &frame));
+    CHECK(frame_matches(&frame, 64, 48, frame_number));
+
+    frame_ring_reader_close(&reader);
+    frame_ring_destroy(&ring);
+}
+
+static void test_grow(void) {
+    struct frame_ring *ring = frame_ring_create(ring_name, 64, 48);
+    CHECK(ring);
+    if (!ring) return;
+
+    struct frame_ring_reader *reader = frame_ring_reader_open(ring_name);
+    CHECK(reader);
+    if (!reader) {
+        frame_ring_destroy(&ring);
+        return;
+    }
+
+    write_frame(ring, 64, 48, 1);
+    CHECK(!frame_ring_reader_closed(reader));
+
+    // Does not fit, so the object is replaced
+    write_frame(ring, 320, 240, 2);
+    CHECK(frame_ring_reader_closed(reader));
+
+    // The old object keeps the frames it had
+    struct frame_ring_frame frame;
+    CHECK(frame_ring_reader_next(reader, 0, &frame));
+    CHECK(frame_matches(&frame, 64, 48, 1));
+    CHECK(!frame_ring_reader_next(reader, 1, &frame));
+    frame_ring_reader_close(&reader);
+
+    // And the new one goes on with the frame numbers
+    reader = frame_ring_reader_open(ring_name);
+    CHECK(reader);
+    if (reader) {
+        CHECK(frame_ring_reader_next(reader, 1, &frame));
+        CHECK(frame_matches(&frame, 320, 240, 2));
+
+        // Smaller frames and frames that are only narrower fit in it
+        write_frame(ring, 64, 48, 3);
+        write_frame(ring, 240, 240, 4);
+        CHECK(!frame_ring_reader_closed(reader));
+        CHECK(frame_ring_reader_next(reader, 2, &frame));
+        CHECK(frame_matches(&frame, 240, 240, 4));
+
+        frame_ring_reader_close(&reader);
+    }
+
+    frame_ring_destroy(&ring);
+}
+
+/**
+ * Creates an object by hand, with a single valid frame of 64x48 that the
+ * test then breaks in various ways.
+ */
+static struct frame_ring_header* create_object(size_t size) {
+    shm_unlink(ring_name);
+    int fd = shm_open(ring_name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) return NULL;
+
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, size) == 0) {
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    return map;
+}
+
+static void init_object(struct frame_ring_header *header, uint32_t slot_size) {
+    memset(header, 0, sizeof(struct frame_ring_header) + slot_size);
+    header->magic = FRAME_RING_MAGIC;
+    header->version = FRAME_RING_VERSION;
+    header->slot_count = 1;
+    header->slot_size = slot_size;
+    header->max_width = 64;
+    header->max_height = 48;
+    atomic_store(&header->frame_count, 1);
+
+    struct frame_ring_slot *slot = frame_ring_get_slot(header, 0);
+    atomic_store(&slot->sequence, 2);
+    slot->format = FRAME_RING_FORMAT_I420;
+    slot->frame_number = 1;
+    slot->width = 64;
+    slot->height = 48;
+
+    uint32_t offset = sizeof(struct frame_ring_slot);
+    for (int plane = 0; plane < 3; plane++) {
+        uint32_t rows = plane == 0 ? 48 : 24;
+        slot->plane_offset[plane] = offset;
+        slot->linesize[plane] = 64;
+        offset += 64 * rows;
+    }
+}
+
+static bool read_object(void) {
+    struct frame_ring_reader *reader = frame_ring_reader_open(ring_name);
+    if (!reader) return false;
+
+    struct frame_ring_frame frame;
+    bool valid = frame_ring_reader_next(reader, 0, &frame);
+    frame_ring_reader_close(&reader);
+    return valid;
+}
+
+static bool open_object(void) {
+    struct frame_ring_reader *reader = frame_ring_reader_open(ring_name);
+    bool opened = reader != NULL;
+    frame_ring_reader_close(&reader);
+    return opened;
+}
+
+static void test_bounds(void) {
+    // Three planes of 64-byte rows, 48 + 24 + 24 of them
+    uint32_t slot_size = sizeof(struct frame_ring_slot) + 64 * 96;
+    size_t size = sizeof(struct frame_ring_header) + slot_size;
+
+    struct frame_ring_header *header = create_object(size);
+    CHECK(header);
+    if (!header) return;
+    struct frame_ring_slot *slot = frame_ring_get_slot(header, 0);
+
+    init_object(header, slot_size);
+    CHECK(read_object());
+
+    // Being written
+    init_object(header, slot_size);
+    atomic_store(&slot->sequence, 3);
+    CHECK(!read_object());
+
+    // Not the newest frame, e.g. left over from before the slot was reused
+    init_object(header, slot_size);
+    slot->frame_number = 5;
+    CHECK(!read_object());
+
+    init_object(header, slot_size);
+    slot->format = 0;
+    CHECK(!read_object());
+
+    // Planes that start or end out of the slot
+    init_object(header, slot_size);
+    slot->plane_offset[2] = slot_size;
+    CHECK(!read_object());
+
+    init_object(header, slot_size);
+    slot->plane_offset[1] = UINT32_MAX;
+    CHECK(!read_object());
+
+    init_object(header, slot_size);
+    slot->height = 49;
+    CHECK(!read_object());
+
+    init_object(header, slot_size);
+    slot->height = UINT32_MAX;
+    CHECK(!read_object());
+
+    init_object(header, slot_size);
+    slot->linesize[0] = UINT32_MAX;
+    CHECK(!read_object());
+
+    // Headers that do not match the size of the object are not opened
+    init_object(header, slot_size);
+    header->slot_count = 2;
+    CHECK(!open_object());
+
+    init_object(header, slot_size);
+    header->slot_size = slot_size + 1;
+    CHECK(!open_object());
+
+    init_object(header, slot_size);
+    header->slot_count = 0;
+    CHECK(!open_object());
+
+    init_object(header, slot_size);
+    header->version = FRAME_RING_VERSION + 1;
+    CHECK(!open_object());
+
+    init_object(header, slot_size);
+    header->magic = 0;
+    CHECK(!open_object());
+
+    munmap(header, size);
+
+    // Too small to hold a header
+    header = create_object(sizeof(struct frame_ring_header) / 2);
+    CHECK(header);
+    if (header) {
+        CHECK(!open_object());
+        munmap(header, sizeof(struct frame_ring_header) / 2);
+    }
+
+    shm_unlink(ring_name);
+}
+
+int main(void) {
+    snprintf(ring_name, sizeof(ring_name), "/frame-ring-test-%ld",
+        (long) getpid());
+
+    test_round_trip();
+    test_torn_read();
+    test_grow();
+    test_bounds();
+
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,671 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/*
+ * End-to-end benchmark of the receive path over loopback, without OBS or a
+ * browser.
+ *
+ * It starts the signaling server and registers a room per peer, exactly as
+ * the sources do, but discards the decoded frames instead of handing them to
+ * OBS. Every peer is a headless libdatachannel sender that speaks the same
+ * WebSocket signaling protocol as the client page, and streams a synthetic
+ * H.264 clip that is encoded once per resolution before the runs start.
+ *
+ * Usage: webrtc-bench [--duration <seconds>] [--fps <n>] [--port <port>]
+ *                     [--resolutions <WxH,...>] [--peers <n,...>]
+ *                     [--trace <file.json>] [--udp-mux <port>]
+ *
+ * With --trace, the stages of the receive path are traced for all the runs
+ * and saved as a Chrome trace. With --udp-mux, all the receiving peer
+ * connections share a single UDP socket on the given port, 0 for any, as
+ * with the ice_udp_mux setting of the plugin.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+#include <rtc/rtc.hpp>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/opt.h>
+
+#include <obs-module.h>
+#include <util/platform.h>
+
+#include "signaling-server.h"
+#include "h264-decoder.h"
+}
+#include "rtp-parser.h"
+#include "rtp-receiver.h"
+#include "trace.h"
+#include "webrtc.h"
+
+// The page assets are not needed, the senders only use the WebSocket
+extern "C" obs_module_t *obs_current_module(void) {
+    return nullptr;
+}
+
+#define VIDEO_PAYLOAD_TYPE 96
+#define VIDEO_CLOCK_RATE 90000
+
+// How long a peer may take to connect and deliver its first frame
+#define SETUP_TIMEOUT std::chrono::seconds(10)
+
+// How long to wait for frames in flight after the senders stop
+#define DRAIN_TIME std::chrono::milliseconds(500)
+
+using Clock = std::chrono::steady_clock;
+
+struct Resolution {
+    int width;
+    int height;
+};
+
+struct BenchOptions {
+    int duration = 10;
+    int fps = 30;
+    int port = 3090;
+    std::vector<Resolution> resolutions = {
+        {640, 360},
+        {1280, 720},
+        {1920, 1080},
+    };
+    std::vector<int> peers = {1, 4, 8};
+    std::string tracePath;
+    // -1 for a socket per peer connection
+    int udpMuxPort = -1;
+};
+
+/**
+ * Encoded access units, in Annex B format, starting with a keyframe so that
+ * it can be looped.
+ */
+using Clip = std::vector<std::vector<uint8_t>>;
+
+/**
+ * Draws a moving gradient with some noise, so that the encoder has about as
+ * much work as with a real screen capture.
+ */
+static void draw_frame(AVFrame *frame, int index) {
+    for (int y = 0; y < frame->height; y++) {
+        uint8_t *row = frame->data[0] + y * frame->linesize[0];
+        for (int x = 0; x < frame->width; x++) {
+            uint32_t noise = (x * 7919u + y * 104729u + index * 31u) >> 4;
+            row[x] = (uint8_t) (x + y + index * 4 + (noise & 0xf));
+        }
+    }
+
+    for (int plane = 1; plane < 3; plane++) {
+        for (int y = 0; y < frame->height / 2; y++) {
+            uint8_t *row = frame->data[plane] + y * frame->linesize[plane];
+            memset(row, 128 + plane * 16 + index % 32, frame->width / 2);
+        }
+    }
+}
+
+/**
+ * Encodes a two second synthetic clip.
+ *
+ * @return false if no H.264 encoder is available.
+ */
+static bool encode_clip(const Resolution &resolution, int fps, Clip &clip) {
+    const AVCodec *codec = avcodec_find_encoder_by_name("libx264");
+    if (!codec) codec = avcodec_find_encoder(AV_CODEC_ID_H264);
+    if (!codec) {
+        fprintf(stderr, "No H.264 encoder is available\n");
+        return false;
+    }
+
+    AVCodecContext *ctx = avcodec_alloc_context3(codec);
+    ctx->width = resolution.width;
+    ctx->height = resolution.height;
+    ctx->time_base = (AVRational) {1, fps};
+    ctx->framerate = (AVRational) {fps, 1};
+    ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+    ctx->gop_size = fps * 2;
+    ctx->max_b_frames = 0;
+    // About what browsers use for screen sharing
+    ctx->bit_rate = (int64_t) resolution.width * resolution.height * fps / 10;
+    av_opt_set(ctx->priv_data, "preset", "veryfast", 0);
+    av_opt_set(ctx->priv_data, "tune", "zerolatency", 0);
+    av_opt_set(ctx->priv_data, "profile", "baseline", 0);
+
+    if (avcodec_open2(ctx, codec, nullptr) < 0) {
+        fprintf(stderr, "Could not open the %s encoder\n", codec->name);
+        avcodec_free_context(&ctx);
+        return false;
+    }
+
+    AVFrame *frame = av_frame_alloc();
+    frame->width = ctx->width;
+    frame->height = ctx->height;
+    frame->format = ctx->pix_fmt;
+    av_frame_get_buffer(frame, 0);
+
+    AVPacket *pkt = av_packet_alloc();
+    int frame_count = fps * 2;
+
+    clip.clear();
+    for (int i = 0; i <= frame_count; i++) {
+        if (i < frame_count) {
+            av_frame_make_writable(frame);
+            draw_frame(frame, i);
+            frame->pts = i;
+            avcodec_send_frame(ctx, frame);
+        } else {
+            // Flush the encoder
+            avcodec_send_frame(ctx, nullptr);
+        }
+
+        while (avcodec_receive_packet(ctx, pkt) == 0) {
+            clip.emplace_back(pkt->data, pkt->data + pkt->size);
+            av_packet_unref(pkt);
+        }
+    }
+
+    av_packet_free(&pkt);
+    av_frame_free(&frame);
+    avcodec_free_context(&ctx);
+
+    return !clip.empty();
+}
+
+/**
+ * Extracts a string field from a signaling message. The messages are simple
+ * enough that a full JSON parser is not needed.
+ */
+static std::string json_get_string(const std::string &json, const char *key) {
+    std::string pattern = std::string("\"") + key + "\":\"";
+    size_t pos = json.find(pattern);
+    if (pos == std::string::npos) return "";
+
+    std::string value;
+    for (pos += pattern.size(); pos < json.size() && json[pos] != '"'; pos++) {
+        char c = json[pos];
+        if (c != '\\' || pos + 1 >= json.size()) {
+            value += c;
+            continue;
+        }
+
+        switch (json[++pos]) {
+            case 'n': value += '\n'; break;
+            case 'r': value += '\r'; break;
+            case 't': value += '\t'; break;
+            case 'u':
+                value += (char) std::stoi(json.substr(pos + 1, 4), nullptr, 16);
+                pos += 4;
+                break;
+            default: value += json[pos];
+        }
+    }
+
+    return value;
+}
+
+/**
+ * The receiving end of a peer: a room with its connection and decoder, like
+ * a source without the OBS output.
+ */
+struct BenchReceiver {
+    struct signaling_room *room = nullptr;
+    struct webrtc_connection *conn = nullptr;
+    struct rtp_receiver *rtpReceiver = nullptr;
+    struct h264_decoder *decoder = nullptr;
+
+    std::atomic<uint64_t> framesDecoded = 0;
+    std::atomic<uint64_t> errors = 0;
+    std::atomic<bool> gotFirstFrame = false;
+    Clock::time_point firstFrameTime;
+};
+
+static void receiver_rtp_packet(
+    struct rtp_packet *packet,
+    uint64_t arrival_time,
+    void *data
+) {
+    auto receiver = (BenchReceiver *) data;
+    UNUSED_PARAMETER(arrival_time);
+
+    if (!rtp_process_h264_packet(receiver->decoder, packet)) {
+        receiver->errors++;
+    }
+
+    AVFrame *frame;
+    while ((frame = h264_decoder_get_frame(receiver->decoder))) {
+        if (!receiver->gotFirstFrame) {
+            receiver->firstFrameTime = Clock::now();
+            receiver->gotFirstFrame = true;
+        }
+        receiver->framesDecoded++;
+        av_frame_free(&frame);
+    }
+}
+
+static void receiver_nack(
+    uint32_t ssrc,
+    const uint16_t *sequenceNumbers,
+    size_t count,
+    void *data
+) {
+    auto receiver = (BenchReceiver *) data;
+    webrtc_connection_send_nack(receiver->conn, ssrc, sequenceNumbers, count);
+}
+
+static void receiver_video_callback(uint8_t *buffer, size_t len, void *data) {
+    auto receiver = (BenchReceiver *) data;
+    rtp_receiver_push(receiver->rtpReceiver, buffer, len, os_gettime_ns());
+}
+
+static void receiver_signal(const char *message, void *data) {
+    auto receiver = (BenchReceiver *) data;
+    signaling_room_send(receiver->room, message);
+}
+
+static void receiver_room_message(void *data, const char *message) {
+    auto receiver = (BenchReceiver *) data;
+    webrtc_connection_handle_message(receiver->conn, message);
+}
+
+static void receiver_room_disconnected(void *data) {
+    auto receiver = (BenchReceiver *) data;
+    webrtc_connection_client_disconnected(receiver->conn);
+}
+
+static const struct signaling_room_callbacks receiver_room_callbacks = {
+    nullptr,
+    receiver_room_message,
+    receiver_room_disconnected,
+};
+
+static bool receiver_start(BenchReceiver &receiver, const std::string &roomId) {
+    receiver.decoder = h264_decoder_create();
+
+    rtp_receiver_config receiverConfig = {};
+    receiverConfig.red_payload_type = WEBRTC_PAYLOAD_TYPE_RED;
+    receiverConfig.ulpfec_payload_type = WEBRTC_PAYLOAD_TYPE_ULPFEC;
+    receiverConfig.flexfec_payload_type = WEBRTC_PAYLOAD_TYPE_FLEXFEC;
+    receiverConfig.rtx[0].payload_type = WEBRTC_PAYLOAD_TYPE_RTX;
+    receiverConfig.rtx[0].associated_payload_type = WEBRTC_PAYLOAD_TYPE_H264;
+    receiverConfig.max_hold_ns = RTP_RECEIVER_DEFAULT_HOLD_NS;
+    receiver.rtpReceiver = rtp_receiver_create(
+        &receiverConfig,
+        receiver_rtp_packet,
+        &receiver
+    );
+    rtp_receiver_set_nack_callback(receiver.rtpReceiver, receiver_nack, &receiver);
+
+    webrtc_connection_config config = {};
+    config.video_callback = receiver_video_callback;
+    config.video_callback_data = &receiver;
+    config.signal_callback = receiver_signal;
+    config.signal_callback_data = &receiver;
+    receiver.conn = webrtc_connection_create(&config);
+    if (!receiver.decoder || !receiver.conn) return false;
+
+    receiver.room = signaling_server_register(
+        roomId.c_str(),
+        &receiver_room_callbacks,
+        &receiver
+    );
+    return receiver.room != nullptr;
+}
+
+static void receiver_stop(BenchReceiver &receiver) {
+    signaling_server_unregister(&receiver.room);
+    if (receiver.conn) webrtc_connection_delete(&receiver.conn);
+    if (receiver.rtpReceiver) rtp_receiver_destroy(&receiver.rtpReceiver);
+    if (receiver.decoder) h264_decoder_destroy(&receiver.decoder);
+}
+
+/**
+ * A headless guest. It connects to a room like the client page, answers the
+ * offer and streams the clip at a fixed frame rate.
+ */
+class BenchSender {
+    const Clip &clip;
+    int fps;
+
+    std::shared_ptr<rtc::WebSocket> ws;
+    std::shared_ptr<rtc::PeerConnection> pc;
+    std::shared_ptr<rtc::Track> track;
+    std::shared_ptr<rtc::RtpPacketizationConfig> rtpConfig;
+
+    std::thread thread;
+    std::atomic<bool> running = false;
+
+public:
+    std::atomic<uint64_t> framesSent = 0;
+    Clock::time_point startTime;
+
+    BenchSender(const Clip &clip, int fps) : clip(clip), fps(fps) {}
+
+    ~BenchSender() {
+        this->stop();
+    }
+
+    void start(const std::string &url, uint32_t ssrc) {
+        this->startTime = Clock::now();
+
+        this->pc = std::make_shared<rtc::PeerConnection>();
+
+        // The mid has to match the offer of the receiver
+        rtc::Description::Video media("video", rtc::Description::Direction::SendOnly);
+        media.addH264Codec(VIDEO_PAYLOAD_TYPE);
+        media.addSSRC(ssrc, "bench");
+        this->track = this->pc->addTrack(media);
+
+        this->rtpConfig = std::make_shared<rtc::RtpPacketizationConfig>(
+            ssrc, "bench", VIDEO_PAYLOAD_TYPE, VIDEO_CLOCK_RATE
+        );
+        auto packetizer = std::make_shared<rtc::H264RtpPacketizer>(
+            rtc::NalUnit::Separator::StartSequence,
+            this->rtpConfig
+        );
+        packetizer->addToChain(std::make_shared<rtc::RtcpSrReporter>(this->rtpConfig));
+        packetizer->addToChain(std::make_shared<rtc::RtcpNackResponder>());
+        this->track->setMediaHandler(packetizer);
+
+        this->track->onOpen([this]() {
+            this->running = true;
+            this->thread = std::thread(&BenchSender::sendLoop, this);
+        });
+
+        // Like the client page, the answer is sent once all candidates are in
+        this->pc->onGatheringStateChange([this](rtc::PeerConnection::GatheringState state) {
+            if (state != rtc::PeerConnection::GatheringState::Complete) return;
+
+            auto description = this->pc->localDescription();
+            if (description.has_value()) {
+                this->ws->send(std::string(description.value()));
+            }
+        });
+
+        this->ws = std::make_shared<rtc::WebSocket>();
+        this->ws->onOpen([this]() {
+            this->ws->send(std::string("ready"));
+        });
+        this->ws->onMessage(nullptr, [this](std::string message) {
+            if (json_get_string(message, "type") != "offer") return;
+
+            rtc::Description offer(json_get_string(message, "sdp"), "offer");
+            this->pc->setRemoteDescription(offer);
+        });
+        this->ws->open(url);
+    }
+
+    void stop() {
+        this->running = false;
+        if (this->thread.joinable()) {
+            this->thread.join();
+        }
+
+        if (this->ws) this->ws->close();
+        if (this->pc) this->pc->close();
+    }
+
+private:
+    void sendLoop() {
+        auto frameInterval = std::chrono::nanoseconds(1000000000 / this->fps);
+        auto nextFrame = Clock::now();
+
+        for (uint64_t i = 0; this->running; i++) {
+            const auto &accessUnit = this->clip[i % this->clip.size()];
+
+            this->rtpConfig->timestamp = this->rtpConfig->startTimestamp
+                + (uint32_t) (i * VIDEO_CLOCK_RATE / this->fps);
+
+            try {
+                this->track->send(
+                    (const std::byte *) accessUnit.data(),
+                    accessUnit.size()
+                );
+                this->framesSent++;
+            } catch (const std::exception &e) {
+                fprintf(stderr, "Sending failed: %s\n", e.what());
+                return;
+            }
+
+            nextFrame += frameInterval;
+            std::this_thread::sleep_until(nextFrame);
+        }
+    }
+};
+
+static double cpu_time_seconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+        + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static void run_scenario(
+    const BenchOptions &options,
+    const Resolution &resolution,
+    const Clip &clip,
+    int peerCount
+) {
+    std::vector<std::unique_ptr<BenchReceiver>> receivers;
+    std::vector<std::unique_ptr<BenchSender>> senders;
+
+    for (int i = 0; i < peerCount; i++) {
+        auto receiver = std::make_unique<BenchReceiver>();
+        std::string roomId = "bench-" + std::to_string(i);
+        if (!receiver_start(*receiver, roomId)) {
+            fprintf(stderr, "Could not set up room %s\n", roomId.c_str());
+            receiver_stop(*receiver);
+            return;
+        }
+        receivers.push_back(std::move(receiver));
+    }
+
+    for (int i = 0; i < peerCount; i++) {
+        auto sender = std::make_unique<BenchSender>(clip, options.fps);
+        std::string url = "ws://127.0.0.1:" + std::to_string(options.port)
+            + SIGNALING_ROOM_PREFIX + "bench-" + std::to_string(i);
+        sender->start(url, 1000 + i);
+        senders.push_back(std::move(sender));
+    }
+
+    // Wait for every peer to deliver its first frame
+    auto setupDeadline = Clock::now() + SETUP_TIMEOUT;
+    int connected = 0;
+    while (Clock::now() < setupDeadline) {
+        connected = 0;
+        for (auto &receiver : receivers) {
+            connected += receiver->gotFirstFrame;
+        }
+        if (connected == peerCount) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    double setupTotal = 0, setupMax = 0;
+    for (int i = 0; i < peerCount; i++) {
+        if (!receivers[i]->gotFirstFrame) continue;
+
+        double setup = std::chrono::duration<double, std::milli>(
+            receivers[i]->firstFrameTime - senders[i]->startTime
+        ).count();
+        setupTotal += setup;
+        if (setup > setupMax) setupMax = setup;
+    }
+
+    // The steady state
+    uint64_t decodedBefore = 0;
+    for (auto &receiver : receivers) decodedBefore += receiver->framesDecoded;
+    double cpuBefore = cpu_time_seconds();
+    auto steadyStart = Clock::now();
+
+    std::this_thread::sleep_for(std::chrono::seconds(options.duration));
+
+    uint64_t decodedAfter = 0;
+    for (auto &receiver : receivers) decodedAfter += receiver->framesDecoded;
+    double cpu = cpu_time_seconds() - cpuBefore;
+    double elapsed = std::chrono::duration<double>(Clock::now() - steadyStart).count();
+
+    for (auto &sender : senders) sender->stop();
+    std::this_thread::sleep_for(DRAIN_TIME);
+
+    uint64_t sent = 0, decoded = 0, errors = 0;
+    for (auto &sender : senders) sent += sender->framesSent;
+    for (auto &receiver : receivers) {
+        decoded += receiver->framesDecoded;
+        errors += receiver->errors;
+    }
+
+    uint64_t steadyFrames = decodedAfter - decodedBefore;
+    double fpsPerPeer = steadyFrames / elapsed / peerCount;
+    double cpuPerFrame = steadyFrames ? cpu * 1000 / steadyFrames : 0;
+
+    printf("%5dx%-5d %5d %9d %9.1f %9.1f %9.1f %9llu %9llu %12.3f\n",
+        resolution.width, resolution.height, peerCount, connected,
+        connected ? setupTotal / connected : 0.0, setupMax, fpsPerPeer,
+        (unsigned long long) (sent > decoded ? sent - decoded : 0),
+        (unsigned long long) errors, cpuPerFrame);
+    fflush(stdout);
+
+    senders.clear();
+    for (auto &receiver : receivers) receiver_stop(*receiver);
+}
+
+template <typename T, typename Parse>
+static std::vector<T> parse_list(const char *arg, Parse parse) {
+    std::vector<T> list;
+    std::string str(arg);
+    size_t start = 0;
+    while (start <= str.size()) {
+        size_t end = str.find(',', start);
+        if (end == std::string::npos) end = str.size();
+        list.push_back(parse(str.substr(start, end - start)));
+        start = end + 1;
+    }
+    return list;
+}
+
+static void print_usage(const char *program) {
+    fprintf(stderr,
+        "Usage: %s [--duration <seconds>] [--fps <n>] [--port <port>]\n"
+        "       [--resolutions <WxH,...>] [--peers <n,...>]\n"
+        "       [--trace <file.json>] [--udp-mux <port>]\n", program);
+}
+
+int main(int argc, char **argv) {
+    BenchOptions options;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            print_usage(argv[0]);
+            return 1;
+        }
+
+        const char *value = argv[++i];
+        if (arg == "--duration") {
+            options.duration = atoi(value);
+        } else if (arg == "--fps") {
+            options.fps = atoi(value);
+        } else if (arg == "--port") {
+            options.port = atoi(value);
+        } else if (arg == "--resolutions") {
+            options.resolutions = parse_list<Resolution>(value, [](std::string s) {
+                Resolution resolution = {};
+                sscanf(s.c_str(), "%dx%d", &resolution.width, &resolution.height);
+                return resolution;
+            });
+        } else if (arg == "--peers") {
+            options.peers = parse_list<int>(value, [](std::string s) {
+                return atoi(s.c_str());
+            });
+        } else if (arg == "--trace") {
+            options.tracePath = value;
+        } else if (arg == "--udp-mux") {
+            options.udpMuxPort = atoi(value);
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (options.duration <= 0 || options.fps <= 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // Only errors, the connections are very chatty otherwise
+    base_set_log_handler(
+        [](int level, const char *format, va_list args, void *) {
+            if (level <= LOG_ERROR) {
+                vfprintf(stderr, format, args);
+                fputc('\n', stderr);
+            }
+        },
+        nullptr
+    );
+
+    // The senders create their peer connections themselves, so only the
+    // receivers share the socket
+    webrtc_ice_config ice = {};
+    if (options.udpMuxPort >= 0) {
+        ice.udp_mux = true;
+        ice.port_range_begin = options.udpMuxPort;
+        ice.port_range_end = options.udpMuxPort;
+    }
+    webrtc_init("error", &ice);
+    if (!signaling_server_start(options.port)) {
+        fprintf(stderr, "Could not start the server on port %d\n", options.port);
+        return 1;
+    }
+
+    if (!options.tracePath.empty()) {
+        trace_start();
+    }
+
+    printf("%-11s %5s %9s %9s %9s %9s %9s %9s %12s\n",
+        "resolution", "peers", "connected", "setup ms", "setup max",
+        "fps/peer", "dropped", "errors", "cpu ms/frame");
+
+    for (const auto &resolution : options.resolutions) {
+        Clip clip;
+        if (!encode_clip(resolution, options.fps, clip)) break;
+
+        for (int peerCount : options.peers) {
+            run_scenario(options, resolution, clip, peerCount);
+        }
+    }
+
+    signaling_server_stop();
+    webrtc_shutdown();
+
+    if (!options.tracePath.empty()) {
+        trace_stop();
+        if (!trace_save(options.tracePath.c_str())) {
+            fprintf(stderr, "Could not save the trace to %s\n",
+                options.tracePath.c_str());
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,169 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/*
+ * Reads the video that a source shares with the "Share the decoded video"
+ * setting, as an example of frame-ring-reader and to check that the frames
+ * come through. Reports the frame rate every second until it is
+ * interrupted.
+ *
+ * Usage: webrtc-frames [--output <file.yuv>] <room>
+ *
+ * With --output, the frames are also written to a raw I420 file, which
+ * e.g. ffplay can play given the size that is reported.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "frame-ring-reader.h"
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_interrupt(int signal) {
+    (void) signal;
+    interrupted = 1;
+}
+
+static void sleep_ms(long ms) {
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000};
+    nanosleep(&ts, NULL);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void write_frame(FILE *file, const struct frame_ring_frame *frame) {
+    for (int plane = 0; plane < 3; plane++) {
+        uint32_t width = plane == 0 ? frame->width : (frame->width + 1) / 2;
+        uint32_t height = plane == 0 ? frame->height : (frame->height + 1) / 2;
+
+        for (uint32_t y = 0; y < height; y++) {
+            fwrite(frame->data[plane] + y * frame->linesize[plane], 1, width, file);
+        }
+    }
+}
+
+static void print_usage(const char *program) {
+    fprintf(stderr, "Usage: %s [--output <file.yuv>] <room>\n", program);
+}
+
+int main(int argc, char **argv) {
+    const char *room = NULL;
+    const char *output_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (!room) {
+            room = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!room) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    FILE *output = NULL;
+    if (output_path) {
+        output = fopen(output_path, "wb");
+        if (!output) {
+            perror(output_path);
+            return 1;
+        }
+    }
+
+    char name[128];
+    snprintf(name, sizeof(name), "/obs-webrtc-%s", room);
+
+    signal(SIGINT, on_interrupt);
+    signal(SIGTERM, on_interrupt);
+
+    struct frame_ring_reader *reader = NULL;
+    uint64_t last_frame = 0;
+    uint32_t width = 0, height = 0;
+
+    // Since the last report
+    uint64_t report_time = now_ns();
+    unsigned frames = 0, skipped = 0, torn = 0;
+
+    while (!interrupted) {
+        if (!reader || frame_ring_reader_closed(reader)) {
+            // The object is replaced when the frames outgrow it, and does
+            // not exist while sharing is off
+            frame_ring_reader_close(&reader);
+            reader = frame_ring_reader_open(name);
+            if (!reader) {
+                sleep_ms(100);
+                continue;
+            }
+        }
+
+        struct frame_ring_frame frame;
+        if (!frame_ring_reader_next(reader, last_frame, &frame)) {
+            sleep_ms(1);
+            continue;
+        }
+
+        if (output) {
+            write_frame(output, &frame);
+        }
+
+        if (!frame_ring_reader_check(reader, &frame)) {
+            // Overwritten while it was being written out, which leaves a
+            // broken frame in the file
+            torn++;
+            continue;
+        }
+
+        if (last_frame != 0 && frame.frame_number > last_frame + 1) {
+            skipped += frame.frame_number - last_frame - 1;
+        }
+        last_frame = frame.frame_number;
+        frames++;
+
+        if (frame.width != width || frame.height != height) {
+            width = frame.width;
+            height = frame.height;
+            printf("%ux%u\n", width, height);
+        }
+
+        uint64_t now = now_ns();
+        if (now - report_time >= 1000000000ULL) {
+            printf("%.1f fps, %u skipped, %u torn\n",
+                frames * 1e9 / (now - report_time), skipped, torn);
+            report_time = now;
+            frames = skipped = torn = 0;
+        }
+    }
+
+    frame_ring_reader_close(&reader);
+    if (output) {
+        fclose(output);
+    }
+    return 0;
+}
@@ -0,0 +1,561 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/*
+ * Load test of the HTTP server over loopback, without OBS or a browser.
+ *
+ * It starts the server of the plugin, with a WebSocket handler that echoes
+ * the messages back, and drives it from a thread per client connection in
+ * three modes:
+ *
+ * - keep-alive: requests on persistent HTTP/1.1 connections
+ * - close: a new connection for every request, as browsers that do not
+ *   reuse connections do, which loads the accept queue
+ * - websocket: text messages on upgraded connections, as in signaling
+ *
+ * Outside of OBS there are no client assets, so the requests get 404
+ * responses, which go through the same parsing and sending as the page.
+ *
+ * Usage: webrtc-http-bench [--duration <seconds>] [--port <port>]
+ *                          [--connections <n,...>] [--pipeline <n>]
+ *
+ * With --pipeline, every client sends that many requests or messages before
+ * it waits for the responses.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <obs-module.h>
+#include <util/platform.h>
+
+#include "http-server.h"
+
+// There are no page assets to load, see above
+obs_module_t *obs_current_module(void) {
+    return NULL;
+}
+
+// macOS has no MSG_NOSIGNAL, SIGPIPE is turned off per socket there instead
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define MAX_CONNECTION_COUNTS 16
+#define MAX_PIPELINE 64
+#define RECEIVE_BUFFER_SIZE 65536
+
+// How long a client waits for a response before it counts an error
+#define RECEIVE_TIMEOUT_MS 2000
+
+// A signaling message of a typical size
+#define WS_MESSAGE_SIZE 100
+
+enum bench_mode {
+    BENCH_MODE_KEEP_ALIVE,
+    BENCH_MODE_CLOSE,
+    BENCH_MODE_WEBSOCKET,
+};
+
+static const char *mode_names[] = {"keep-alive", "close", "websocket"};
+
+struct bench_options {
+    int duration;
+    int port;
+    int connections[MAX_CONNECTION_COUNTS];
+    int connection_count;
+    int pipeline;
+};
+
+struct bench_client {
+    pthread_t thread;
+    enum bench_mode mode;
+    const struct bench_options *options;
+    uint64_t end_time;
+
+    // Null-terminated, for looking for the end of the headers
+    uint8_t buffer[RECEIVE_BUFFER_SIZE + 1];
+    size_t buffer_len;
+
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t latency_sum_ns;
+    uint64_t latency_max_ns;
+};
+
+static struct http_server *server = NULL;
+
+static bool echo_open(void *data, uint64_t connection_id, const char *path) {
+    UNUSED_PARAMETER(data);
+    UNUSED_PARAMETER(connection_id);
+    UNUSED_PARAMETER(path);
+    return true;
+}
+
+static void echo_message(
+    void *data,
+    uint64_t connection_id,
+    const char *message,
+    size_t len
+) {
+    UNUSED_PARAMETER(data);
+    http_server_ws_send(server, connection_id, message, len);
+}
+
+static void echo_close(void *data, uint64_t connection_id) {
+    UNUSED_PARAMETER(data);
+    UNUSED_PARAMETER(connection_id);
+}
+
+static const struct http_server_ws_callbacks echo_callbacks = {
+    .open = echo_open,
+    .message = echo_message,
+    .close = echo_close,
+};
+
+static int client_connect(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    struct timeval timeout = {
+        .tv_sec = RECEIVE_TIMEOUT_MS / 1000,
+        .tv_usec = (RECEIVE_TIMEOUT_MS % 1000) * 1000,
+    };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    // Requests are small and sent whole, do not hold them back
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Closes with a reset, so that the client ports of the close mode do not
+ * pile up in TIME_WAIT.
+ */
+static void client_abort(int fd) {
+    struct linger linger = {.l_onoff = 1, .l_linger = 0};
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    close(fd);
+}
+
+static bool send_all(int fd, const void *data, size_t len) {
+    const uint8_t *bytes = data;
+    while (len > 0) {
+        ssize_t sent = send(fd, bytes, len, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        bytes += sent;
+        len -= sent;
+    }
+    return true;
+}
+
+static bool client_receive(struct bench_client *client, int fd) {
+    if (client->buffer_len == RECEIVE_BUFFER_SIZE) return false;
+
+    ssize_t received = recv(fd, client->buffer + client->buffer_len,
+        RECEIVE_BUFFER_SIZE - client->buffer_len, 0);
+    if (received < 0 && errno == EINTR) return true;
+    if (received <= 0) return false;
+
+    client->buffer_len += received;
+    client->buffer[client->buffer_len] = '\0';
+    return true;
+}
+
+static void client_consume(struct bench_client *client, size_t len) {
+    memmove(client->buffer, client->buffer + len, client->buffer_len - len);
+    client->buffer_len -= len;
+    client->buffer[client->buffer_len] = '\0';
+}
+
+/**
+ * Reads a response, including its body, and gets its status code.
+ */
+static bool read_response(struct bench_client *client, int fd, int *status) {
+    while (1) {
+        char *headers = (char*) client->buffer;
+        char *headers_end = strstr(headers, "\r\n\r\n");
+
+        if (headers_end) {
+            size_t header_len = headers_end + 4 - headers;
+            size_t content_length = 0;
+
+            // Look for the header within the headers only
+            *headers_end = '\0';
+            if (sscanf(headers, "HTTP/1.1 %d", status) != 1) return false;
+
+            for (char *line = strstr(headers, "\r\n"); line;
+                line = strstr(line + 2, "\r\n")) {
+                if (strncasecmp(line + 2, "Content-Length:", 15) == 0) {
+                    content_length = strtoul(line + 17, NULL, 10);
+                }
+            }
+            *headers_end = '\r';
+
+            if (header_len + content_length > RECEIVE_BUFFER_SIZE) {
+                return false;
+            }
+
+            while (client->buffer_len < header_len + content_length) {
+                if (!client_receive(client, fd)) return false;
+            }
+
+            client_consume(client, header_len + content_length);
+            return true;
+        }
+
+        if (!client_receive(client, fd)) return false;
+    }
+}
+
+/**
+ * Reads a text frame from the server, which never masks them.
+ */
+static bool read_ws_message(struct bench_client *client, int fd) {
+    while (client->buffer_len < 2) {
+        if (!client_receive(client, fd)) return false;
+    }
+
+    // The messages are echoed, so they have the size of the ones sent
+    uint8_t *frame = client->buffer;
+    if (frame[0] != (0x80 | 0x1) || frame[1] != WS_MESSAGE_SIZE) return false;
+
+    while (client->buffer_len < 2 + WS_MESSAGE_SIZE) {
+        if (!client_receive(client, fd)) return false;
+    }
+
+    client_consume(client, 2 + WS_MESSAGE_SIZE);
+    return true;
+}
+
+static bool client_upgrade(struct bench_client *client, int fd) {
+    // The example key of RFC 6455
+    const char request[] =
+        "GET /bench HTTP/1.1\r\n"
+        "Host: 127.0.0.1\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+        "Sec-WebSocket-Version: 13\r\n"
+        "\r\n";
+
+    int status = 0;
+    return send_all(fd, request, sizeof(request) - 1)
+        && read_response(client, fd, &status)
+        && status == 101;
+}
+
+/**
+ * Writes a masked text frame, as clients have to send them.
+ *
+ * @return The size of the frame.
+ */
+static size_t write_ws_message(uint8_t *frame, uint64_t counter) {
+    const uint8_t mask[4] = {0x12, 0x34, 0x56, 0x78};
+
+    char payload[WS_MESSAGE_SIZE + 1];
+    int len = snprintf(payload, sizeof(payload),
+        "{\"type\":\"candidate\",\"counter\":%020llu}",
+        (unsigned long long) counter);
+    memset(payload + len, ' ', WS_MESSAGE_SIZE - len);
+
+    frame[0] = 0x80 | 0x1;
+    frame[1] = 0x80 | WS_MESSAGE_SIZE;
+    memcpy(frame + 2, mask, 4);
+    for (size_t i = 0; i < WS_MESSAGE_SIZE; i++) {
+        frame[6 + i] = payload[i] ^ mask[i % 4];
+    }
+
+    return 6 + WS_MESSAGE_SIZE;
+}
+
+static void client_add_latency(struct bench_client *client, uint64_t start) {
+    uint64_t latency = os_gettime_ns() - start;
+    client->latency_sum_ns += latency;
+    if (latency > client->latency_max_ns) client->latency_max_ns = latency;
+}
+
+static void run_keep_alive(struct bench_client *client, bool reconnect) {
+    const char request[] =
+        "GET /bench HTTP/1.1\r\n"
+        "Host: 127.0.0.1\r\n"
+        "\r\n";
+
+    int pipeline = client->options->pipeline;
+    int fd = -1;
+
+    while (os_gettime_ns() < client->end_time) {
+        if (fd < 0) {
+            fd = client_connect(client->options->port);
+            client->buffer_len = 0;
+            client->buffer[0] = '\0';
+            if (fd < 0) {
+                client->errors++;
+                continue;
+            }
+        }
+
+        uint64_t start = os_gettime_ns();
+        bool ok = true;
+        for (int i = 0; i < pipeline && ok; i++) {
+            ok = send_all(fd, request, sizeof(request) - 1);
+        }
+        for (int i = 0; i < pipeline && ok; i++) {
+            int status = 0;
+            ok = read_response(client, fd, &status)
+                && (status == 200 || status == 404);
+            if (ok) {
+                client->requests++;
+                client_add_latency(client, start);
+            }
+        }
+
+        if (!ok) client->errors++;
+        if (!ok || reconnect) {
+            client_abort(fd);
+            fd = -1;
+        }
+    }
+
+    if (fd >= 0) close(fd);
+}
+
+static void run_websocket(struct bench_client *client) {
+    uint8_t frames[MAX_PIPELINE * (6 + WS_MESSAGE_SIZE)];
+    int pipeline = client->options->pipeline;
+    int fd = -1;
+
+    while (os_gettime_ns() < client->end_time) {
+        if (fd < 0) {
+            fd = client_connect(client->options->port);
+            client->buffer_len = 0;
+            client->buffer[0] = '\0';
+            if (fd < 0 || !client_upgrade(client, fd)) {
+                if (fd >= 0) client_abort(fd);
+                fd = -1;
+                client->errors++;
+                continue;
+            }
+        }
+
+        size_t len = 0;
+        for (int i = 0; i < pipeline; i++) {
+            len += write_ws_message(frames + len, client->requests + i);
+        }
+
+        uint64_t start = os_gettime_ns();
+        bool ok = send_all(fd, frames, len);
+        for (int i = 0; i < pipeline && ok; i++) {
+            ok = read_ws_message(client, fd);
+            if (ok) {
+                client->requests++;
+                client_add_latency(client, start);
+            }
+        }
+
+        if (!ok) {
+            client->errors++;
+            client_abort(fd);
+            fd = -1;
+        }
+    }
+
+    if (fd >= 0) close(fd);
+}
+
+static void* client_thread(void *data) {
+    struct bench_client *client = data;
+
+    switch (client->mode) {
+        case BENCH_MODE_KEEP_ALIVE: run_keep_alive(client, false); break;
+        case BENCH_MODE_CLOSE: run_keep_alive(client, true); break;
+        case BENCH_MODE_WEBSOCKET: run_websocket(client); break;
+    }
+
+    return NULL;
+}
+
+static void run_scenario(
+    const struct bench_options *options,
+    enum bench_mode mode,
+    int connections
+) {
+    struct bench_client *clients =
+        bzalloc(connections * sizeof(struct bench_client));
+
+    uint64_t start = os_gettime_ns();
+    uint64_t end_time = start + options->duration * 1000000000ULL;
+
+    int started = 0;
+    for (int i = 0; i < connections; i++) {
+        clients[i].mode = mode;
+        clients[i].options = options;
+        clients[i].end_time = end_time;
+
+        if (pthread_create(&clients[i].thread, NULL, client_thread,
+            &clients[i]) != 0) {
+            fprintf(stderr, "Could not start client %d\n", i);
+            break;
+        }
+        started++;
+    }
+
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+    uint64_t latency_sum_ns = 0;
+    uint64_t latency_max_ns = 0;
+    for (int i = 0; i < started; i++) {
+        pthread_join(clients[i].thread, NULL);
+        requests += clients[i].requests;
+        errors += clients[i].errors;
+        latency_sum_ns += clients[i].latency_sum_ns;
+        if (clients[i].latency_max_ns > latency_max_ns) {
+            latency_max_ns = clients[i].latency_max_ns;
+        }
+    }
+
+    double seconds = (os_gettime_ns() - start) / 1e9;
+    printf("%-10s %11d %12.0f %9.3f %9.3f %9llu\n",
+        mode_names[mode], started,
+        requests / seconds,
+        requests > 0 ? latency_sum_ns / 1e6 / requests : 0.0,
+        latency_max_ns / 1e6,
+        (unsigned long long) errors);
+
+    bfree(clients);
+}
+
+static int parse_connections(const char *value, int *connections) {
+    int count = 0;
+    const char *start = value;
+    while (*start && count < MAX_CONNECTION_COUNTS) {
+        connections[count++] = atoi(start);
+        const char *comma = strchr(start, ',');
+        if (!comma) break;
+        start = comma + 1;
+    }
+    return count;
+}
+
+static void log_errors(int level, const char *format, va_list args, void *param) {
+    UNUSED_PARAMETER(param);
+    if (level <= LOG_ERROR) {
+        vfprintf(stderr, format, args);
+        fputc('\n', stderr);
+    }
+}
+
+static void print_usage(const char *program) {
+    fprintf(stderr,
+        "Usage: %s [--duration <seconds>] [--port <port>]\n"
+        "       [--connections <n,...>] [--pipeline <n>]\n", program);
+}
+
+int main(int argc, char **argv) {
+    struct bench_options options = {
+        .duration = 5,
+        .port = 3091,
+        .connections = {1, 16, 64},
+        .connection_count = 3,
+        .pipeline = 1,
+    };
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            print_usage(argv[0]);
+            return 1;
+        }
+
+        const char *arg = argv[i];
+        const char *value = argv[++i];
+        if (strcmp(arg, "--duration") == 0) {
+            options.duration = atoi(value);
+        } else if (strcmp(arg, "--port") == 0) {
+            options.port = atoi(value);
+        } else if (strcmp(arg, "--connections") == 0) {
+            options.connection_count =
+                parse_connections(value, options.connections);
+        } else if (strcmp(arg, "--pipeline") == 0) {
+            options.pipeline = atoi(value);
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (options.duration <= 0 || options.pipeline <= 0
+        || options.pipeline > MAX_PIPELINE) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    for (int i = 0; i < options.connection_count; i++) {
+        if (options.connections[i] <= 0) {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Only errors, the server logs every connection otherwise
+    base_set_log_handler(log_errors, NULL);
+
+    server = http_server_create(options.port, &echo_callbacks, NULL);
+    if (!server) {
+        fprintf(stderr, "Could not start the server on port %d\n", options.port);
+        return 1;
+    }
+
+    printf("%-10s %11s %12s %9s %9s %9s\n",
+        "mode", "connections", "requests/s", "mean ms", "max ms", "errors");
+
+    for (int mode = BENCH_MODE_KEEP_ALIVE; mode <= BENCH_MODE_WEBSOCKET; mode++) {
+        for (int i = 0; i < options.connection_count; i++) {
+            run_scenario(&options, mode, options.connections[i]);
+        }
+    }
+
+    http_server_destroy(&server);
+    return 0;
+}
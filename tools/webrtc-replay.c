@@ -0,0 +1,253 @@
+/*
+OBS WebRTC Source
+Copyright (C) 2024 Achilleas Michailidis <achmichail@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/*
+ * Replays an RTP capture made with the rtp_capture_dir option through the
+ * receive path of the plugin (parsing, FEC recovery, reordering,
+ * depacketization and decoding) without
+ * OBS or a browser, and reports how it went.
+ *
+ * Usage: webrtc-replay [--realtime] <capture.rtpdump>
+ *
+ * By default the packets are processed as fast as possible, to measure
+ * throughput. With --realtime they are processed at the times they arrived,
+ * to reproduce timing-dependent problems.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <obs.h>
+#include <util/platform.h>
+
+#include "rtpdump.h"
+#include "rtp-parser.h"
+#include "rtp-receiver.h"
+#include "webrtc.h"
+#include "h264-decoder.h"
+#include "latency-stats.h"
+
+struct replay_counters {
+    uint64_t rtp_packets;
+    uint64_t rtcp_packets;
+    uint64_t bytes;
+    uint64_t frames;
+
+    uint64_t malformed_packets;
+    uint64_t decode_errors;
+};
+
+struct replay {
+    struct h264_decoder *decoder;
+    struct latency_stats *stats;
+    struct replay_counters counters;
+};
+
+static void replay_rtp_packet(
+    struct rtp_packet *rtp,
+    uint64_t arrival_time,
+    void *data
+) {
+    struct replay *replay = data;
+    UNUSED_PARAMETER(arrival_time);
+
+    // The arrival times are from the capture, measure the replay instead
+    uint64_t received = os_gettime_ns();
+    latency_stats_packet_received(
+        replay->stats,
+        rtp->timestamp,
+        received,
+        received
+    );
+
+    if (!rtp_process_h264_packet(replay->decoder, rtp)) {
+        replay->counters.decode_errors++;
+    }
+
+    AVFrame *frame;
+    while ((frame = h264_decoder_get_frame(replay->decoder))) {
+        uint64_t now = os_gettime_ns();
+        uint32_t rtp_timestamp = (uint32_t) frame->pts;
+
+        latency_stats_frame_decoded(replay->stats, rtp_timestamp, now);
+        latency_stats_frame_output(replay->stats, rtp_timestamp, now);
+
+        replay->counters.frames++;
+        av_frame_free(&frame);
+    }
+}
+
+static void replay_access_unit(
+    const struct h264_access_unit *access_unit,
+    void *data
+) {
+    struct replay *replay = data;
+    latency_stats_frame_decoding(
+        replay->stats,
+        access_unit->rtp_timestamp,
+        os_gettime_ns()
+    );
+}
+
+static void print_percentiles(
+    const char *name,
+    const struct latency_percentiles *percentiles
+) {
+    printf("  %-14s p50 %7.2f ms  p95 %7.2f ms  p99 %7.2f ms\n",
+        name, percentiles->p50, percentiles->p95, percentiles->p99);
+}
+
+static void print_usage(const char *program) {
+    fprintf(stderr, "Usage: %s [--realtime] <capture.rtpdump>\n", program);
+}
+
+int main(int argc, char **argv) {
+    bool realtime = false;
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--realtime") == 0) {
+            realtime = true;
+        } else if (!path) {
+            path = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!path) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    struct rtpdump_reader *reader = rtpdump_reader_open(path);
+    if (!reader) return 1;
+
+    struct replay replay = {0};
+    replay.decoder = h264_decoder_create();
+    if (!replay.decoder) {
+        rtpdump_reader_close(&reader);
+        return 1;
+    }
+    h264_decoder_set_access_unit_callback(
+        replay.decoder,
+        replay_access_unit,
+        &replay
+    );
+    replay.stats = latency_stats_create();
+
+    // Holds are timed with the arrival times from the capture, so that gaps
+    // are given up on as they were live, however fast the replay is
+    struct rtp_receiver_config receiver_conf = {
+        .red_payload_type = WEBRTC_PAYLOAD_TYPE_RED,
+        .ulpfec_payload_type = WEBRTC_PAYLOAD_TYPE_ULPFEC,
+        .flexfec_payload_type = WEBRTC_PAYLOAD_TYPE_FLEXFEC,
+        .rtx = {
+            {WEBRTC_PAYLOAD_TYPE_RTX, WEBRTC_PAYLOAD_TYPE_H264},
+            {WEBRTC_PAYLOAD_TYPE_RTX_MAIN, WEBRTC_PAYLOAD_TYPE_H264_MAIN},
+            {WEBRTC_PAYLOAD_TYPE_RTX_HIGH, WEBRTC_PAYLOAD_TYPE_H264_HIGH},
+        },
+        .max_hold_ns = RTP_RECEIVER_DEFAULT_HOLD_NS,
+    };
+    struct rtp_receiver *receiver = rtp_receiver_create(
+        &receiver_conf,
+        replay_rtp_packet,
+        &replay
+    );
+
+    struct replay_counters *counters = &replay.counters;
+    struct rtpdump_packet *packet = bmalloc(sizeof(struct rtpdump_packet));
+
+    uint64_t start_time = os_gettime_ns();
+
+    while (rtpdump_reader_next(reader, packet)) {
+        uint64_t arrival_time = start_time + (uint64_t) packet->time * 1000000;
+        if (realtime) {
+            os_sleepto_ns(arrival_time);
+        }
+
+        if (packet->rtcp) {
+            counters->rtcp_packets++;
+            continue;
+        }
+
+        counters->rtp_packets++;
+        counters->bytes += packet->len;
+
+        struct rtp_packet *rtp = rtp_packet_parse(packet->data, packet->len);
+        if (!rtp) {
+            counters->malformed_packets++;
+            continue;
+        }
+        rtp_packet_free(rtp);
+
+        rtp_receiver_push(receiver, packet->data, packet->len, arrival_time);
+    }
+
+    double elapsed = (os_gettime_ns() - start_time) / 1000000000.0;
+
+    struct latency_report report;
+    latency_stats_get_report(replay.stats, &report);
+
+    struct rtp_receiver_stats receiver_stats;
+    rtp_receiver_get_stats(receiver, &receiver_stats);
+
+    printf("Replayed %s in %.3f s (%s)\n", path, elapsed,
+        realtime ? "real time" : "as fast as possible");
+    printf("  RTP packets    %llu (%.0f/s)\n",
+        (unsigned long long) counters->rtp_packets,
+        counters->rtp_packets / elapsed);
+    printf("  RTCP packets   %llu\n",
+        (unsigned long long) counters->rtcp_packets);
+    printf("  Data           %.2f MB (%.2f Mbit/s)\n",
+        counters->bytes / 1000000.0, counters->bytes * 8 / elapsed / 1000000.0);
+    printf("  Frames         %llu (%.1f/s)\n",
+        (unsigned long long) counters->frames, counters->frames / elapsed);
+
+    printf("Latency of the last %zu frames\n", report.decode.count);
+    print_percentiles("jitter buffer", &report.jitter_buffer);
+    print_percentiles("queue", &report.queue);
+    print_percentiles("decode", &report.decode);
+
+    printf("Repairs\n");
+    printf("  FEC packets    %llu\n",
+        (unsigned long long) receiver_stats.fec_received);
+    printf("  Recovered      %llu\n",
+        (unsigned long long) receiver_stats.recovered);
+    printf("  Retransmitted  %llu\n",
+        (unsigned long long) receiver_stats.retransmitted);
+
+    printf("Errors\n");
+    printf("  Malformed      %llu\n",
+        (unsigned long long) counters->malformed_packets);
+    printf("  Decoding       %llu\n",
+        (unsigned long long) counters->decode_errors);
+    printf("  Lost packets   %llu\n",
+        (unsigned long long) receiver_stats.lost);
+    printf("  Discarded      %llu\n",
+        (unsigned long long) receiver_stats.discarded);
+
+    bfree(packet);
+    rtp_receiver_destroy(&receiver);
+    latency_stats_destroy(&replay.stats);
+    h264_decoder_destroy(&replay.decoder);
+    rtpdump_reader_close(&reader);
+
+    return 0;
+}